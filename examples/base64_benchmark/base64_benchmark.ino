@@ -0,0 +1,83 @@
+/**
+ * @file    base64_benchmark.ino
+ * @author  jihun kang
+ * @date    2026-10-14
+ * @brief   터널 body base64 codec 마이크로 벤치마크
+ *
+ * @details
+ * WiFi 없이 OrbiSyncBase64 encode/decode 속도를 측정합니다.
+ * 터널 기본 최대 body(4096B)와 응답 chunk(2048B) 크기로 반복 실행 후
+ * 호출당 µs와 MB/s를 Serial로 출력합니다.
+ *
+ * - encode: 응답 body → base64 (proxy_response)
+ * - decode: 요청 base64 → body, in-place (proxy_request)
+ * - 결과 일치(round-trip) 검증
+ *
+ * 본 코드는 OrbiSync 오픈소스 프로젝트의 일부입니다.
+ * 라이선스 및 사용 조건은 LICENSE 파일을 참고하세요.
+ */
+
+#include <Arduino.h>
+#include <OrbiSyncBase64.h>
+
+static const size_t kMaxBody = 4096;
+static const uint16_t kIterations = 200;
+
+static uint8_t s_body[kMaxBody];
+static char s_b64[((kMaxBody + 2) / 3) * 4 + 1];
+static char s_work[sizeof(s_b64)];
+
+static void benchSize(size_t n) {
+  // encode
+  uint32_t t0 = micros();
+  size_t encLen = 0;
+  for (uint16_t i = 0; i < kIterations; i++) {
+    encLen = OrbiSyncNode::base64Encode(s_b64, s_body, n);
+  }
+  uint32_t encUs = micros() - t0;
+  yield();
+
+  // decode (in-place: 매번 base64 원본을 복사해 둔 뒤 그 자리에 decode)
+  uint32_t copyUs = 0;
+  uint32_t decUs = 0;
+  size_t decLen = 0;
+  for (uint16_t i = 0; i < kIterations; i++) {
+    uint32_t c0 = micros();
+    memcpy(s_work, s_b64, encLen + 1);
+    uint32_t c1 = micros();
+    decLen = OrbiSyncNode::base64Decode((uint8_t*)s_work, s_work, encLen);
+    decUs += micros() - c1;
+    copyUs += c1 - c0;
+  }
+  yield();
+
+  bool ok = (decLen == n) && memcmp(s_work, s_body, n) == 0;
+
+  float encPer = (float)encUs / kIterations;
+  float decPer = (float)decUs / kIterations;
+  Serial.printf("[B64] n=%u encode %.1fus (%.2f MB/s)  decode %.1fus (%.2f MB/s)  memcpy %.1fus  %s\n",
+                (unsigned)n,
+                encPer, encPer > 0 ? n / encPer : 0.0f,
+                decPer, decPer > 0 ? n / decPer : 0.0f,
+                (float)copyUs / kIterations,
+                ok ? "OK" : "MISMATCH");
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(200);
+  Serial.println();
+  Serial.printf("[B64] cpu=%uMHz iterations=%u\n", (unsigned)ESP.getCpuFreqMHz(), (unsigned)kIterations);
+
+  randomSeed(12345);
+  for (size_t i = 0; i < kMaxBody; i++) s_body[i] = (uint8_t)random(256);
+
+  static const size_t kSizes[] = {64, 512, 2048, 4096};
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); i++) {
+    benchSize(kSizes[i]);
+  }
+}
+
+void loop() {
+  delay(1000);
+}
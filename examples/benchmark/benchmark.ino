@@ -0,0 +1,174 @@
+/**
+ * @file    benchmark.ino
+ * @author  jihun kang
+ * @date    2026-10-14
+ * @brief   터널 요청 처리 성능 벤치마크 (on-device)
+ *
+ * @details
+ * WiFi/Hub 없이 합성 터널 frame을 injectTunnelFrame()으로 주입하고
+ * 응답 frame은 setTunnelTap()으로 받아 버립니다 (loopback).
+ * frame 종류별로 N회 반복 후 다음을 Serial로 출력합니다.
+ *
+ * - req/s, 요청당 p50/p99 처리 시간 (frame parse + handler + 응답 직렬화)
+ * - getMetrics()의 handler µs p50/p99
+ * - 최대 stack 사용량 (ESP8266: cont stack, ESP32: loop task high-water)
+ * - heap / 최대 연속 블록 변화 (단편화)
+ *
+ * 펌웨어 릴리스 전 같은 보드/클럭에서 실행해 이전 결과와 비교하세요.
+ *
+ * 본 코드는 OrbiSync 오픈소스 프로젝트의 일부입니다.
+ * 라이선스 및 사용 조건은 LICENSE 파일을 참고하세요.
+ */
+
+#include <Arduino.h>
+#include <OrbiSyncNode.h>
+
+static const uint16_t kIterations = 500;
+
+// 합성 요청 body (proxy_request는 base64: {"led":"on","n":1234567890})
+static const char kProxyBodyB64[] = "eyJsZWQiOiJvbiIsIm4iOjEyMzQ1Njc4OTB9";
+static const char kStatusJson[] = "{\"ok\":true,\"uptime_ms\":0,\"heap\":0}";
+
+static OrbiSyncNode::Config makeConfig() {
+  OrbiSyncNode::Config c = {};
+  c.hubBaseUrl = "http://127.0.0.1";
+  c.slotId = "bench";
+  c.firmwareVersion = "bench";
+  c.ledPin = -1;
+  c.enableTunnel = true;
+  return c;
+}
+
+static OrbiSyncNodeType node(makeConfig());
+
+// ---- loopback tap: 응답 frame 수/바이트만 집계 ----
+static uint32_t s_txFrames = 0;
+static uint32_t s_txBytes = 0;
+
+static bool benchTap(const uint8_t* data, size_t len, bool binary) {
+  (void)data; (void)binary;
+  s_txFrames++;
+  s_txBytes += len;
+  return true;
+}
+
+// ---- handlers ----
+static void handleStatus(const OrbiSyncNode::TunnelHttpRequest& req, OrbiSyncNode::TunnelHttpResponseWriter& res) {
+  (void)req;
+  res.setStatus(200);
+  res.setHeader("Content-Type", "application/json");
+  res.write(kStatusJson);
+}
+
+static void handleEcho(const OrbiSyncNode::TunnelHttpRequest& req, OrbiSyncNode::TunnelHttpResponseWriter& res) {
+  res.setStatus(200);
+  res.setHeader("Content-Type", "application/octet-stream");
+  if (req.body && req.bodyLen) res.write(req.body, req.bodyLen);
+}
+
+// ---- 측정 도구 ----
+static uint32_t stackFree() {
+#if defined(ESP8266)
+  return ESP.getFreeContStack();
+#elif defined(ESP32)
+  return uxTaskGetStackHighWaterMark(nullptr);
+#else
+  return 0;
+#endif
+}
+
+static uint32_t maxBlock() {
+#if defined(ESP8266)
+  return ESP.getMaxFreeBlockSize();
+#elif defined(ESP32)
+  return ESP.getMaxAllocHeap();
+#else
+  return 0;
+#endif
+}
+
+typedef size_t (*FrameBuilder)(char* out, size_t cap, uint16_t i);
+
+static size_t buildProxyRequest(char* out, size_t cap, uint16_t i) {
+  return (size_t)snprintf(out, cap,
+    "{\"type\":\"proxy_request\",\"request_id\":\"p%u\",\"method\":\"POST\",\"path\":\"/bench/echo\","
+    "\"headers\":{\"Content-Type\":\"application/json\",\"X-Bench\":\"1\"},\"body\":\"%s\"}",
+    (unsigned)i, kProxyBodyB64);
+}
+
+static size_t buildHttpReq(char* out, size_t cap, uint16_t i) {
+  return (size_t)snprintf(out, cap,
+    "{\"type\":\"HTTP_REQ\",\"stream_id\":\"s%u\",\"method\":\"GET\",\"path\":\"/bench/status\","
+    "\"headers\":{\"Accept\":\"application/json\"}}",
+    (unsigned)i);
+}
+
+static size_t buildRpc(char* out, size_t cap, uint16_t i) {
+  return (size_t)snprintf(out, cap,
+    "{\"id\":%u,\"method\":\"POST\",\"path\":\"/bench/echo\",\"body\":{\"cmd\":\"led\",\"on\":true}}",
+    (unsigned)i);
+}
+
+static void runCase(const char* name, FrameBuilder build) {
+  static char frame[512];
+  OrbiSyncNode::MetricHistogram lat = {};
+
+  // handler 히스토그램은 누적 (호출 수만 case별 차이로 표시)
+  uint32_t hCount0 = node.getMetrics().tunnel.handlerUs.count;
+  uint32_t heap0 = ESP.getFreeHeap();
+  uint32_t block0 = maxBlock();
+  uint32_t stack0 = stackFree();
+  uint32_t tx0 = s_txFrames;
+  uint32_t txBytes0 = s_txBytes;
+
+  uint32_t t0 = micros();
+  for (uint16_t i = 0; i < kIterations; i++) {
+    size_t n = build(frame, sizeof(frame), i);
+    uint32_t s = micros();
+    node.injectTunnelFrame((uint8_t*)frame, n, false);
+    lat.record(micros() - s);
+    if ((i & 31) == 0) yield();
+  }
+  uint32_t totalUs = micros() - t0;
+
+  const OrbiSyncNode::Metrics& m = node.getMetrics();
+  uint32_t stack1 = stackFree();
+  float reqPerSec = totalUs ? (kIterations * 1000000.0f / totalUs) : 0.0f;
+
+  Serial.printf("[BENCH] %-13s n=%u  %.0f req/s  p50=%uus p99=%uus max=%uus\n",
+                name, (unsigned)kIterations, reqPerSec,
+                (unsigned)lat.percentile(50), (unsigned)lat.percentile(99), (unsigned)lat.max);
+  Serial.printf("[BENCH] %-13s handler(누적) p50=%uus p99=%uus (+%u calls)  tx=%u frames %u bytes\n",
+                name,
+                (unsigned)m.tunnel.handlerUs.percentile(50), (unsigned)m.tunnel.handlerUs.percentile(99),
+                (unsigned)(m.tunnel.handlerUs.count - hCount0),
+                (unsigned)(s_txFrames - tx0), (unsigned)(s_txBytes - txBytes0));
+  Serial.printf("[BENCH] %-13s heap %u -> %u  max_block %u -> %u  stack_free %u -> %u\n",
+                name, (unsigned)heap0, (unsigned)ESP.getFreeHeap(),
+                (unsigned)block0, (unsigned)maxBlock(), (unsigned)stack0, (unsigned)stack1);
+}
+
+void setup() {
+  Serial.begin(115200);
+  delay(200);
+  Serial.println();
+  Serial.printf("[BENCH] cpu=%uMHz heap=%u\n", (unsigned)ESP.getCpuFreqMHz(), (unsigned)ESP.getFreeHeap());
+
+  node.addRoute("GET", "/bench/status", handleStatus);
+  node.addRoute("POST", "/bench/echo", handleEcho);
+  node.setTunnelTap(benchTap);
+
+  runCase("proxy_request", buildProxyRequest);
+  runCase("HTTP_REQ", buildHttpReq);
+  runCase("rpc", buildRpc);
+
+  Serial.printf("[BENCH] parse p50=%uus p99=%uus arena_misses=%u\n",
+                (unsigned)node.getMetrics().tunnel.parseUs.percentile(50),
+                (unsigned)node.getMetrics().tunnel.parseUs.percentile(99),
+                (unsigned)node.getMetrics().arenaMisses);
+  Serial.println("[BENCH] done");
+}
+
+void loop() {
+  delay(1000);
+}
@@ -0,0 +1,17 @@
+#!/bin/bash
+# host replay 빌드: ARDUINOJSON_DIR=<ArduinoJson 6.21+ src 경로> ./build.sh
+set -e
+cd "$(dirname "$0")"
+
+if [ -z "$ARDUINOJSON_DIR" ]; then
+  echo "Usage: ARDUINOJSON_DIR=/path/to/ArduinoJson/src ./build.sh"
+  exit 1
+fi
+
+CXX="${CXX:-c++}"
+$CXX -std=gnu++17 -O2 -Wall -DESP32 -DORBISYNC_TASK_MODE=0 \
+  -Ishim -I../../src -I"$ARDUINOJSON_DIR" \
+  host_replay.cpp shim/shim.cpp ../../src/*.cpp \
+  -o host_replay
+
+echo "built: $(pwd)/host_replay"
@@ -0,0 +1,143 @@
+/**
+ * @file   host_replay.cpp
+ * @brief  캡처한 Hub 터널 traffic을 host에서 OrbiSyncNode 실제 코드로 재생
+ * @details
+ * - 입력: 한 줄에 frame 하나. 텍스트 frame은 JSON 그대로, binary frame은 "bin:<base64>"
+ *   '#'으로 시작하는 줄과 빈 줄은 무시
+ * - 응답 frame은 setTunnelTap()으로 받음 (-v면 stdout 출력)
+ * - 결과: frame 수, req/s, frame당 p50/p90/p99/max µs, 응답 frame/바이트
+ *
+ * 사용: ./host_replay capture.txt [-n 반복] [-v]
+ * 라이브러리 로그(Serial)는 stderr, 결과는 stdout
+ */
+#include <Arduino.h>
+#include <OrbiSyncNode.h>
+#include <OrbiSyncBase64.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct Frame {
+  std::vector<uint8_t> data;
+  bool binary;
+};
+
+static bool s_verbose = false;
+static uint32_t s_txFrames = 0;
+static uint64_t s_txBytes = 0;
+
+static bool replayTap(const uint8_t* data, size_t len, bool binary) {
+  s_txFrames++;
+  s_txBytes += len;
+  if (s_verbose) {
+    if (binary) printf("<< bin %zu bytes\n", len);
+    else printf("<< %.*s\n", (int)len, (const char*)data);
+  }
+  return true;
+}
+
+// 재생용 기본 handler: 요청 body를 그대로 돌려줌 (route가 없는 요청 포함)
+static void echoHandler(const OrbiSyncNode::TunnelHttpRequest& req, OrbiSyncNode::TunnelHttpResponseWriter& res) {
+  res.setStatus(200);
+  const char* ct = req.getHeader("content-type");
+  res.setHeader("Content-Type", ct ? ct : "application/octet-stream");
+  if (req.body && req.bodyLen) res.write(req.body, req.bodyLen);
+}
+
+static bool loadCapture(const char* path, std::vector<Frame>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  std::string line;
+  int c;
+  for (;;) {
+    line.clear();
+    while ((c = fgetc(f)) != EOF && c != '\n') line.push_back((char)c);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (!line.empty() && line[0] != '#') {
+      Frame fr;
+      fr.binary = line.compare(0, 4, "bin:") == 0;
+      if (fr.binary) {
+        fr.data.resize(OrbiSyncNode::base64DecodedMaxLen(line.size() - 4));
+        fr.data.resize(OrbiSyncNode::base64Decode(fr.data.data(), line.c_str() + 4, line.size() - 4));
+      } else {
+        fr.data.assign(line.begin(), line.end());
+      }
+      out.push_back(fr);
+    }
+    if (c == EOF) break;
+  }
+  fclose(f);
+  return true;
+}
+
+static OrbiSyncNode::Config makeConfig() {
+  OrbiSyncNode::Config c = {};
+  c.hubBaseUrl = "http://127.0.0.1";
+  c.slotId = "replay";
+  c.firmwareVersion = "host-replay";
+  c.ledPin = -1;
+  c.enableTunnel = true;
+  c.tunnelStreamResponses = true;
+  c.serveMetrics = true;
+  return c;
+}
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  int repeat = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) s_verbose = true;
+    else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+    else path = argv[i];
+  }
+  if (!path || repeat < 1) {
+    fprintf(stderr, "usage: %s capture.txt [-n repeat] [-v]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<Frame> frames;
+  if (!loadCapture(path, frames) || frames.empty()) {
+    fprintf(stderr, "no frames in %s\n", path);
+    return 1;
+  }
+
+  OrbiSyncNodeType node(makeConfig());
+  node.onHttpRequest(echoHandler);
+  node.setTunnelTap(replayTap);
+
+  std::vector<uint32_t> lat;
+  lat.reserve(frames.size() * repeat);
+  std::vector<uint8_t> work;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; r++) {
+    for (const Frame& fr : frames) {
+      // binary frame은 제자리 수정되므로 매번 복사본으로
+      work.assign(fr.data.begin(), fr.data.end());
+      work.push_back(0);
+      auto s = std::chrono::steady_clock::now();
+      node.injectTunnelFrame(work.data(), fr.data.size(), fr.binary);
+      lat.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - s).count());
+    }
+  }
+  double totalUs = (double)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - t0).count();
+
+  std::sort(lat.begin(), lat.end());
+  auto pct = [&](double p) { return lat[(size_t)((lat.size() - 1) * p / 100.0)]; };
+
+  const OrbiSyncNode::Metrics& m = node.getMetrics();
+  printf("frames=%zu repeat=%d total=%.1fms rate=%.0f frames/s\n",
+         frames.size(), repeat, totalUs / 1000.0, totalUs > 0 ? lat.size() * 1e6 / totalUs : 0.0);
+  printf("latency_us p50=%u p90=%u p99=%u max=%u\n", pct(50), pct(90), pct(99), lat.back());
+  printf("handler_us p50=%u p99=%u parse_us p50=%u p99=%u\n",
+         (unsigned)m.tunnel.handlerUs.percentile(50), (unsigned)m.tunnel.handlerUs.percentile(99),
+         (unsigned)m.tunnel.parseUs.percentile(50), (unsigned)m.tunnel.parseUs.percentile(99));
+  printf("requests=%u busy=%u tx_frames=%u tx_bytes=%llu\n",
+         (unsigned)m.tunnel.requests, (unsigned)m.tunnel.busyRejects,
+         (unsigned)s_txFrames, (unsigned long long)s_txBytes);
+  return 0;
+}
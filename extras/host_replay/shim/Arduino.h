@@ -0,0 +1,67 @@
+/**
+ * @file   Arduino.h
+ * @brief  host replay용 최소 Arduino shim (OrbiSyncNode가 쓰는 것만)
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define LED_BUILTIN 2
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) { return 1; }
+  virtual size_t write(const uint8_t*, size_t n) { return n; }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+  size_t print(const char* s) { return printf("%s", s); }
+  size_t print(char c) { return printf("%c", c); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned v, int base = 10) { return printf(base == 16 ? "%x" : "%u", v); }
+  size_t println(const char* s = "") { return printf("%s\n", s); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int read(uint8_t*, size_t) { return 0; }
+  virtual int peek() { return -1; }
+  void setTimeout(unsigned long) {}
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long) {}
+};
+extern HardwareSerial Serial;
+
+/// heap 정보는 host에서 의미 없음 → 0
+struct EspClass {
+  uint32_t getFreeHeap() { return 0; }
+  uint32_t getMaxAllocHeap() { return 0; }
+  uint32_t getCpuFreqMHz() { return 0; }
+  void restart() {}
+};
+extern EspClass ESP;
@@ -0,0 +1,10 @@
+#pragma once
+#include <Arduino.h>
+
+class IPAddress {
+ public:
+  IPAddress() {}
+  IPAddress(uint8_t, uint8_t, uint8_t, uint8_t) {}
+  operator uint32_t() const { return 0; }
+  bool fromString(const char*) { return false; }
+};
@@ -0,0 +1,35 @@
+/**
+ * @file   WebSocketsClient.h
+ * @brief  host replay용 WebSocketsClient shim (연결 안 됨, 송신은 tap으로만)
+ */
+#pragma once
+#include <Arduino.h>
+
+typedef enum {
+  WStype_ERROR,
+  WStype_DISCONNECTED,
+  WStype_CONNECTED,
+  WStype_TEXT,
+  WStype_BIN,
+  WStype_FRAGMENT_TEXT_START,
+  WStype_FRAGMENT_BIN_START,
+  WStype_FRAGMENT,
+  WStype_FRAGMENT_FIN,
+  WStype_PING,
+  WStype_PONG,
+} WStype_t;
+
+class WebSocketsClient {
+ public:
+  typedef void (*WebSocketClientEvent)(WStype_t type, uint8_t* payload, size_t length);
+  void begin(const char*, uint16_t, const char* = "/", const char* = "arduino") {}
+  void beginSSL(const char*, uint16_t, const char* = "/", const char* = "", const char* = "arduino") {}
+  void setAuthorization(const char*) {}
+  void setExtraHeaders(const char* = nullptr) {}
+  void onEvent(WebSocketClientEvent) {}
+  void loop() {}
+  void disconnect() {}
+  bool isConnected() { return false; }
+  bool sendTXT(const uint8_t*, size_t) { return false; }
+  bool sendBIN(const uint8_t*, size_t) { return false; }
+};
@@ -0,0 +1,23 @@
+/**
+ * @file   WiFi.h
+ * @brief  host replay용 WiFi shim (ESP32 API 형태, 항상 연결 안 됨)
+ */
+#pragma once
+#include <WiFiClient.h>
+
+#define WL_CONNECTED 3
+#define WIFI_STA 1
+
+struct WiFiClass {
+  void mode(int) {}
+  int begin(const char*, const char*) { return 0; }
+  int status() { return 0; }
+  uint8_t* macAddress(uint8_t* mac) {
+    static const uint8_t kHostMac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+    memcpy(mac, kHostMac, 6);
+    return mac;
+  }
+  int32_t RSSI() { return 0; }
+  int hostByName(const char*, IPAddress&) { return 0; }
+};
+extern WiFiClass WiFi;
@@ -0,0 +1,19 @@
+/**
+ * @file   WiFiClient.h
+ * @brief  host replay용 TCP client shim: 연결은 항상 실패 (Hub 통신 없이 터널 frame만 재생)
+ */
+#pragma once
+#include <Arduino.h>
+#include <IPAddress.h>
+
+class WiFiClient : public Stream {
+ public:
+  virtual int connect(const char*, uint16_t) { return 0; }
+  virtual int connect(IPAddress, uint16_t) { return 0; }
+  virtual uint8_t connected() { return 0; }
+  virtual void stop() {}
+  void setNoDelay(bool) {}
+  using Print::write;
+  size_t write(const uint8_t*, size_t) override { return 0; }
+  operator bool() { return false; }
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <WiFiClient.h>
+
+class WiFiClientSecure : public WiFiClient {
+ public:
+  void setInsecure() {}
+  void setCACert(const char*) {}
+  using WiFiClient::connect;
+  int connect(IPAddress, uint16_t, const char*, const char*, const char*, const char*) { return 0; }
+};
@@ -0,0 +1,44 @@
+/**
+ * @file   shim.cpp
+ * @brief  host replay용 Arduino 런타임 (시간/Serial/random)
+ */
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+
+static const auto s_start = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - s_start).count();
+}
+
+unsigned long micros() {
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - s_start).count();
+}
+
+void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+void yield() {}
+
+long random(long howbig) { return howbig > 0 ? (long)(rand() % howbig) : 0; }
+long random(long howsmall, long howbig) { return howbig > howsmall ? howsmall + random(howbig - howsmall) : howsmall; }
+void randomSeed(unsigned long seed) { srand((unsigned)seed); }
+
+void pinMode(int, int) {}
+void digitalWrite(int, int) {}
+
+size_t Print::printf(const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  return n > 0 ? (size_t)n : 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file   OrbiSyncBase64.cpp
+ * @brief  table 기반 base64 codec
+ */
+ #include "OrbiSyncBase64.h"
+
+#if defined(ESP32) && ORBISYNC_BASE64_MBEDTLS
+ #include "mbedtls/base64.h"
+#endif
+
+namespace OrbiSyncNode {
+
+static const char kBase64Chars[] =
+ "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// 역변환 table: 0..63 = 값, 0x40 = '=', 0x80 = 알파벳 밖 (건너뜀)
+// ESP8266에서 PROGMEM이면 바이트마다 pgm_read가 필요해 RAM(256B)에 둠
+static const uint8_t kBase64Rev[256] = {
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x3E, 0x80, 0x80, 0x80, 0x3F,
+ 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x80, 0x80, 0x80, 0x40, 0x80, 0x80,
+ 0x80, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+ 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+ 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+};
+
+static constexpr uint8_t kRevPad = 0x40;
+static constexpr uint8_t kRevSkip = 0x80;
+
+size_t base64Encode(char* out, const uint8_t* in, size_t inLen) {
+#if defined(ESP32) && ORBISYNC_BASE64_MBEDTLS
+ size_t olen = 0;
+ if (mbedtls_base64_encode((unsigned char*)out, base64EncodedLen(inLen) + 1, &olen, in, inLen) == 0) return olen;
+#endif
+ const char* t = kBase64Chars;
+ char* o = out;
+ const uint8_t* end = in + (inLen - inLen % 3);
+ while (in < end) {
+   uint32_t w = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+   o[0] = t[(w >> 18) & 0x3F];
+   o[1] = t[(w >> 12) & 0x3F];
+   o[2] = t[(w >> 6) & 0x3F];
+   o[3] = t[w & 0x3F];
+   in += 3;
+   o += 4;
+ }
+ switch (inLen % 3) {
+   case 1: {
+     uint32_t w = (uint32_t)in[0] << 16;
+     o[0] = t[(w >> 18) & 0x3F];
+     o[1] = t[(w >> 12) & 0x3F];
+     o[2] = '=';
+     o[3] = '=';
+     o += 4;
+     break;
+   }
+   case 2: {
+     uint32_t w = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8);
+     o[0] = t[(w >> 18) & 0x3F];
+     o[1] = t[(w >> 12) & 0x3F];
+     o[2] = t[(w >> 6) & 0x3F];
+     o[3] = '=';
+     o += 4;
+     break;
+   }
+   default: break;
+ }
+ *o = '\0';
+ return (size_t)(o - out);
+}
+
+size_t base64Decode(uint8_t* out, const char* in, size_t inLen) {
+ const uint8_t* p = (const uint8_t*)in;
+ const uint8_t* end = p + inLen;
+ uint8_t* o = out;
+
+ // fast path: 공백/padding 없는 quad
+ while (end - p >= 4) {
+   uint8_t a = kBase64Rev[p[0]], b = kBase64Rev[p[1]], c = kBase64Rev[p[2]], d = kBase64Rev[p[3]];
+   if ((a | b | c | d) & (kRevPad | kRevSkip)) break;
+   uint32_t w = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | d;
+   o[0] = (uint8_t)(w >> 16);
+   o[1] = (uint8_t)(w >> 8);
+   o[2] = (uint8_t)w;
+   p += 4;
+   o += 3;
+ }
+
+ // slow path: 개행/공백 건너뛰기, '='에서 종료
+ uint32_t acc = 0;
+ int bits = 0;
+ for (; p < end; p++) {
+   uint8_t v = kBase64Rev[*p];
+   if (v == kRevPad) break;
+   if (v & kRevSkip) continue;
+   acc = (acc << 6) | v;
+   bits += 6;
+   if (bits >= 8) {
+     bits -= 8;
+     *o++ = (uint8_t)(acc >> bits);
+   }
+ }
+ return (size_t)(o - out);
+}
+
+} // namespace OrbiSyncNode
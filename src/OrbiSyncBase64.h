@@ -0,0 +1,36 @@
+/**
+ * @file   OrbiSyncBase64.h
+ * @brief  터널 body용 base64 codec (table 기반)
+ * @details
+ * - decode: 256-entry 역변환 table, 4문자 → 3바이트 한 번에 (유효 quad는 분기 1개)
+ * - encode: 3바이트 → 24비트 word → 4문자
+ * - decode는 in-place 가능 (out == in): 쓰는 위치가 항상 읽는 위치보다 앞
+ * - ORBISYNC_BASE64_MBEDTLS=1 이면 ESP32에서 mbedTLS encode 사용
+ */
+ #ifndef ORBISYNC_BASE64_H
+ #define ORBISYNC_BASE64_H
+
+ #include <stdint.h>
+ #include <stddef.h>
+
+/// ESP32 mbedTLS base64 사용 (기본 0: IDF 최신 mbedTLS는 constant-time 구현이라 table보다 느림)
+#ifndef ORBISYNC_BASE64_MBEDTLS
+#define ORBISYNC_BASE64_MBEDTLS 0
+#endif
+
+namespace OrbiSyncNode {
+
+/// 인코딩 결과 길이 (NUL 제외, padding 포함)
+inline size_t base64EncodedLen(size_t inLen) { return (inLen + 2) / 3 * 4; }
+/// 디코딩 결과 최대 길이
+inline size_t base64DecodedMaxLen(size_t inLen) { return (inLen + 3) / 4 * 3; }
+
+/// out: base64EncodedLen(inLen) + 1 바이트. NUL 종료, 반환: 길이
+size_t base64Encode(char* out, const uint8_t* in, size_t inLen);
+
+/// 알파벳 밖 문자(공백/개행)는 건너뛰고 '='에서 종료. out == (uint8_t*)in 허용
+size_t base64Decode(uint8_t* out, const char* in, size_t inLen);
+
+} // namespace OrbiSyncNode
+
+#endif
@@ -0,0 +1,483 @@
+/**
+ * @file   OrbiSyncDeflate.cpp
+ * @brief  고정 Huffman deflate 압축 + inflate (gzip / zlib / raw)
+ */
+ #include "OrbiSyncDeflate.h"
+
+ #include <stdlib.h>
+ #include <string.h>
+ #include <strings.h>
+
+namespace OrbiSyncNode {
+
+// length / distance code (RFC 1951 3.2.5). 압축/해제 공용
+static const uint16_t kLenBase[29] = {
+ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t kLenExtra[29] = {
+ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t kDistBase[30] = {
+ 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+ 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t kDistExtra[30] = {
+ 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static constexpr size_t kMinMatch = 4;  // 3바이트 match는 고정 code로 literal보다 길어질 수 있음
+static constexpr size_t kMaxMatch = 258;
+
+// ---- checksum ----
+// CRC-32 nibble table (64B, 바이트당 lookup 2번)
+static const uint32_t kCrcNibble[16] = {
+ 0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+ 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* p, size_t n) {
+ crc = ~crc;
+ while (n--) {
+   crc ^= *p++;
+   crc = (crc >> 4) ^ kCrcNibble[crc & 0x0F];
+   crc = (crc >> 4) ^ kCrcNibble[crc & 0x0F];
+ }
+ return ~crc;
+}
+
+static uint32_t adler32Update(uint32_t adler, const uint8_t* p, size_t n) {
+ uint32_t a = adler & 0xFFFF, b = adler >> 16;
+ while (n > 0) {
+   size_t k = n < 5552 ? n : 5552;  // 32비트 누적이 넘치기 전 modulo
+   n -= k;
+   while (k--) {
+     a += *p++;
+     b += a;
+   }
+   a %= 65521;
+   b %= 65521;
+ }
+ return (b << 16) | a;
+}
+
+// -----------------------------
+// 압축
+// -----------------------------
+static uint16_t* s_deflateHash = nullptr;  // 위치+1 (0 = 비어 있음)
+static constexpr size_t kHashSize = (size_t)1 << limits::kDeflateHashBits;
+
+struct BitOut {
+  uint8_t* p;
+  uint32_t buf;
+  uint8_t count;
+
+  void put(uint32_t v, uint8_t n) {
+    buf |= v << count;
+    count += n;
+    while (count >= 8) {
+      *p++ = (uint8_t)buf;
+      buf >>= 8;
+      count -= 8;
+    }
+  }
+  /// Huffman code는 MSB부터 → 뒤집어서 put
+  void putCode(uint32_t code, uint8_t n) {
+    uint32_t r = 0;
+    for (uint8_t i = 0; i < n; i++) {
+      r = (r << 1) | (code & 1);
+      code >>= 1;
+    }
+    put(r, n);
+  }
+};
+
+// 고정 lit/len code: 0-143 8bit, 144-255 9bit, 256-279 7bit, 280-287 8bit
+static void putFixedLit(BitOut& b, uint16_t v) {
+ if (v < 144) b.putCode(0x30 + v, 8);
+ else if (v < 256) b.putCode(0x190 + (v - 144), 9);
+ else if (v < 280) b.putCode(v - 256, 7);
+ else b.putCode(0xC0 + (v - 280), 8);
+}
+
+static void putMatch(BitOut& b, size_t len, size_t dist) {
+ uint8_t lc = 28;
+ while (kLenBase[lc] > len) lc--;
+ putFixedLit(b, (uint16_t)(257 + lc));
+ if (kLenExtra[lc]) b.put((uint32_t)(len - kLenBase[lc]), kLenExtra[lc]);
+ uint8_t dc = 29;
+ while (kDistBase[dc] > dist) dc--;
+ b.putCode(dc, 5);
+ if (kDistExtra[dc]) b.put((uint32_t)(dist - kDistBase[dc]), kDistExtra[dc]);
+}
+
+static inline uint32_t hash4(const uint8_t* p) {
+ uint32_t v = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+ return (v * 2654435761u) >> (32 - limits::kDeflateHashBits);
+}
+
+bool deflateBegin(DeflateStream& s, uint8_t format) {
+ if (!s_deflateHash) s_deflateHash = (uint16_t*)malloc(kHashSize * sizeof(uint16_t));
+ memset(&s, 0, sizeof(s));
+ s.format = format;
+ s.check = (format == kEncodingDeflate) ? 1 : 0;
+ return s_deflateHash != nullptr;
+}
+
+size_t deflateWrite(DeflateStream& s, const uint8_t* in, size_t inLen, uint8_t* out, bool final) {
+ BitOut b = {out, s.bitBuf, s.bitCount};
+
+ if (!s.started) {
+   s.started = true;
+   if (s.format == kEncodingGzip) {
+     // ID1 ID2 CM=8 FLG=0 MTIME=0 XFL=0 OS=255
+     static const uint8_t kGzipHeader[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+     memcpy(b.p, kGzipHeader, sizeof(kGzipHeader));
+     b.p += sizeof(kGzipHeader);
+   } else {
+     *b.p++ = 0x78;
+     *b.p++ = 0x01;
+   }
+ }
+
+ // 고정 Huffman block (BFINAL, BTYPE=01)
+ b.put(final ? 1 : 0, 1);
+ b.put(1, 2);
+
+ if (inLen >= kMinMatch && s_deflateHash) {
+   memset(s_deflateHash, 0, kHashSize * sizeof(uint16_t));
+   size_t i = 0;
+   size_t last = inLen - kMinMatch;  // hash 가능한 마지막 위치
+   while (i < inLen) {
+     if (i <= last) {
+       uint32_t h = hash4(in + i);
+       size_t cand = s_deflateHash[h];
+       s_deflateHash[h] = (uint16_t)(i + 1);
+       if (cand && i - (cand - 1) <= limits::kDeflateWindow && memcmp(in + cand - 1, in + i, kMinMatch) == 0) {
+         const uint8_t* ref = in + cand - 1;
+         size_t max = inLen - i < kMaxMatch ? inLen - i : kMaxMatch;
+         size_t len = kMinMatch;
+         while (len < max && ref[len] == in[i + len]) len++;
+         putMatch(b, len, i - (cand - 1));
+         // match 안쪽 위치도 hash에 (다음 반복 패턴이 가까운 거리로 잡히도록)
+         size_t end = i + len;
+         for (i++; i < end; i++) {
+           if (i <= last) s_deflateHash[hash4(in + i)] = (uint16_t)(i + 1);
+         }
+         continue;
+       }
+     }
+     putFixedLit(b, in[i]);
+     i++;
+   }
+ } else {
+   for (size_t i = 0; i < inLen; i++) putFixedLit(b, in[i]);
+ }
+ putFixedLit(b, 256);  // end of block
+
+ s.check = (s.format == kEncodingGzip) ? crc32Update(s.check, in, inLen) : adler32Update(s.check, in, inLen);
+ s.inTotal += (uint32_t)inLen;
+
+ if (final) {
+   if (b.count) b.put(0, (uint8_t)(8 - b.count));
+   uint32_t c = s.check;
+   if (s.format == kEncodingGzip) {
+     for (uint8_t k = 0; k < 4; k++) *b.p++ = (uint8_t)(c >> (8 * k));
+     for (uint8_t k = 0; k < 4; k++) *b.p++ = (uint8_t)(s.inTotal >> (8 * k));
+   } else {
+     for (int k = 3; k >= 0; k--) *b.p++ = (uint8_t)(c >> (8 * k));
+   }
+   b.buf = 0;
+   b.count = 0;
+ }
+ s.bitBuf = b.buf;
+ s.bitCount = b.count;
+ return (size_t)(b.p - out);
+}
+
+// -----------------------------
+// 해제
+// -----------------------------
+struct Huffman {
+  uint16_t counts[16];   // 길이별 code 수
+  uint16_t symbols[288];
+};
+struct InflateTables {
+  Huffman lit;
+  Huffman dist;
+  uint8_t lengths[288 + 32];
+};
+static InflateTables* s_inflate = nullptr;
+
+struct BitIn {
+  const uint8_t* p;
+  const uint8_t* end;
+  uint32_t buf;
+  uint8_t count;
+  bool err;
+
+  uint32_t get(uint8_t n) {
+    while (count < n) {
+      if (p >= end) {
+        err = true;
+        return 0;
+      }
+      buf |= (uint32_t)*p++ << count;
+      count += 8;
+    }
+    uint32_t v = buf & ((1u << n) - 1);
+    buf >>= n;
+    count -= n;
+    return v;
+  }
+};
+
+// canonical Huffman: 길이별 개수 → 길이순 symbol (zlib puff 방식)
+static bool huffBuild(Huffman& h, const uint8_t* lengths, uint16_t n) {
+ uint16_t offs[16];
+ memset(h.counts, 0, sizeof(h.counts));
+ for (uint16_t i = 0; i < n; i++) h.counts[lengths[i]]++;
+ h.counts[0] = 0;
+ int left = 1;
+ for (uint8_t len = 1; len < 16; len++) {
+   left = (left << 1) - h.counts[len];
+   if (left < 0) return false;  // over-subscribed
+ }
+ offs[1] = 0;
+ for (uint8_t len = 1; len < 15; len++) offs[len + 1] = offs[len] + h.counts[len];
+ for (uint16_t i = 0; i < n; i++) {
+   if (lengths[i]) h.symbols[offs[lengths[i]]++] = i;
+ }
+ return true;
+}
+
+static int huffDecode(BitIn& in, const Huffman& h) {
+ int code = 0, first = 0, index = 0;
+ for (uint8_t len = 1; len < 16; len++) {
+   code |= (int)in.get(1);
+   if (in.err) return -1;
+   int count = h.counts[len];
+   if (code - first < count) return h.symbols[index + (code - first)];
+   index += count;
+   first = (first + count) << 1;
+   code <<= 1;
+ }
+ return -1;
+}
+
+static void buildFixed(InflateTables& t) {
+ uint16_t i = 0;
+ for (; i < 144; i++) t.lengths[i] = 8;
+ for (; i < 256; i++) t.lengths[i] = 9;
+ for (; i < 280; i++) t.lengths[i] = 7;
+ for (; i < 288; i++) t.lengths[i] = 8;
+ huffBuild(t.lit, t.lengths, 288);
+ for (i = 0; i < 30; i++) t.lengths[i] = 5;
+ huffBuild(t.dist, t.lengths, 30);
+}
+
+static bool buildDynamic(BitIn& in, InflateTables& t) {
+ static const uint8_t kOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+ uint16_t nlen = (uint16_t)(in.get(5) + 257);
+ uint16_t ndist = (uint16_t)(in.get(5) + 1);
+ uint16_t ncode = (uint16_t)(in.get(4) + 4);
+ if (in.err || nlen > 286 || ndist > 30) return false;
+
+ uint8_t* lengths = t.lengths;
+ memset(lengths, 0, 19);
+ for (uint16_t i = 0; i < ncode; i++) lengths[kOrder[i]] = (uint8_t)in.get(3);
+ if (in.err || !huffBuild(t.lit, lengths, 19)) return false;  // code length code (lit 자리를 잠시 사용)
+
+ uint16_t i = 0;
+ while (i < nlen + ndist) {
+   int sym = huffDecode(in, t.lit);
+   if (sym < 0) return false;
+   if (sym < 16) {
+     lengths[i++] = (uint8_t)sym;
+     continue;
+   }
+   uint8_t v = 0;
+   uint16_t rep;
+   if (sym == 16) {
+     if (i == 0) return false;
+     v = lengths[i - 1];
+     rep = (uint16_t)(3 + in.get(2));
+   } else if (sym == 17) {
+     rep = (uint16_t)(3 + in.get(3));
+   } else {
+     rep = (uint16_t)(11 + in.get(7));
+   }
+   if (in.err || i + rep > nlen + ndist) return false;
+   while (rep--) lengths[i++] = v;
+ }
+ if (lengths[256] == 0) return false;  // end-of-block code 없음
+ return huffBuild(t.lit, lengths, nlen) && huffBuild(t.dist, lengths + nlen, ndist);
+}
+
+static bool inflateCodes(BitIn& in, const InflateTables& t, uint8_t* out, size_t cap, size_t& n, bool& tooLarge) {
+ for (;;) {
+   int sym = huffDecode(in, t.lit);
+   if (sym < 0) return false;
+   if (sym < 256) {
+     if (n >= cap) { tooLarge = true; return false; }
+     out[n++] = (uint8_t)sym;
+     continue;
+   }
+   if (sym == 256) return true;
+   sym -= 257;
+   if (sym >= 29) return false;
+   size_t len = kLenBase[sym] + in.get(kLenExtra[sym]);
+   int ds = huffDecode(in, t.dist);
+   if (ds < 0 || ds >= 30) return false;
+   size_t dist = kDistBase[ds] + in.get(kDistExtra[ds]);
+   if (in.err || dist > n) return false;
+   if (n + len > cap) { tooLarge = true; return false; }
+   const uint8_t* src = out + n - dist;
+   for (size_t k = 0; k < len; k++) out[n + k] = src[k];  // 겹칠 수 있어 바이트 단위
+   n += len;
+ }
+}
+
+bool inflateBody(const uint8_t* in, size_t inLen, uint8_t* out, size_t cap, size_t& outLen, bool& tooLarge) {
+ outLen = 0;
+ tooLarge = false;
+ if (!in || inLen < 2) return false;
+ if (!s_inflate) s_inflate = (InflateTables*)malloc(sizeof(InflateTables));
+ if (!s_inflate) return false;
+
+ // wrapper 판별
+ uint8_t format = kEncodingNone;  // raw deflate
+ size_t pos = 0;
+ if (inLen >= 18 && in[0] == 0x1F && in[1] == 0x8B && in[2] == 8) {
+   format = kEncodingGzip;
+   uint8_t flg = in[3];
+   pos = 10;
+   if (flg & 0x04) {  // FEXTRA
+     if (pos + 2 > inLen) return false;
+     pos += 2 + (in[pos] | ((size_t)in[pos + 1] << 8));
+   }
+   for (uint8_t f = 0x08; f <= 0x10; f <<= 1) {  // FNAME, FCOMMENT (NUL 종료)
+     if (!(flg & f)) continue;
+     while (pos < inLen && in[pos]) pos++;
+     pos++;
+   }
+   if (flg & 0x02) pos += 2;  // FHCRC
+   if (pos + 8 > inLen) return false;
+ } else if ((in[0] & 0x0F) == 8 && (in[0] >> 4) <= 7 && ((in[0] << 8) | in[1]) % 31 == 0 && !(in[1] & 0x20)) {
+   format = kEncodingDeflate;
+   pos = 2;
+ }
+
+ BitIn bi = {in + pos, in + inLen, 0, 0, false};
+ size_t n = 0;
+ bool last = false;
+ while (!last) {
+   last = bi.get(1) != 0;
+   uint32_t type = bi.get(2);
+   if (bi.err) return false;
+   if (type == 0) {
+     // stored: byte 경계로
+     bi.buf = 0;
+     bi.count = 0;
+     if (bi.end - bi.p < 4) return false;
+     uint16_t len = (uint16_t)(bi.p[0] | (bi.p[1] << 8));
+     uint16_t nlen = (uint16_t)(bi.p[2] | (bi.p[3] << 8));
+     bi.p += 4;
+     if ((uint16_t)~nlen != len || (size_t)(bi.end - bi.p) < len) return false;
+     if (n + len > cap) { tooLarge = true; return false; }
+     memcpy(out + n, bi.p, len);
+     bi.p += len;
+     n += len;
+   } else if (type == 1 || type == 2) {
+     if (type == 1) buildFixed(*s_inflate);
+     else if (!buildDynamic(bi, *s_inflate)) return false;
+     if (!inflateCodes(bi, *s_inflate, out, cap, n, tooLarge)) return false;
+   } else {
+     return false;
+   }
+ }
+
+ // trailer (남은 bit는 버리고 byte 경계부터)
+ const uint8_t* t = bi.p - bi.count / 8;
+ if (format == kEncodingGzip) {
+   if (bi.end - t < 8) return false;
+   uint32_t crc = (uint32_t)t[0] | ((uint32_t)t[1] << 8) | ((uint32_t)t[2] << 16) | ((uint32_t)t[3] << 24);
+   uint32_t isize = (uint32_t)t[4] | ((uint32_t)t[5] << 8) | ((uint32_t)t[6] << 16) | ((uint32_t)t[7] << 24);
+   if (crc != crc32Update(0, out, n) || isize != (uint32_t)n) return false;
+ } else if (format == kEncodingDeflate) {
+   if (bi.end - t < 4) return false;
+   uint32_t adler = ((uint32_t)t[0] << 24) | ((uint32_t)t[1] << 16) | ((uint32_t)t[2] << 8) | t[3];
+   if (adler != adler32Update(1, out, n)) return false;
+ }
+ outLen = n;
+ return true;
+}
+
+// -----------------------------
+// HTTP header 값
+// -----------------------------
+static bool tokenIs(const char* p, size_t len, const char* name) {
+ return strlen(name) == len && strncasecmp(p, name, len) == 0;
+}
+
+// name → encoding. "*"는 gzip
+static uint8_t encodingToken(const char* p, size_t len) {
+ if (tokenIs(p, len, "gzip") || tokenIs(p, len, "x-gzip") || tokenIs(p, len, "*")) return kEncodingGzip;
+ if (tokenIs(p, len, "deflate")) return kEncodingDeflate;
+ if (len == 0 || tokenIs(p, len, "identity")) return kEncodingNone;
+ return kEncodingUnsupported;
+}
+
+uint8_t encodingFromAccept(const char* value, size_t len) {
+ bool gzip = false, deflate = false;
+ const char* p = value;
+ const char* end = value + len;
+ while (p < end) {
+   const char* item = p;
+   while (p < end && *p != ',') p++;
+   const char* itemEnd = p;
+   if (p < end) p++;
+
+   while (item < itemEnd && (*item == ' ' || *item == '\t')) item++;
+   const char* nameEnd = item;
+   while (nameEnd < itemEnd && *nameEnd != ';' && *nameEnd != ' ' && *nameEnd != '\t') nameEnd++;
+   // ";q=0" (0.0, 0.00 포함) 이면 거부
+   bool refused = false;
+   for (const char* q = nameEnd; q + 2 < itemEnd; q++) {
+     if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=') {
+       refused = true;
+       for (const char* d = q + 2; d < itemEnd && *d != ';' && *d != ' '; d++) {
+         if (*d >= '1' && *d <= '9') refused = false;
+       }
+       break;
+     }
+   }
+   if (refused) continue;
+   uint8_t enc = encodingToken(item, (size_t)(nameEnd - item));
+   if (enc == kEncodingGzip) gzip = true;
+   else if (enc == kEncodingDeflate) deflate = true;
+ }
+ if (gzip) return kEncodingGzip;
+ if (deflate) return kEncodingDeflate;
+ return kEncodingNone;
+}
+
+uint8_t encodingFromName(const char* value, size_t len) {
+ while (len && (*value == ' ' || *value == '\t')) { value++; len--; }
+ while (len && (value[len - 1] == ' ' || value[len - 1] == '\t')) len--;
+ if (tokenIs(value, len, "*")) return kEncodingUnsupported;
+ return encodingToken(value, len);
+}
+
+const char* encodingName(uint8_t enc) {
+ switch (enc) {
+   case kEncodingGzip: return "gzip";
+   case kEncodingDeflate: return "deflate";
+   default: return "identity";
+ }
+}
+
+size_t deflateHeapBytes() {
+ return (s_deflateHash ? kHashSize * sizeof(uint16_t) : 0) + (s_inflate ? sizeof(InflateTables) : 0);
+}
+
+} // namespace OrbiSyncNode
@@ -0,0 +1,57 @@
+/**
+ * @file   OrbiSyncDeflate.h
+ * @brief  터널 body용 gzip/deflate codec (작은 window, 할당은 처음 한 번)
+ * @details
+ * - 압축: LZ77(hash 1-way, 최소 match 4) + 고정 Huffman block. 호출마다 block 하나, history는 그 입력 안에서만
+ *   → 응답 writer의 body 버퍼 하나가 window (ORBISYNC_DEFLATE_WINDOW 이내 거리만 참조)
+ * - stream은 여러 호출(chunk)에 걸쳐 이어짐: 남은 bit는 DeflateStream에 보관, final에서 trailer
+ * - 해제: stored / 고정 / 동적 Huffman 모두. 출력 버퍼 전체가 history라 별도 window 없음
+ * - hash table / 해제 table은 처음 사용할 때 malloc (쓰지 않으면 RAM 0)
+ */
+ #ifndef ORBISYNC_DEFLATE_H
+ #define ORBISYNC_DEFLATE_H
+
+ #include <stdint.h>
+ #include <stddef.h>
+
+ #include "OrbiSyncLimits.h"
+
+namespace OrbiSyncNode {
+
+/// HTTP content-coding. DEFLATE = zlib wrapper (RFC 9110 "deflate")
+enum : uint8_t { kEncodingNone = 0, kEncodingGzip, kEncodingDeflate, kEncodingUnsupported = 0xFF };
+
+struct DeflateStream {
+  uint32_t check;    /// gzip: CRC-32, deflate: Adler-32
+  uint32_t inTotal;
+  uint32_t bitBuf;   /// 아직 바이트를 채우지 못한 bit (LSB부터)
+  uint8_t bitCount;
+  uint8_t format;
+  bool started;      /// header 출력함
+};
+
+/// 압축 결과 최대 길이 (고정 Huffman literal 9bit + header/trailer)
+inline size_t deflateBound(size_t inLen) { return inLen + inLen / 8 + 32; }
+
+/// format: kEncodingGzip / kEncodingDeflate. hash table 할당 실패면 false
+bool deflateBegin(DeflateStream& s, uint8_t format);
+
+/// in 전체를 block 하나로. out: deflateBound(inLen) 바이트. final이면 마지막 block + trailer. 반환: 쓴 길이
+size_t deflateWrite(DeflateStream& s, const uint8_t* in, size_t inLen, uint8_t* out, bool final);
+
+/// gzip / zlib / raw deflate 자동 판별, out에 전부 해제 (trailer 검사 포함)
+/// 실패면 false, cap을 넘으면 tooLarge = true
+bool inflateBody(const uint8_t* in, size_t inLen, uint8_t* out, size_t cap, size_t& outLen, bool& tooLarge);
+
+/// Accept-Encoding → 쓸 encoding (gzip 우선, q=0 제외). 없으면 kEncodingNone
+uint8_t encodingFromAccept(const char* value, size_t len);
+/// Content-Encoding 값 → encoding ("identity" = kEncodingNone, 모르는 값 = kEncodingUnsupported)
+uint8_t encodingFromName(const char* value, size_t len);
+const char* encodingName(uint8_t enc);
+
+/// 지금까지 할당한 hash / 해제 table bytes (logMemoryBudget용)
+size_t deflateHeapBytes();
+
+} // namespace OrbiSyncNode
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file   OrbiSyncLimits.h
+ * @brief  buffer 크기 profile (target별 기본값, 항목별 -D override)
+ * @details
+ * - ORBISYNC_PROFILE: 0 = target 자동 (ESP8266 → SMALL, 그 외 → LARGE), 1 = SMALL, 2 = LARGE
+ * - SMALL: ESP8266 (cont stack 4KB, heap ~40KB). 큰 JSON 문서는 stack 대신 static
+ * - LARGE: ESP32. 응답 body / 토큰 / 수신 문서를 키움
+ * - 아래 ORBISYNC_* 를 -D로 주면 profile 값보다 우선. 코드에서는 limits::k* 사용
+ * - 적용 결과는 OrbiSyncNode::logMemoryBudget()으로 확인
+ */
+ #ifndef ORBISYNC_LIMITS_H
+ #define ORBISYNC_LIMITS_H
+
+ #include <stdint.h>
+ #include <stddef.h>
+
+#define ORBISYNC_PROFILE_SMALL 1
+#define ORBISYNC_PROFILE_LARGE 2
+
+#ifndef ORBISYNC_PROFILE
+#define ORBISYNC_PROFILE 0
+#endif
+
+#if ORBISYNC_PROFILE == 0
+#undef ORBISYNC_PROFILE
+#if defined(ESP8266)
+#define ORBISYNC_PROFILE ORBISYNC_PROFILE_SMALL
+#else
+#define ORBISYNC_PROFILE ORBISYNC_PROFILE_LARGE
+#endif
+#endif
+
+#define ORBISYNC_PROFILE_PICK(small, large) ((ORBISYNC_PROFILE == ORBISYNC_PROFILE_SMALL) ? (small) : (large))
+
+/// nodeToken_ / sessionToken_ (NUL 포함). Authorization header / register frame 크기도 이 값을 따름
+#ifndef ORBISYNC_TOKEN_BYTES
+#define ORBISYNC_TOKEN_BYTES ORBISYNC_PROFILE_PICK(256, 512)
+#endif
+
+/// 2xx가 아닌 Hub 응답 body 버퍼 (오류 코드 확인 / log). 2xx body는 버퍼 없이 JsonDocument로 바로 파싱
+#ifndef ORBISYNC_HUB_ERR_BODY_BYTES
+#define ORBISYNC_HUB_ERR_BODY_BYTES ORBISYNC_PROFILE_PICK(256, 512)
+#endif
+
+/// Hub 응답 파싱 JsonDocument (static 하나를 모든 Hub 응답이 공유, 요청 slot이 하나라 겹치지 않음)
+/// filter로 쓰는 필드만 남기므로 응답 크기가 아니라 토큰 / URL 길이만큼 필요
+/// asyncHttp 응답 body 버퍼(s_hubRxBody)도 같은 크기 → 이보다 큰 2xx body는 async 요청 실패
+#ifndef ORBISYNC_HUB_DOC_BYTES
+#define ORBISYNC_HUB_DOC_BYTES ORBISYNC_PROFILE_PICK(1536, 3072)
+#endif
+
+/// ESP8266 BearSSL 수신/송신 버퍼 (512는 서버 MFLN 지원 필요)
+#ifndef ORBISYNC_TLS_RX_BYTES
+#define ORBISYNC_TLS_RX_BYTES 512
+#endif
+#ifndef ORBISYNC_TLS_TX_BYTES
+#define ORBISYNC_TLS_TX_BYTES 512
+#endif
+
+/// 요청당 header 최대 개수 (view 16바이트씩 (32비트), 초과분은 무시)
+#ifndef ORBISYNC_TUNNEL_MAX_HEADERS
+#define ORBISYNC_TUNNEL_MAX_HEADERS 16
+#endif
+
+/// 응답 writer의 header 개수 (key 24 + value 80바이트 사본, stream마다 하나). 초과분은 무시
+#ifndef ORBISYNC_TUNNEL_MAX_RESPONSE_HEADERS
+#define ORBISYNC_TUNNEL_MAX_RESPONSE_HEADERS 8
+#endif
+
+/// 응답 writer body 버퍼 (streaming이면 이 크기 단위로 chunk 전송). stream마다 하나
+#ifndef ORBISYNC_TUNNEL_BODY_BYTES
+#define ORBISYNC_TUNNEL_BODY_BYTES ORBISYNC_PROFILE_PICK(2048, 4096)
+#endif
+
+/// 터널 수신 frame 파싱용 JsonDocument (proxy_request body 포함 frame 전체가 들어가야 함)
+#ifndef ORBISYNC_TUNNEL_RX_DOC_SIZE
+#define ORBISYNC_TUNNEL_RX_DOC_SIZE ORBISYNC_PROFILE_PICK(1536, 3072)
+#endif
+
+/// 송신 batch 버퍼 (Config::tunnelBatchFrames). 이보다 큰 메시지는 단독 frame
+#ifndef ORBISYNC_TUNNEL_BATCH_BYTES
+#define ORBISYNC_TUNNEL_BATCH_BYTES 1536
+#endif
+
+/// 동시에 처리 중인 터널 요청 수 (slot당 응답 버퍼 ~ORBISYNC_TUNNEL_BODY_BYTES+1KB). 초과 요청은 즉시 503
+#ifndef ORBISYNC_TUNNEL_MAX_STREAMS
+#define ORBISYNC_TUNNEL_MAX_STREAMS ORBISYNC_PROFILE_PICK(2, 4)
+#endif
+
+/// 터널이 끊긴 동안 보관할 송신 메시지 RAM (Config::tunnelOutbox, 켠 경우에만 할당, 보드 공유)
+#ifndef ORBISYNC_OUTBOX_BYTES
+#define ORBISYNC_OUTBOX_BYTES ORBISYNC_PROFILE_PICK(2048, 4096)
+#endif
+
+/// 실행 대기 Hub command 수 (노드당, Config::enableCommandPolling / 터널 push). ack 대기열은 2배
+#ifndef ORBISYNC_COMMAND_QUEUE
+#define ORBISYNC_COMMAND_QUEUE ORBISYNC_PROFILE_PICK(2, 4)
+#endif
+
+/// command args JSON 텍스트 (넘으면 실행하지 않고 args_too_large ack)
+#ifndef ORBISYNC_COMMAND_ARGS_BYTES
+#define ORBISYNC_COMMAND_ARGS_BYTES ORBISYNC_PROFILE_PICK(128, 384)
+#endif
+
+/// 응답 압축 LZ77 최대 거리 (Config::tunnelCompress). 2의 거듭제곱
+#ifndef ORBISYNC_DEFLATE_WINDOW
+#define ORBISYNC_DEFLATE_WINDOW ORBISYNC_PROFILE_PICK(1024, 2048)
+#endif
+/// 압축 hash table 크기 (2^bits × 2바이트, 처음 압축할 때 할당)
+#ifndef ORBISYNC_DEFLATE_HASH_BITS
+#define ORBISYNC_DEFLATE_HASH_BITS ORBISYNC_PROFILE_PICK(9, 10)
+#endif
+
+namespace OrbiSyncNode {
+namespace limits {
+
+constexpr uint8_t kProfile = ORBISYNC_PROFILE;
+constexpr size_t kTokenBytes = ORBISYNC_TOKEN_BYTES;
+constexpr size_t kHubErrBodyBytes = ORBISYNC_HUB_ERR_BODY_BYTES;
+constexpr size_t kHubDocBytes = ORBISYNC_HUB_DOC_BYTES;
+constexpr size_t kTlsRxBytes = ORBISYNC_TLS_RX_BYTES;
+constexpr size_t kTlsTxBytes = ORBISYNC_TLS_TX_BYTES;
+constexpr size_t kTunnelBodyBytes = ORBISYNC_TUNNEL_BODY_BYTES;
+constexpr size_t kTunnelRxDocBytes = ORBISYNC_TUNNEL_RX_DOC_SIZE;
+constexpr size_t kTunnelBatchBytes = ORBISYNC_TUNNEL_BATCH_BYTES;
+constexpr size_t kOutboxBytes = ORBISYNC_OUTBOX_BYTES;
+constexpr size_t kCommandArgsBytes = ORBISYNC_COMMAND_ARGS_BYTES;
+constexpr size_t kDeflateWindow = ORBISYNC_DEFLATE_WINDOW;
+constexpr uint8_t kDeflateHashBits = ORBISYNC_DEFLATE_HASH_BITS;
+
+static_assert(kTokenBytes >= 64, "ORBISYNC_TOKEN_BYTES too small");
+static_assert(kTunnelBodyBytes >= 256, "ORBISYNC_TUNNEL_BODY_BYTES too small");
+static_assert(kOutboxBytes <= 0xFFFF, "ORBISYNC_OUTBOX_BYTES: record 위치는 16비트");
+static_assert(ORBISYNC_TUNNEL_MAX_HEADERS >= 1 && ORBISYNC_TUNNEL_MAX_HEADERS <= 255, "ORBISYNC_TUNNEL_MAX_HEADERS: 1~255");
+static_assert(ORBISYNC_TUNNEL_MAX_RESPONSE_HEADERS >= 1 && ORBISYNC_TUNNEL_MAX_RESPONSE_HEADERS <= 255,
+              "ORBISYNC_TUNNEL_MAX_RESPONSE_HEADERS: 1~255");
+static_assert(ORBISYNC_COMMAND_QUEUE >= 1 && ORBISYNC_COMMAND_QUEUE <= 64, "ORBISYNC_COMMAND_QUEUE: 1~64");
+static_assert(kDeflateWindow >= 256 && kDeflateWindow <= 32768 && (kDeflateWindow & (kDeflateWindow - 1)) == 0,
+              "ORBISYNC_DEFLATE_WINDOW: 256~32768, 2의 거듭제곱");
+static_assert(kDeflateHashBits >= 8 && kDeflateHashBits <= 14, "ORBISYNC_DEFLATE_HASH_BITS: 8~14");
+static_assert(kTunnelBodyBytes < 0xFFFF, "ORBISYNC_TUNNEL_BODY_BYTES: 압축 hash 위치는 16비트");
+static_assert(kCommandArgsBytes >= 8 && kCommandArgsBytes <= 0xFFFF, "ORBISYNC_COMMAND_ARGS_BYTES");
+
+}  // namespace limits
+}  // namespace OrbiSyncNode
+
+#endif
@@ -0,0 +1,110 @@
+/**
+ * @file   OrbiSyncMetrics.h
+ * @brief  OrbiSyncNode 지연/처리량 metrics (고정 메모리)
+ * @details
+ * - 카운터 + log2 bucket histogram (할당 없음, 기록은 O(1))
+ * - Hub endpoint별: connect / TTFB / 전체 ms, bytes in/out
+ * - 터널: frame parse µs, handler µs, ping RTT, 재연결/backoff
+ * - OrbiSyncNode::getMetrics()로 조회, heartbeat에 요약 포함
+ */
+ #ifndef ORBISYNC_METRICS_H
+ #define ORBISYNC_METRICS_H
+
+ #include <stdint.h>
+ #include <stddef.h>
+
+namespace OrbiSyncNode {
+
+/// bucket i: [2^(i-1), 2^i) (bucket 0 = 0, 마지막 bucket은 overflow)
+#ifndef ORBISYNC_METRICS_BUCKETS
+#define ORBISYNC_METRICS_BUCKETS 16
+#endif
+
+struct MetricHistogram {
+  uint32_t count;
+  uint32_t sum;
+  uint32_t max;
+  uint16_t buckets[ORBISYNC_METRICS_BUCKETS];  /// 65535에서 포화
+
+  void record(uint32_t v) {
+    count++;
+    sum += v;
+    if (v > max) max = v;
+    uint8_t b = 0;
+    while (v && b < ORBISYNC_METRICS_BUCKETS - 1) { v >>= 1; b++; }
+    if (buckets[b] != 0xFFFF) buckets[b]++;
+  }
+
+  /// 분위수 근사 (해당 bucket의 상한값). pct: 0~100
+  uint32_t percentile(uint8_t pct) const {
+    if (count == 0) return 0;
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < ORBISYNC_METRICS_BUCKETS; i++) total += buckets[i];
+    uint32_t target = (total * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < ORBISYNC_METRICS_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen >= target) {
+        if (i == 0) return 0;
+        uint32_t upper = (i >= 32) ? 0xFFFFFFFFu : ((1u << i) - 1);
+        return upper < max ? upper : max;
+      }
+    }
+    return max;
+  }
+};
+
+/// Hub API endpoint (OrbiSyncNode 내부 HttpOp 순서와 동일)
+enum class HubEndpoint : uint8_t { HELLO, PAIR, APPROVE, SESSION, REGISTER_BY_SLOT, HEARTBEAT, COUNT };
+
+struct HubEndpointMetrics {
+  uint32_t requests;
+  uint32_t failures;     /// connect 실패/timeout/status 없음
+  uint32_t reused;       /// keep-alive 연결 재사용
+  uint32_t bytesOut;
+  uint32_t bytesIn;
+  MetricHistogram connectMs;  /// TCP+TLS connect (재사용 시 기록 없음)
+  MetricHistogram ttfbMs;     /// 요청 시작 → 첫 응답 바이트
+  MetricHistogram totalMs;    /// 요청 시작 → 완료
+};
+
+struct TunnelMetrics {
+  uint32_t connects;       /// tunnelConnect 시도
+  uint32_t disconnects;
+  uint32_t rxFrames;
+  uint32_t txFrames;
+  uint32_t rxBytes;
+  uint32_t txBytes;
+  uint32_t requests;       /// handler까지 간 요청
+  uint32_t busyRejects;    /// stream pool 가득 → 503
+  uint32_t deferTimeouts;  /// deferred 응답 504
+  uint32_t batchedMsgs;    /// batch frame으로 묶여 나간 메시지 수
+  uint32_t outboxQueued;   /// 끊긴 동안 outbox에 보관한 메시지
+  uint32_t outboxDropped;  /// outbox 가득 참 → 버림
+  uint32_t outboxDeduped;  /// 같은 id가 이미 보관/전송돼 버림
+  uint32_t resumes;        /// resume token으로 register 없이 활성
+  uint32_t fastRetries;    /// graceful close 후 지연 없는 재연결
+  uint32_t compressIn;     /// 압축한 응답 body (원본 bytes)
+  uint32_t compressOut;    /// 압축 결과 bytes (base64 전)
+  uint32_t inflated;       /// 해제한 요청 body 수
+  uint32_t flowCredits;    /// 받은 flow_credit 수 (Hub flow window)
+  uint32_t flowWaits;      /// window가 닫혀 전송을 미룬 응답 frame
+  uint32_t flowOverruns;   /// handler 안의 chunk flush라 window를 넘겨 보낸 frame
+  uint32_t flowStalls;     /// credit 없이 kFlowStallMs가 지나 outstanding 초기화
+  uint8_t backoffStep;     /// 현재 재연결 backoff 단계 (getMetrics 시점)
+  MetricHistogram parseUs;    /// frame JSON parse
+  MetricHistogram handlerUs;  /// route/onRequest/onHttpRequest handler
+  MetricHistogram pingRttMs;  /// ping → pong
+};
+
+struct Metrics {
+  uint32_t uptimeMs;
+  uint32_t freeHeap;
+  uint32_t arenaMisses;
+  HubEndpointMetrics hub[(uint8_t)HubEndpoint::COUNT];
+  TunnelMetrics tunnel;
+};
+
+} // namespace OrbiSyncNode
+
+#endif
@@ -20,11 +20,85 @@
 #endif
 
 #include <WebSocketsClient.h>
+// proxy_request body는 수신 문서 안의 base64 문자열 자리에 in-place decode → 같은 텍스트의 문자열이 bytes를 공유하면 안 됨
+// (ArduinoJson 6.15+ 기본값은 중복 제거. 설정값은 ArduinoJson namespace 이름에 들어가 sketch의 다른 설정과 섞이지 않음)
+#undef ARDUINOJSON_ENABLE_STRING_DEDUPLICATION
+#define ARDUINOJSON_ENABLE_STRING_DEDUPLICATION 0
 #include <ArduinoJson.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 
 #include "OrbiSyncNode.h"
+#include "OrbiSyncBase64.h"
+#include "OrbiSyncQueue.h"
+#if ORBISYNC_OUTBOX_SPILL
+#include <LittleFS.h>
+#endif
+
+#if ORBISYNC_TASK_MODE
+ #include <freertos/FreeRTOS.h>
+ #include <freertos/task.h>
+#endif
+
+// -----------------------------
+// Log level (compile-time)
+// -----------------------------
+// -DORBISYNC_LOG_LEVEL=N 로 지정. 레벨보다 상세한 로그는 인자/문자열까지 컴파일에서 제거됨.
+// 0=NONE 1=ERROR 2=WARN 3=INFO 4=DEBUG(요청/응답, handshake 상세) 5=VERBOSE(frame/body preview, 토큰)
+// Config::debugHttp는 남아 있는 DEBUG 로그 일부의 런타임 gate로 유지.
+#define ORBISYNC_LOG_NONE    0
+#define ORBISYNC_LOG_ERROR   1
+#define ORBISYNC_LOG_WARN    2
+#define ORBISYNC_LOG_INFO    3
+#define ORBISYNC_LOG_DEBUG   4
+#define ORBISYNC_LOG_VERBOSE 5
+
+#ifndef ORBISYNC_LOG_LEVEL
+#define ORBISYNC_LOG_LEVEL ORBISYNC_LOG_INFO
+#endif
+
+// 꺼진 레벨: 인자는 타입 검사만 하고 dead code로 제거 (문자열도 flash에 남지 않음)
+#define ORBI_LOG_NOP(...) do { if (0) Serial.printf(__VA_ARGS__); } while (0)
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_ERROR
+#define ORBI_LOGE(...) Serial.printf(__VA_ARGS__)
+#else
+#define ORBI_LOGE ORBI_LOG_NOP
+#endif
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_WARN
+#define ORBI_LOGW(...) Serial.printf(__VA_ARGS__)
+#else
+#define ORBI_LOGW ORBI_LOG_NOP
+#endif
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_INFO
+#define ORBI_LOGI(...) Serial.printf(__VA_ARGS__)
+#else
+#define ORBI_LOGI ORBI_LOG_NOP
+#endif
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_DEBUG
+#define ORBI_LOGD(...) Serial.printf(__VA_ARGS__)
+#else
+#define ORBI_LOGD ORBI_LOG_NOP
+#endif
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_VERBOSE
+#define ORBI_LOGV(...) Serial.printf(__VA_ARGS__)
+#else
+#define ORBI_LOGV ORBI_LOG_NOP
+#endif
+
+// payload preview (제어문자는 '.'로 치환). 레벨 밖이면 호출부째 제거
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_ERROR
+static void logPreview(const uint8_t* data, size_t len, size_t maxLen) {
+ size_t pl = len > maxLen ? maxLen : len;
+ for (size_t i = 0; i < pl; i++) {
+   char c = (char)data[i];
+   if (c == '\r' || c == '\n') Serial.print(' ');
+   else Serial.print((c >= 32 && c < 127) ? c : '.');
+ }
+ if (len > maxLen) Serial.print("...");
+ Serial.println();
+}
+#endif
 
 // -----------------------------
 // Tunables
@@ -33,27 +107,197 @@ static constexpr uint32_t kBackoffMinMs = 1000;
 static constexpr uint32_t kBackoffMaxMs = 30000;
 
 static constexpr uint32_t kTunnelPingIntervalMs = 25000;
+static constexpr size_t kPingBufBytes = 768;  // ping(+heartbeat) frame
 static const uint32_t kTunnelBackoffMs[] = {1000, 2000, 5000, 10000, 30000};
 static constexpr uint8_t kTunnelBackoffSteps = 5;
 
 static constexpr size_t kDefaultMaxTunnelBody = 4096;
-
-// HTTPS fail → HTTP fallback (개발용)
-static uint8_t s_httpsFailCount = 0;
+static constexpr uint32_t kDefaultTunnelDeferTimeoutMs = 10000;  // deferred 응답 / task mode handoff
+
+// nextWakeupMs / idleWait
+static constexpr uint32_t kWakeupIdleMaxMs = 60000;    // 예정된 일이 없을 때 상한
+static constexpr uint32_t kWakeupWifiPollMs = 100;     // WiFi 연결 대기 중 확인 주기
+static constexpr uint16_t kDefaultIdleWaitMaxMs = 50;
+static constexpr uint32_t kIdleSliceMs = 10;           // idleWaitFor 조기 종료 확인 단위
+
+// outbox (Config::tunnelOutbox)
+static constexpr uint8_t kOutboxDrainBurst = 8;        // register_ack / tunnelLoop 한 번에 보낼 최대 메시지
+static constexpr uint8_t kOutboxRecentIds = 8;         // 최근 전송한 이벤트 id (sendTunnelEvent 중복 검사)
+
+// Hub flow window (register_ack flow_window / flow_credit)
+static constexpr uint32_t kFlowStallMs = 5000;         // credit 없이 이만큼 지나면 Hub가 다 읽은 것으로 보고 outstanding 초기화
+static constexpr size_t kFlowFrameOverhead = 256;      // 응답 frame 크기 추정: body 외 JSON 필드 / binary header
+
+// 응답 frame 직렬화 문서 (body는 arena의 base64 포인터만 넣으므로 header/필드분만)
+static constexpr size_t kTunnelProxyTxDocBytes = 1024;
+static constexpr size_t kTunnelHttpTxDocBytes = 512;
+
+// binary 터널 frame (형식은 "Binary tunnel frame" 섹션 참고)
+static constexpr uint8_t kBinFrameVersion = 1;
+static constexpr size_t kBinFrameHeaderLen = 9;
+static constexpr uint8_t kBinTypeRequest = 1;
+static constexpr uint8_t kBinTypeResponse = 2;
+static constexpr uint8_t kBinTypeResponseChunk = 3;
+static constexpr uint8_t kBinFlagFinal = 0x01;
+
+// HTTPS fail → HTTP fallback (개발용). 실패 횟수는 공유 Hub 연결(s_httpConn)에 기록
 static constexpr uint8_t MAX_HTTPS_FAIL_COUNT = 2;
 
 static char s_macBuf[24];
 
-// WebSocket globals
-static WebSocketsClient* s_wsClient = nullptr;
-static OrbiSyncNode::OrbiSyncNode* s_nodeForWs = nullptr;
-// Defer disconnect/delete to main loop; never delete inside WebSocket callback (prevents LoadProhibited).
-static bool s_tunnelDisconnectPending = false;
+// TLS 세션 재개 캐시 (ESP8266 BearSSL). ESP32 WiFiClientSecure는 세션 설정 API가 없어 미지원.
+#ifndef ORBISYNC_TLS_SESSION_CACHE
+#define ORBISYNC_TLS_SESSION_CACHE 1
+#endif
+
+#if defined(ESP8266) && ORBISYNC_TLS_SESSION_CACHE
+static BearSSL::Session s_tlsSession;
+static char s_tlsSessionHost[128] = "";
+
+// Hub host의 캐시된 세션 반환. host가 바뀌면 이전 세션 폐기(다른 서버에 resume 시도 방지)
+static BearSSL::Session* tlsSessionFor(const char* host) {
+ if (strcmp(s_tlsSessionHost, host) != 0) {
+   s_tlsSession = BearSSL::Session();
+   strncpy(s_tlsSessionHost, host, sizeof(s_tlsSessionHost) - 1);
+   s_tlsSessionHost[sizeof(s_tlsSessionHost) - 1] = '\0';
+ }
+ return &s_tlsSession;
+}
+#endif
+
+// WebSocket client 재사용: 1이면 정적 client 하나를 노드 수명 동안 유지 (재연결마다 new/delete 없음)
+#ifndef ORBISYNC_WS_STATIC_CLIENT
+#define ORBISYNC_WS_STATIC_CLIENT 1
+#endif
+
+#if ORBISYNC_WS_STATIC_CLIENT
+static WebSocketsClient s_wsClientStorage;
+#endif
+
+static WebSocketsClient* wsClientAcquire() {
+#if ORBISYNC_WS_STATIC_CLIENT
+ return &s_wsClientStorage;
+#else
+ return new WebSocketsClient();
+#endif
+}
+
+// disconnect()가 내부 소켓/TLS를 닫음. 정적 모드는 객체를 남겨두고 다음 begin()에서 재초기화
+static void wsClientRelease(WebSocketsClient* client) {
+ if (!client) return;
+ client->disconnect();
+#if !ORBISYNC_WS_STATIC_CLIENT
+ delete client;
+#endif
+}
+// ---- 터널 WS 연결 (gateway당 하나) ----
+// nodes[0](owner)이 연결을 열고 WS 이벤트/재연결을 담당. Config::tunnelMultiplex 노드는 같은 tunnel_url이면
+// 이 연결에 자기 register만 보내 합류하고, 수신 frame은 node_id(없으면 slot_id)로 해당 노드에 전달.
+// 송신 batch: 등록 후 텍스트 메시지를 "[m1,m2,...]" 한 frame으로 모음 → frame/TLS record당 오버헤드 절감
+//   flush: loopTick 끝(또는 tunnelBatchMaxDelayMs 경과), 다음 메시지가 버퍼에 안 들어갈 때, binary 전송 전
+//   버퍼는 기능을 켠 경우에만 첫 tunnelConnect에서 확보 (arena와 같이 유지)
+struct TunnelLink {
+ WebSocketsClient* ws;      // != nullptr: 터널 세션 활성 (정적 모드에서도 해제 시 nullptr)
+ OrbiSyncNode::OrbiSyncNode* nodes[ORBISYNC_TUNNEL_MAX_NODES];  // [0] = owner
+ const char* slots[ORBISYNC_TUNNEL_MAX_NODES];                  // nodes[i]의 Config::slotId
+ uint8_t nodeCount;
+ // Defer disconnect/release to main loop; never release inside WebSocket callback (prevents LoadProhibited).
+ bool disconnectPending;
+ bool gracefulClose;        // Hub 정상 종료 (close 1000/1001/1012 또는 goaway) → 첫 재연결 지연 없음
+ char* txBatch;
+ size_t txBatchLen;
+ uint8_t txBatchCount;
+ uint32_t txBatchFirstMs;
+ // Hub flow window: Hub가 아직 읽지 않은 송신 bytes 상한 (0 = 없음). 연결당 하나, 공유 연결의 노드 모두 같은 window
+ uint32_t flowWindow;
+ uint32_t flowOutstanding;  // 보냈지만 flow_credit으로 돌아오지 않은 bytes
+ uint32_t flowLastCreditMs; // 마지막 credit (또는 outstanding이 0에서 늘어난 시각) → stall 판단
+};
+static TunnelLink s_link = {};
+
+// 응답 frame 하나(len bytes)를 지금 보내도 되는지. outstanding이 0이면 window보다 큰 frame도 보냄 (멈추지 않도록)
+// task mode: loopTick core의 writable()도 읽음 (32비트 읽기, 값이 조금 늦어도 다음 확인에서 맞춰짐)
+static bool flowAllows(size_t len) {
+ return !s_link.flowWindow || !s_link.flowOutstanding || s_link.flowOutstanding + len <= s_link.flowWindow;
+}
+
+static void flowSetWindow(uint32_t window) {
+ if (!s_link.flowWindow) s_link.flowOutstanding = 0;  // 공유 연결의 합류 노드 ack는 진행 중인 outstanding 유지
+ s_link.flowWindow = window;
+ s_link.flowLastCreditMs = millis();
+}
+
+static int linkIndexOf(const OrbiSyncNode::OrbiSyncNode* n) {
+ for (uint8_t i = 0; i < s_link.nodeCount; i++) {
+   if (s_link.nodes[i] == n) return i;
+ }
+ return -1;
+}
+
+static void linkAdd(OrbiSyncNode::OrbiSyncNode* n, const char* slotId) {
+ s_link.nodes[s_link.nodeCount] = n;
+ s_link.slots[s_link.nodeCount] = slotId;
+ s_link.nodeCount++;
+}
+
+static void linkRemove(int idx) {
+ if (idx < 0 || idx >= s_link.nodeCount) return;
+ for (uint8_t i = (uint8_t)idx; i + 1 < s_link.nodeCount; i++) {
+   s_link.nodes[i] = s_link.nodes[i + 1];
+   s_link.slots[i] = s_link.slots[i + 1];
+ }
+ s_link.nodeCount--;
+}
+
+// 터널 scratch arena: tunnelConnect 시 한 번 확보하고 재연결에도 유지 (요청마다 malloc/free 없음)
+// [tx b64: 응답 body base64] [tx out: 직렬화된 응답 frame]. 요청 body는 수신 문서 안에서 in-place decode
+// tx는 frame 하나 전송하는 동안만 사용 → 영역이 겹치지 않음
+static constexpr size_t kArenaTxB64Bytes = ((TUNNEL_RESPONSE_BODY_MAX + 2) / 3) * 4 + 1;
+static constexpr size_t kArenaTxFrameOverhead = 1024;  // JSON 필드/headers/escape 여유
+static constexpr size_t kArenaTxOutBytes = kArenaTxB64Bytes + kArenaTxFrameOverhead;
+
+enum ArenaRegion : uint8_t { ARENA_TX_B64, ARENA_TX_OUT };
+
+static uint8_t* s_tunnelArena = nullptr;
+static uint32_t s_tunnelArenaMisses = 0;  // arena에 안 맞아 heap으로 간 횟수
+
+static bool tunnelArenaReserve() {
+ if (s_tunnelArena) return true;
+ size_t total = kArenaTxB64Bytes + kArenaTxOutBytes;
+ s_tunnelArena = (uint8_t*)malloc(total);
+ if (s_tunnelArena) {
+   ORBI_LOGI("[TUNNEL] arena reserved %u bytes\n", (unsigned)total);
+ } else {
+   ORBI_LOGW("[TUNNEL] arena reserve FAILED %u bytes (heap fallback)\n", (unsigned)total);
+ }
+ return s_tunnelArena != nullptr;
+}
+
+// region에서 n바이트. 안 맞으면 heap (heap=true, arenaGive로 반환)
+static void* arenaTake(ArenaRegion region, size_t n, bool& heap) {
+ heap = false;
+ if (s_tunnelArena) {
+   switch (region) {
+     case ARENA_TX_B64:
+       if (n <= kArenaTxB64Bytes) return s_tunnelArena;
+       break;
+     case ARENA_TX_OUT:
+       if (n <= kArenaTxOutBytes) return s_tunnelArena + kArenaTxB64Bytes;
+       break;
+   }
+ }
+ s_tunnelArenaMisses++;
+ if (s_tunnelArena) ORBI_LOGW("[TUNNEL] arena miss region=%u need=%u (heap)\n", (unsigned)region, (unsigned)n);
+ heap = true;
+ return malloc(n);
+}
+
+static void arenaGive(void* p, bool heap) {
+ if (heap && p) free(p);
+}
 
 // 터널 로그 rate limit (10초에 1회)
 static constexpr uint32_t kTunnelStatusLogIntervalMs = 10000;
-static uint32_t s_lastTunnelStatusLogMs = 0;
-static uint32_t s_lastTunnelSkipLogMs = 0;
 
 // tunnel_url에서 tunnel_id(서브도메인), tunnel_host 추출. buf_id/buf_host 최대 64바이트.
 static void parseTunnelUrlParts(const char* url, char* buf_id, size_t sz_id, char* buf_host, size_t sz_host) {
@@ -84,75 +328,16 @@ static void parseTunnelUrlParts(const char* url, char* buf_id, size_t sz_id, cha
 }
 
 // 응답 body preview (최대 200바이트, 제어문자 치환)
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_VERBOSE
 static void logBodyPreview(const char* tag, const char* body, size_t len) {
   constexpr size_t kMaxPreview = 200;
   if (!body) return;
-  size_t pl = len;
-  if (pl > kMaxPreview) pl = kMaxPreview;
   Serial.printf("[%s] response body_len=%u preview=", tag, (unsigned)len);
-  for (size_t i = 0; i < pl; i++) {
-    char c = body[i];
-    if (c == '\r' || c == '\n') Serial.print(' ');
-    else if (c >= 32 && c < 127) Serial.print(c);
-    else Serial.print('.');
-  }
-  if (len > kMaxPreview) Serial.print("...");
-  Serial.println();
-}
-
-// -----------------------------
-// Base64
-// -----------------------------
-static const char kBase64Chars[] =
- "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-static size_t base64Decode(uint8_t* out, const char* in, size_t inLen) {
- size_t outLen = 0;
- int val = 0, valb = -8;
- for (size_t i = 0; i < inLen; i++) {
-   unsigned char c = (unsigned char)in[i];
-   int d = -1;
-   if (c >= 'A' && c <= 'Z') d = c - 'A';
-   else if (c >= 'a' && c <= 'z') d = c - 'a' + 26;
-   else if (c >= '0' && c <= '9') d = c - '0' + 52;
-   else if (c == '+') d = 62;
-   else if (c == '/') d = 63;
-   else if (c == '=') break;
-   else continue;
-
-   val = (val << 6) + d;
-   valb += 6;
-   if (valb >= 0) {
-     out[outLen++] = (uint8_t)((val >> valb) & 0xFF);
-     valb -= 8;
-   }
- }
- return outLen;
-}
-
-static size_t base64Encode(char* out, const uint8_t* in, size_t inLen) {
- size_t i = 0, j = 0;
- for (; i + 2 < inLen; i += 3) {
-   out[j++] = kBase64Chars[(in[i] >> 2) & 0x3F];
-   out[j++] = kBase64Chars[((in[i] & 0x03) << 4) | (in[i+1] >> 4)];
-   out[j++] = kBase64Chars[((in[i+1] & 0x0F) << 2) | (in[i+2] >> 6)];
-   out[j++] = kBase64Chars[in[i+2] & 0x3F];
- }
- if (i < inLen) {
-   out[j++] = kBase64Chars[(in[i] >> 2) & 0x3F];
-   if (i + 1 < inLen) {
-     out[j++] = kBase64Chars[((in[i] & 0x03) << 4) | (in[i+1] >> 4)];
-     out[j++] = kBase64Chars[((in[i+1] & 0x0F) << 2)];
-     out[j++] = '=';
-   } else {
-     out[j++] = kBase64Chars[(in[i] & 0x03) << 4];
-     out[j++] = '=';
-     out[j++] = '=';
-   }
- }
- out[j] = '\0';
- return j;
+  logPreview((const uint8_t*)body, len, kMaxPreview);
 }
+#else
+#define logBodyPreview(...) do {} while (0)
+#endif
 
 // =============================
 // Namespace OrbiSyncNode
@@ -180,12 +365,37 @@ static const char* stateStr(State s) {
 // -----------------------------
 // TunnelHttpRequest::getHeader
 // -----------------------------
-const char* TunnelHttpRequest::getHeader(const char* key) const {
+// FNV-1a (16비트로 접음), ASCII 소문자 기준
+uint16_t TunnelHttpRequest::headerHash(const char* key, size_t len) {
+ uint32_t h = 2166136261u;
+ for (size_t i = 0; i < len; i++) {
+   uint8_t c = (uint8_t)key[i];
+   if (c >= 'A' && c <= 'Z') c = (uint8_t)(c + ('a' - 'A'));
+   h = (h ^ c) * 16777619u;
+ }
+ return (uint16_t)(h ^ (h >> 16));
+}
+
+bool TunnelHttpRequest::addHeader(const char* key, size_t keyLen, const char* value, size_t valueLen) {
+ if (!key || !value || headerCount >= TUNNEL_MAX_HEADERS) return false;
+ TunnelHeaderView& h = headers[headerCount++];
+ h.key = key;
+ h.value = value;
+ h.keyLen = (uint16_t)keyLen;
+ h.valueLen = (uint16_t)valueLen;
+ h.hash = headerHash(key, keyLen);
+ return true;
+}
+
+const char* TunnelHttpRequest::getHeader(const char* key, size_t* outLen) const {
  if (!key) return nullptr;
+ size_t kl = strlen(key);
+ uint16_t hash = headerHash(key, kl);
  for (uint8_t i = 0; i < headerCount; i++) {
-   size_t j = 0;
-   while (key[j] && headers[i].key[j] && key[j] == headers[i].key[j]) j++;
-   if (key[j] == '\0' && headers[i].key[j] == '\0') return headers[i].value;
+   const TunnelHeaderView& h = headers[i];
+   if (h.hash != hash || h.keyLen != kl || strncasecmp(h.key, key, kl) != 0) continue;
+   if (outLen) *outLen = h.valueLen;
+   return h.value;
  }
  return nullptr;
 }
@@ -194,14 +404,38 @@ const char* TunnelHttpRequest::getHeader(const char* key) const {
 // TunnelHttpResponseWriter
 // -----------------------------
 TunnelHttpResponseWriter::TunnelHttpResponseWriter()
- : node_(nullptr), statusCode_(200), headerCount_(0), bodyLen_(0), ended_(false) {
+ : node_(nullptr), statusCode_(200), headerCount_(0), bodyLen_(0), bodyTotal_(0), chunkSeq_(0),
+   format_(kFormatProxy), idNumeric_(false), streaming_(false), binary_(false), truncated_(false), ended_(false),
+   inUse_(false), deferred_(false), taskOpPending_(false), flowHeld_(false), startedMs_(0), acceptEnc_(kEncodingNone),
+   contentEnc_(kEncodingNone), deflate_() {
  requestId_[0] = '\0';
 }
 
+void TunnelHttpResponseWriter::reset(void* node, uint8_t format, bool binary, bool streaming) {
+ node_ = node;
+ requestId_[0] = '\0';
+ statusCode_ = 200;
+ headerCount_ = 0;
+ bodyLen_ = 0;
+ bodyTotal_ = 0;
+ chunkSeq_ = 0;
+ format_ = format;
+ idNumeric_ = false;
+ streaming_ = streaming;
+ binary_ = binary;
+ truncated_ = false;
+ ended_ = false;
+ deferred_ = false;
+ flowHeld_ = false;
+ startedMs_ = millis();
+ acceptEnc_ = kEncodingNone;
+ contentEnc_ = kEncodingNone;
+}
+
 void TunnelHttpResponseWriter::setStatus(int code) { statusCode_ = code; }
 
 void TunnelHttpResponseWriter::setHeader(const char* key, const char* value) {
- if (!key || !value || headerCount_ >= TUNNEL_MAX_HEADERS) return;
+ if (!key || !value || headerCount_ >= TUNNEL_MAX_RESPONSE_HEADERS) return;
  strncpy(headers_[headerCount_].key, key, 23);
  headers_[headerCount_].key[23] = '\0';
  strncpy(headers_[headerCount_].value, value, 79);
@@ -211,10 +445,26 @@ void TunnelHttpResponseWriter::setHeader(const char* key, const char* value) {
 
 void TunnelHttpResponseWriter::write(const uint8_t* data, size_t len) {
  if (!data || ended_) return;
- size_t remain = sizeof(body_) - bodyLen_;
- if (len > remain) len = remain;
- memcpy(body_ + bodyLen_, data, len);
- bodyLen_ += len;
+ while (len > 0) {
+   size_t remain = sizeof(body_) - 1 - bodyLen_;
+   if (remain == 0) {
+     if (!streaming_ || !node_ || format_ != kFormatProxy) {
+       if (!truncated_) ORBI_LOGW("[HTTP_RESP] body truncated at %u bytes (streaming off)\n", (unsigned)bodyLen_);
+       truncated_ = true;
+       return;
+     }
+     // 버퍼가 찼고 더 쓸 데이터가 있음 → 현재 버퍼를 chunk로 flush
+     OrbiSyncNode* node = static_cast<OrbiSyncNode*>(node_);
+     if (!node->tunnelQueueWriterOp(*this, false)) node->tunnelSendProxyChunk(*this, false);
+     continue;
+   }
+   size_t n = len < remain ? len : remain;
+   memcpy(body_ + bodyLen_, data, n);
+   bodyLen_ += n;
+   bodyTotal_ += n;
+   data += n;
+   len -= n;
+ }
 }
 
 void TunnelHttpResponseWriter::write(const char* str) {
@@ -222,12 +472,31 @@ void TunnelHttpResponseWriter::write(const char* str) {
  write((const uint8_t*)str, strlen(str));
 }
 
+size_t TunnelHttpResponseWriter::writable() const {
+ if (!inUse_ || ended_) return 0;
+ size_t remain = sizeof(body_) - 1 - bodyLen_;
+ if (!streaming_ || !node_ || format_ != kFormatProxy) return remain;
+ // 버퍼가 차면 chunk flush: window가 그 frame을 받을 수 있을 때만 버퍼 하나 더
+ return flowAllows(frameCost(sizeof(body_) - 1)) ? remain + sizeof(body_) - 1 : remain;
+}
+
+// 압축 전 기준 (압축되면 실제 frame은 더 작음). header는 첫 frame에만
+size_t TunnelHttpResponseWriter::frameCost(size_t bodyLen) const {
+ size_t body = binary_ ? bodyLen : ((bodyLen + 2) / 3) * 4;
+ return body + (chunkSeq_ ? 0 : (size_t)headerCount_ * 48) + kFlowFrameOverhead;
+}
+
 void TunnelHttpResponseWriter::end() {
  if (ended_) return;
  ended_ = true;
  if (node_) {
-   static_cast<OrbiSyncNode*>(node_)->tunnelSendProxyResponse(*this);
+   OrbiSyncNode* node = static_cast<OrbiSyncNode*>(node_);
+   if (node->tunnelQueueWriterOp(*this, true)) return;  // network task가 전송 후 slot 반환
+   node->tunnelWriterSend(*this);  // window가 닫혀 있으면 tunnelPollStreams가 전송 후 slot 반환
+   return;
  }
+ inUse_ = false;
+ deferred_ = false;
 }
 
 // -----------------------------
@@ -235,246 +504,873 @@ void TunnelHttpResponseWriter::end() {
 // -----------------------------
 static uint32_t cfgOrDefaultU32(uint32_t v, uint32_t defv) { return v ? v : defv; }
 static size_t cfgOrDefaultSz(size_t v, size_t defv) { return v ? v : defv; }
-
 // -----------------------------
-// safePostJson (NO new/delete)
+// HTTP exchange engine (NO new/delete)
 // -----------------------------
 // - static TLS/plain client reuse
 // - header read: connected() 조건 제거 + first-byte wait
 // - timeout을 넉넉히(HELLO 단계에서 header read 늦게 오는 경우 방지)
-static bool safePostJson(
+// - cfg.httpKeepAlive: 같은 host:port면 소켓 유지 (Content-Length/chunked 프레이밍)
+// - connect(+TLS handshake)는 Arduino client API상 블로킹. 이후 단계는 httpPump()마다 budget 바이트씩 진행
+//   → safePostJson(블로킹)과 asyncHttp 모드가 같은 파서를 공유
+static constexpr uint32_t kHttpConnectTimeoutMs = 12000;
+static constexpr uint32_t kHttpFirstByteWaitMs  = 3000;
+static constexpr uint32_t kHttpHeaderTimeoutMs  = 15000; // 핵심: 기존 8초는 짧아서 header 못 받는 케이스 많음
+static constexpr uint32_t kHttpBodyTimeoutMs    = 15000;
+static constexpr size_t   kHttpMaxHeaderBytes   = 2048;
+static constexpr size_t   kHttpPumpBudget       = 512;   // asyncHttp: loopTick당 처리 바이트
+static constexpr size_t   kHttpReqHeaderBytes   = limits::kTokenBytes + 512;  // 요청 header (stack, bearer 포함)
+
+// --- static clients ---
+#if defined(ESP8266)
+static BearSSL::WiFiClientSecure s_tls;
+#elif defined(ESP32)
+static WiFiClientSecure s_tls;
+#endif
+static WiFiClient s_plain;
+
+// keep-alive로 열려 있는 Hub 연결 정보
+struct KeepAliveConn {
+ char host[128];
+ uint16_t port;
+ bool useTls;
+ bool open;
+ uint8_t httpsFailCount;  // 연속 HTTPS connect 실패 (MAX_HTTPS_FAIL_COUNT면 HTTP로)
+};
+static KeepAliveConn s_httpConn = {};
+
+// Hub host DNS 캐시: TTL 동안 resolver 왕복 없이 connect(IP). 해석될 때마다 바뀐 주소는 예비 주소로 보관
+// - connect 실패 → 다음 주소, 모두 실패하면 만료시켜 다음 connect에서 다시 해석
+// - 해석 실패 시 만료된 주소라도 있으면 사용 (resolver 장애 중 재연결)
+#ifndef ORBISYNC_DNS_CACHE
+#define ORBISYNC_DNS_CACHE 1
+#endif
+#ifndef ORBISYNC_DNS_CACHE_HOSTS
+#define ORBISYNC_DNS_CACHE_HOSTS 2
+#endif
+#ifndef ORBISYNC_DNS_CACHE_ADDRS
+#define ORBISYNC_DNS_CACHE_ADDRS 2
+#endif
+
+#if ORBISYNC_DNS_CACHE
+static constexpr uint32_t kDefaultDnsCacheTtlMs = 300000;
+
+struct DnsCacheEntry {
+ char host[128];
+ IPAddress addrs[ORBISYNC_DNS_CACHE_ADDRS];  // [0]: 최근 해석 결과, 나머지: 이전 주소 (fallback)
+ uint8_t count;
+ uint8_t cur;          // 다음 connect에 쓸 주소
+ bool expired;
+ uint32_t resolvedMs;
+ uint32_t usedMs;      // 교체 대상 선정 (가장 오래 안 쓴 항목)
+};
+static DnsCacheEntry s_dnsCache[ORBISYNC_DNS_CACHE_HOSTS];
+
+static DnsCacheEntry* dnsEntryFor(const char* host, uint32_t now) {
+ DnsCacheEntry* victim = &s_dnsCache[0];
+ for (uint8_t i = 0; i < ORBISYNC_DNS_CACHE_HOSTS; i++) {
+   DnsCacheEntry& e = s_dnsCache[i];
+   if (e.host[0] && strcmp(e.host, host) == 0) return &e;
+   if (!e.host[0]) { victim = &e; break; }
+   if ((int32_t)(e.usedMs - victim->usedMs) < 0) victim = &e;
+ }
+ if (strlen(host) >= sizeof(victim->host)) return nullptr;
+ *victim = DnsCacheEntry();
+ strcpy(victim->host, host);
+ victim->usedMs = now;
+ return victim;
+}
+
+static void dnsRemember(DnsCacheEntry& e, const IPAddress& ip, uint32_t now) {
+ uint8_t found = e.count;
+ for (uint8_t i = 0; i < e.count; i++) {
+   if ((uint32_t)e.addrs[i] == (uint32_t)ip) { found = i; break; }
+ }
+ if (found == e.count && e.count < ORBISYNC_DNS_CACHE_ADDRS) e.count++;
+ if (found >= e.count) found = e.count - 1;  // 가득 차면 가장 오래된 주소를 밀어냄
+ for (uint8_t i = found; i > 0; i--) e.addrs[i] = e.addrs[i - 1];
+ e.addrs[0] = ip;
+ e.cur = 0;
+ e.expired = false;
+ e.resolvedMs = now;
+}
+
+// host → IP. IP 문자열이면 그대로. false면 host 이름으로 connect (client 내부 DNS)
+static bool dnsLookup(const Config& cfg, const char* host, IPAddress& out) {
+ if (out.fromString(host)) return true;
+ uint32_t now = millis();
+ DnsCacheEntry* e = dnsEntryFor(host, now);
+ if (!e) return false;
+ e->usedMs = now;
+
+ uint32_t ttl = cfgOrDefaultU32(cfg.dnsCacheTtlMs, kDefaultDnsCacheTtlMs);
+ if (e->count && !e->expired && (uint32_t)(now - e->resolvedMs) < ttl) {
+   out = e->addrs[e->cur];
+   return true;
+ }
+
+ uint32_t t0 = millis();
+ IPAddress ip;
+ bool ok = WiFi.hostByName(host, ip) == 1 && (uint32_t)ip != 0;
+ if (cfg.debugHttp) {
+   ORBI_LOGD("[DNS] resolve host=%s ok=%d elapsed=%u\n", host, ok ? 1 : 0, (unsigned)(millis() - t0));
+ }
+ if (ok) {
+   dnsRemember(*e, ip, now);
+ } else if (e->count) {
+   // resolver 실패: 이전 주소로 시도, ttl 뒤에 다시 해석
+   e->resolvedMs = now;
+   e->expired = false;
+   ORBI_LOGW("[DNS] resolve failed host=%s -> cached address\n", host);
+ } else {
+   return false;
+ }
+ out = e->addrs[e->cur];
+ return true;
+}
+
+// connect(IP) 실패: 예비 주소로 넘김. 한 바퀴 돌면 만료 (다음엔 다시 해석)
+static void dnsConnectFailed(const char* host) {
+ for (uint8_t i = 0; i < ORBISYNC_DNS_CACHE_HOSTS; i++) {
+   DnsCacheEntry& e = s_dnsCache[i];
+   if (!e.host[0] || strcmp(e.host, host) != 0 || e.count == 0) continue;
+   e.cur = (uint8_t)((e.cur + 1) % e.count);
+   if (e.cur == 0) e.expired = true;
+   return;
+ }
+}
+#endif
+
+static bool keepAliveMatches(const char* host, uint16_t port, bool useTls) {
+ return s_httpConn.open && s_httpConn.port == port && s_httpConn.useTls == useTls &&
+        strcmp(s_httpConn.host, host) == 0;
+}
+
+static void keepAliveRemember(const char* host, uint16_t port, bool useTls) {
+ strncpy(s_httpConn.host, host, sizeof(s_httpConn.host) - 1);
+ s_httpConn.host[sizeof(s_httpConn.host) - 1] = '\0';
+ s_httpConn.port = port;
+ s_httpConn.useTls = useTls;
+ s_httpConn.open = true;
+}
+
+enum class HttpPhase : uint8_t { IDLE, FIRST_BYTE, HEADERS, BODY, DONE };
+enum class HttpBody : uint8_t { LENGTH, UNTIL_CLOSE, CHUNK_SIZE, CHUNK_DATA, CHUNK_END, TRAILER };
+
+// 진행 중인 요청 1건 (slot은 하나: OrbiSyncNode::httpOp_로 보호)
+struct HttpExchange {
+ HttpPhase phase;
+ HttpBody bodyMode;
+ WiFiClient* c;
+ const Config* cfg;
+ const char* logPrefix;
+
+ char host[128];
+ uint16_t port;
+ bool useTls;
+ char path[256];
+ const char* jsonBody;   // 요청 완료 전까지 호출자가 유지 (async는 static 버퍼 또는 노드의 tpl_)
+
+ char* outBody;
+ size_t outBodyMax;
+ size_t total;
+ int status;
+ bool ok;
+
+ bool reused;
+ bool serverKeepAlive;
+ uint32_t phaseMs;
+ size_t headerBytes;
+ size_t remain;          // Content-Length 또는 현재 chunk 남은 바이트
+ bool hasContentLength;
+ bool chunked;
+ char line[256];
+ size_t lp;
+
+ HubEndpointMetrics* m;  // httpMetricsStart~httpMetricsDone 사이만 유효
+ uint32_t startMs;
+ const char* bearer;     // Authorization: Bearer (nullptr면 생략). 요청 완료까지 호출자가 유지
+ uint32_t headerTimeoutMs;  // 0이면 kHttpHeaderTimeoutMs (long-poll은 더 길게)
+ uint32_t retryAfterMs;  // 응답 Retry-After (초 단위 값만 지원, 0 = 없음)
+ const void* owner;      // asyncHttp 요청을 시작한 노드 (slot은 gateway 전체에 하나)
+ JsonDocument* sink;     // != nullptr: 2xx body를 outBody 대신 이 문서로 바로 파싱 (filter 적용). 요청마다 호출자가 설정
+ bool sinkActive;        // 이번 응답이 sink로 파싱됨 (2xx). 이때 outBody는 빈 문자열, total은 읽은 body 바이트
+ bool sinkParsed;        // 문서 파싱 끝, 남은 body 소비 중 (safePostJson)
+ bool async;             // asyncHttp 요청: sink body를 s_hubRxBody에 모은 뒤 메모리에서 파싱 (대기 없음)
+ size_t sinkLen;         // async: s_hubRxBody에 모은 bytes
+ DeserializationError::Code sinkErr;
+};
+static HttpExchange s_http = {};
+
+static void httpMetricsStart(HttpExchange& x, HubEndpointMetrics* m) {
+ x.m = m;
+ x.startMs = millis();
+}
+
+// 요청 하나 완료(성공/실패) 시 1회
+static void httpMetricsDone(HttpExchange& x) {
+ HubEndpointMetrics* m = x.m;
+ x.m = nullptr;
+ if (!m) return;
+ m->requests++;
+ if (!x.ok) m->failures++;
+ m->bytesIn += x.headerBytes + x.total;
+ m->totalMs.record(millis() - x.startMs);
+}
+
+static void httpFail(HttpExchange& x) {
+ x.c->stop();
+ s_httpConn.open = false;
+ x.outBody[x.sinkActive ? 0 : x.total] = '\0';
+ x.ok = false;
+ x.phase = HttpPhase::DONE;
+}
+
+// framed=true면 응답 경계를 정확히 읽음 → 연결 재사용 가능
+static void httpFinish(HttpExchange& x, bool framed) {
+ x.outBody[x.sinkActive ? 0 : x.total] = '\0';
+
+ if (x.useTls && x.total > 0 && x.status > 0) s_httpConn.httpsFailCount = 0;
+
+ if (x.cfg->httpKeepAlive && x.serverKeepAlive && framed && x.c->connected()) {
+   keepAliveRemember(x.host, x.port, x.useTls);
+ } else {
+   x.c->stop();
+   s_httpConn.open = false;
+ }
+ x.ok = (x.total > 0 && x.status > 0);
+ x.phase = HttpPhase::DONE;
+}
+
+// connect + request 전송. 실패 시 false (x.phase == DONE, x.ok == false)
+static bool httpBegin(
+ HttpExchange& x,
  const Config& cfg,
  const char* host,
  uint16_t port,
  bool useTls,
  const char* path,
  const char* jsonBody,
- int* outStatus,
  char* outBody,
  size_t outBodyMax,
  const char* logPrefix
 ) {
- if (!host || !path || !outStatus || !outBody || outBodyMax == 0) return false;
+ x.phase = HttpPhase::DONE;
+ x.ok = false;
+ x.total = 0;
+ x.sinkActive = false;
+ x.sinkErr = DeserializationError::EmptyInput;
+ if (!host || !path || !outBody || outBodyMax == 0) return false;
+ if (strlen(host) >= sizeof(x.host) || strlen(path) >= sizeof(x.path)) return false;
+
  outBody[0] = '\0';
- *outStatus = 0;
+ x.cfg = &cfg;
+ x.logPrefix = logPrefix;
+ strcpy(x.host, host);
+ x.port = port;
+ x.useTls = useTls;
+ strcpy(x.path, path);
+ x.jsonBody = jsonBody;
+ x.outBody = outBody;
+ x.outBodyMax = outBodyMax;
+ x.total = 0;
+ x.status = 0;
+ x.headerBytes = 0;
+ x.remain = 0;
+ x.hasContentLength = false;
+ x.chunked = false;
+ x.lp = 0;
+ x.retryAfterMs = 0;
+ x.serverKeepAlive = cfg.httpKeepAlive;
 
  yield();
 
- const uint32_t CONNECT_TIMEOUT_MS = 12000;
- const uint32_t FIRST_BYTE_WAIT_MS = 3000;
- const uint32_t HEADER_TIMEOUT_MS = 15000; // 핵심: 기존 8초는 짧아서 header 못 받는 케이스 많음
- const uint32_t BODY_TIMEOUT_MS   = 15000;
+ WiFiClient* c = useTls ? (WiFiClient*)&s_tls : &s_plain;
+ x.c = c;
+
+ x.reused = cfg.httpKeepAlive && keepAliveMatches(host, port, useTls) && c->connected();
+ if (!x.reused) {
+   // 다른 endpoint로 열려 있던 keep-alive 연결 정리
+   if (s_httpConn.open) { s_tls.stop(); s_plain.stop(); }
+   s_httpConn.open = false;
 
- // --- static clients ---
 #if defined(ESP8266)
- static BearSSL::WiFiClientSecure s_tls;
- static WiFiClient s_plain;
- WiFiClient* c = nullptr;
-
- if (useTls) {
-   // TLS 설정
-   if (cfg.allowInsecureTls) {
-     s_tls.setInsecure();
+   if (useTls) {
+     // TLS 설정
+     if (cfg.allowInsecureTls) {
+       s_tls.setInsecure();
+     } else {
+       // rootCaPem을 쓰고 싶으면 여기서 setTrustAnchors로 넣어야 함(현재는 allowInsecureTls 권장)
+       s_tls.setInsecure(); // 현실적으로 CA 넣기 전까지는 insecure가 안정적
+     }
+     s_tls.setTimeout(kHttpConnectTimeoutMs / 1000);
+     s_tls.setNoDelay(true);
+     s_tls.setBufferSizes(limits::kTlsRxBytes, limits::kTlsTxBytes);
+     s_tls.stop();
+#if ORBISYNC_TLS_SESSION_CACHE
+     // 같은 Hub면 이전 세션으로 abbreviated handshake (실패 시 BearSSL이 full handshake로 폴백)
+     s_tls.setSession(tlsSessionFor(host));
+#endif
    } else {
-     // rootCaPem을 쓰고 싶으면 여기서 setTrustAnchors로 넣어야 함(현재는 allowInsecureTls 권장)
-     s_tls.setInsecure(); // 현실적으로 CA 넣기 전까지는 insecure가 안정적
+     s_plain.setTimeout(kHttpConnectTimeoutMs / 1000);
+     s_plain.stop();
    }
-   s_tls.setTimeout(CONNECT_TIMEOUT_MS / 1000);
-   s_tls.setNoDelay(true);
-   s_tls.setBufferSizes(512, 512);
-   s_tls.stop();
-
-   c = (WiFiClient*)&s_tls;
- } else {
-   s_plain.setTimeout(CONNECT_TIMEOUT_MS / 1000);
-   s_plain.stop();
-   c = &s_plain;
- }
 #elif defined(ESP32)
- static WiFiClientSecure s_tls;
- static WiFiClient s_plain;
- WiFiClient* c = nullptr;
-
- if (useTls) {
-   if (cfg.allowInsecureTls) s_tls.setInsecure();
-   else s_tls.setInsecure();
-   s_tls.setTimeout(CONNECT_TIMEOUT_MS / 1000);
-   s_tls.stop();
-   c = (WiFiClient*)&s_tls;
- } else {
-   s_plain.setTimeout(CONNECT_TIMEOUT_MS / 1000);
-   s_plain.stop();
-   c = &s_plain;
- }
+   if (useTls) {
+     if (cfg.allowInsecureTls) s_tls.setInsecure();
+     else s_tls.setInsecure();
+     s_tls.setTimeout(kHttpConnectTimeoutMs / 1000);
+     s_tls.stop();
+   } else {
+     s_plain.setTimeout(kHttpConnectTimeoutMs / 1000);
+     s_plain.stop();
+   }
 #endif
 
- // connect
- if (cfg.debugHttp) {
-   Serial.printf("[%s] connect try host=%s port=%u tls=%d\n", logPrefix, host, port, useTls ? 1 : 0);
- }
-
- uint32_t t0 = millis();
- bool connected = c->connect(host, port);
- uint32_t elapsed = millis() - t0;
-
- if (!connected || elapsed > CONNECT_TIMEOUT_MS) {
+   // connect
    if (cfg.debugHttp) {
-     Serial.printf("[%s] connect failed elapsed=%u\n", logPrefix, (unsigned)elapsed);
+     ORBI_LOGD("[%s] connect try host=%s port=%u tls=%d\n", logPrefix, host, port, useTls ? 1 : 0);
    }
-   if (useTls) {
-     s_httpsFailCount++;
-     if (s_httpsFailCount >= MAX_HTTPS_FAIL_COUNT) {
-       if (cfg.debugHttp) Serial.printf("[%s] HTTPS failcount=%u -> fallback HTTP\n", logPrefix, s_httpsFailCount);
-       return safePostJson(cfg, host, 80, false, path, jsonBody, outStatus, outBody, outBodyMax, logPrefix);
+
+   uint32_t t0 = millis();
+   bool connected = false;
+#if ORBISYNC_DNS_CACHE
+   // ESP8266 BearSSL은 IP로 connect하면 SNI를 보낼 수 없어 TLS는 host 이름으로 (lwIP DNS 캐시 사용)
+   IPAddress ip;
+   bool byIp = false;
+#if defined(ESP32)
+   byIp = dnsLookup(cfg, host, ip);
+   if (byIp) connected = useTls ? s_tls.connect(ip, port, host, nullptr, nullptr, nullptr) : s_plain.connect(ip, port);
+#else
+   byIp = !useTls && dnsLookup(cfg, host, ip);
+   if (byIp) connected = s_plain.connect(ip, port);
+#endif
+   if (!byIp) connected = c->connect(host, port);
+   if (!connected && byIp) dnsConnectFailed(host);
+#else
+   connected = c->connect(host, port);
+#endif
+   uint32_t elapsed = millis() - t0;
+
+   if (!connected || elapsed > kHttpConnectTimeoutMs) {
+     if (cfg.debugHttp) {
+       ORBI_LOGW("[%s] connect failed elapsed=%u\n", logPrefix, (unsigned)elapsed);
      }
+     if (useTls) {
+       s_httpConn.httpsFailCount++;
+       if (s_httpConn.httpsFailCount >= MAX_HTTPS_FAIL_COUNT) {
+         if (cfg.debugHttp) ORBI_LOGD("[%s] HTTPS failcount=%u -> fallback HTTP\n", logPrefix, s_httpConn.httpsFailCount);
+         return httpBegin(x, cfg, host, 80, false, path, jsonBody, outBody, outBodyMax, logPrefix);
+       }
+     }
+     c->stop();
+     return false;
    }
-   c->stop();
-   return false;
+   if (x.m) x.m->connectMs.record(elapsed);
+ } else {
+   if (x.m) x.m->reused++;
+   if (cfg.debugHttp) ORBI_LOGD("[%s] reuse keep-alive host=%s port=%u\n", logPrefix, host, port);
  }
 
  // send request
  size_t bodyLen = jsonBody ? strlen(jsonBody) : 0;
 
- // 작은 버퍼로 헤더 작성
- char req[512];
+ // 작은 버퍼로 헤더 작성 (bearer token 최대 limits::kTokenBytes-1자 포함)
+ char req[kHttpReqHeaderBytes];
+ bool auth = x.bearer && x.bearer[0];
  int reqLen = snprintf(req, sizeof(req),
    "POST %s HTTP/1.1\r\n"
    "Host: %s\r\n"
    "Content-Type: application/json\r\n"
    "Content-Length: %u\r\n"
-   "Connection: close\r\n"
+   "Connection: %s\r\n"
+   "%s%s%s"
    "\r\n",
-   path, host, (unsigned)bodyLen
+   path, host, (unsigned)bodyLen, cfg.httpKeepAlive ? "keep-alive" : "close",
+   auth ? "Authorization: Bearer " : "", auth ? x.bearer : "", auth ? "\r\n" : ""
  );
  if (reqLen <= 0 || (size_t)reqLen >= sizeof(req)) {
-   c->stop();
+   httpFail(x);
    return false;
  }
 
- if (c->write((const uint8_t*)req, (size_t)reqLen) != (size_t)reqLen) {
-   c->stop();
-   return false;
- }
+ bool sent = c->write((const uint8_t*)req, (size_t)reqLen) == (size_t)reqLen;
+ yield();
+ if (sent && bodyLen > 0) sent = c->write((const uint8_t*)jsonBody, bodyLen) == bodyLen;
  yield();
 
- if (bodyLen > 0) {
-   if (c->write((const uint8_t*)jsonBody, bodyLen) != bodyLen) {
-     c->stop();
-     return false;
+ if (!sent) {
+   if (x.reused) {
+     // 재사용 연결이 서버 쪽에서 닫혀 있었음 → 새 연결로 1회 재시도
+     httpFail(x);
+     return httpBegin(x, cfg, host, port, useTls, path, jsonBody, outBody, outBodyMax, logPrefix);
    }
+   httpFail(x);
+   return false;
  }
- yield();
 
- // ---- FIRST BYTE WAIT (중요) ----
- uint32_t fb0 = millis();
- while (!c->available() && (millis() - fb0) < FIRST_BYTE_WAIT_MS) {
-   delay(1);
-   yield();
- }
+ if (x.m) x.m->bytesOut += (uint32_t)reqLen + bodyLen;
+ x.phase = HttpPhase::FIRST_BYTE;
+ x.phaseMs = millis();
+ return true;
+}
 
- // header read (connected() 조건 제거!)
- uint32_t h0 = millis();
- bool headerDone = false;
- size_t headerBytes = 0;
- size_t contentLength = 0;
+// 재사용 연결이 유휴 중 닫혀 있었으면 새 연결로 다시 보냄. 진행 계속이면 false
+static bool httpRetryFresh(HttpExchange& x) {
+ if (x.cfg->debugHttp) ORBI_LOGD("[%s] keep-alive conn stale -> reconnect\n", x.logPrefix);
+ x.c->stop();
+ s_httpConn.open = false;
+ char host[128];
+ char path[256];
+ strcpy(host, x.host);
+ strcpy(path, x.path);
+ httpBegin(x, *x.cfg, host, x.port, x.useTls, path, x.jsonBody, x.outBody, x.outBodyMax, x.logPrefix);
+ return x.phase == HttpPhase::DONE;
+}
 
- char line[256];
- size_t lp = 0;
+static void httpParseHeaderLine(HttpExchange& x) {
+ const char* line = x.line;
 
- while ((millis() - h0) < HEADER_TIMEOUT_MS && headerBytes < 2048) {
-   if (!c->available()) {
-     // 연결은 유지되는데 available이 늦는 경우가 있음
-     delay(1);
-     yield();
-     continue;
-   }
-   int ch = c->read();
-   if (ch < 0) { delay(1); yield(); continue; }
+ if (strncmp(line, "HTTP/", 5) == 0) {
+   const char* sp = strchr(line, ' ');
+   if (sp) x.status = atoi(sp + 1);
+   if (strncmp(line, "HTTP/1.0", 8) == 0) x.serverKeepAlive = false;
+ }
 
-   headerBytes++;
-   if (ch == '\r') continue;
+ if (strncasecmp(line, "Content-Length:", 15) == 0) {
+   x.remain = (size_t)atoi(line + 15);
+   x.hasContentLength = true;
+ }
 
-   if (ch == '\n') {
-     line[lp] = '\0';
-     lp = 0;
+ if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 && strstr(line + 18, "chunked")) {
+   x.chunked = true;
+ }
 
-     if (line[0] == '\0') { // empty line => end header
-       headerDone = true;
-       break;
-     }
+ if (strncasecmp(line, "Retry-After:", 12) == 0) {
+   long sec = atol(line + 12);  // HTTP-date 형식은 0 → backoff 사용
+   x.retryAfterMs = (sec > 0) ? (uint32_t)sec * 1000 : 0;
+ }
 
-     if (strncmp(line, "HTTP/", 5) == 0) {
-       const char* sp = strchr(line, ' ');
-       if (sp) *outStatus = atoi(sp + 1);
-     }
+ if (strncasecmp(line, "Connection:", 11) == 0) {
+   const char* v = line + 11;
+   while (*v == ' ') v++;
+   if (strncasecmp(v, "close", 5) == 0) x.serverKeepAlive = false;
+ }
+}
 
-     if (strncasecmp(line, "Content-Length:", 15) == 0) {
-       contentLength = (size_t)atoi(line + 15);
-     }
+// 한 줄 누적. 1=줄 완성(x.line), 0=데이터 더 필요, -1=연결 끊김
+static int httpReadLineStep(HttpExchange& x, size_t& used) {
+ WiFiClient* c = x.c;
+ if (!c->available()) return c->connected() ? 0 : -1;
+ int ch = c->read();
+ if (ch < 0) return 0;
+ used++;
+ if (ch == '\r') return 0;
+ if (ch == '\n') {
+   x.line[x.lp] = '\0';
+   x.lp = 0;
+   return 1;
+ }
+ if (x.lp < sizeof(x.line) - 1) x.line[x.lp++] = (char)ch;
+ return 0;
+}
 
-     yield();
-     continue;
-   }
+// x.remain 바이트를 outBody 뒤에 붙임. 버퍼를 넘는 부분은 읽고 버림(다음 응답 프레이밍 유지)
+// 1=다 읽음, 0=데이터 더 필요, -1=연결 끊김
+static int httpReadBytesStep(HttpExchange& x, size_t& used, size_t budget) {
+ WiFiClient* c = x.c;
+ if (x.remain == 0) return 1;
+ int avail = c->available();
+ if (avail <= 0) return c->connected() ? 0 : -1;
+
+ size_t want = x.remain;
+ if (want > (size_t)avail) want = (size_t)avail;
+ if (want > budget - used) want = budget - used;
+ if (want > 256) want = 256;
+
+ size_t room = x.outBodyMax - 1 - x.total;
+ int r;
+ if (room > 0) {
+   if (want > room) want = room;
+   r = c->read((uint8_t*)(x.outBody + x.total), want);
+   if (r > 0) x.total += (size_t)r;
+ } else {
+   uint8_t sink[64];
+   if (want > sizeof(sink)) want = sizeof(sink);
+   r = c->read(sink, want);
+ }
+ if (r > 0) {
+   x.remain -= (size_t)r;
+   used += (size_t)r;
+ }
+ return x.remain == 0 ? 1 : 0;
+}
 
-   if (lp < sizeof(line) - 1) {
-     line[lp++] = (char)ch;
-   }
+// ---- sink 모드 body reader ----
+// ArduinoJson custom reader (read / readBytes). Content-Length / chunked / close 경계를 풀어 body 바이트만 넘김
+// → 응답 크기와 관계없이 메모리 일정 (버퍼 복사 없음, filter 밖 필드는 문서에 안 들어감)
+// wait: body timeout까지 블로킹 (safePostJson과 같은 delay(1) 루프, 파싱 중에만). 아니면 바이트가 없을 때 kHttpReadPending
+static constexpr int kHttpReadPending = -2;
 
-   if ((headerBytes % 64) == 0) yield();
+static int httpWaitRead(HttpExchange& x, bool wait) {
+ while (!x.c->available()) {
+   if (!x.c->connected() || (millis() - x.phaseMs) >= kHttpBodyTimeoutMs) return -1;
+   if (!wait) return kHttpReadPending;
+   delay(1);
  }
+ return x.c->read();
+}
 
- if (!headerDone) {
-   if (cfg.debugHttp) {
-     Serial.printf("[%s] header timeout (read=%u)\n", logPrefix, (unsigned)headerBytes);
+struct HttpBodyReader {
+ HttpExchange& x;
+ bool wait;
+ bool end;     // body 끝 또는 실패
+ bool framed;  // 응답 경계까지 정확히 읽음 (keep-alive 재사용 가능)
+
+ HttpBodyReader(HttpExchange& ex, bool w) : x(ex), wait(w), end(false), framed(false) {}
+
+ // chunk size / CRLF / trailer 한 줄 (x.line, 읽던 줄은 x.lp로 이어짐). 1 = 한 줄, 0 = 끊김, kHttpReadPending
+ int line() {
+   for (;;) {
+     int ch = httpWaitRead(x, wait);
+     if (ch == kHttpReadPending) return ch;
+     if (ch < 0) return 0;
+     x.headerBytes++;  // framing 바이트도 bytesIn에 포함
+     if (ch == '\r') continue;
+     if (ch == '\n') {
+       x.line[x.lp] = '\0';
+       x.lp = 0;
+       return 1;
+     }
+     if (x.lp < sizeof(x.line) - 1) x.line[x.lp++] = (char)ch;
    }
-   c->stop();
-   return false;
  }
 
- // body read
- uint32_t b0 = millis();
- size_t total = 0;
+ int take() {
+   int ch = httpWaitRead(x, wait);
+   if (ch == kHttpReadPending) return ch;
+   if (ch < 0) { end = true; return -1; }
+   if (x.remain) x.remain--;
+   x.total++;
+   return ch;
+ }
 
- while ((millis() - b0) < BODY_TIMEOUT_MS && total < outBodyMax - 1) {
-   if (!c->available()) {
-     // Content-Length가 있고 다 읽었으면 종료
-     if (contentLength > 0 && total >= contentLength) break;
-     // 연결이 끊겼고 더 없으면 종료
-     if (!c->connected()) break;
-     delay(1);
-     yield();
-     continue;
+ int read() {
+   while (!end) {
+     int l;
+     switch (x.bodyMode) {
+       case HttpBody::LENGTH:
+         if (x.remain == 0) { end = framed = true; break; }
+         return take();
+       case HttpBody::UNTIL_CLOSE:
+         return take();
+       case HttpBody::CHUNK_SIZE:
+         l = line();
+         if (l == kHttpReadPending) return l;
+         if (!l) { end = true; break; }
+         x.remain = (size_t)strtoul(x.line, nullptr, 16);
+         x.bodyMode = (x.remain == 0) ? HttpBody::TRAILER : HttpBody::CHUNK_DATA;
+         break;
+       case HttpBody::CHUNK_DATA:
+         if (x.remain == 0) { x.bodyMode = HttpBody::CHUNK_END; break; }
+         return take();
+       case HttpBody::CHUNK_END:
+         l = line();
+         if (l == kHttpReadPending) return l;
+         if (!l) { end = true; break; }
+         x.bodyMode = HttpBody::CHUNK_SIZE;
+         break;
+       case HttpBody::TRAILER:
+         l = line();
+         if (l == kHttpReadPending) return l;
+         if (!l) { end = true; break; }
+         if (x.line[0] == '\0') end = framed = true;
+         break;
+     }
    }
+   return -1;
+ }
 
-   size_t toRead = outBodyMax - 1 - total;
-   if (toRead > 256) toRead = 256;
-   int r = c->read((uint8_t*)(outBody + total), toRead);
-   if (r > 0) total += (size_t)r;
+ size_t readBytes(char* buf, size_t n) {
+   size_t i = 0;
+   for (; i < n; i++) {
+     int ch = read();
+     if (ch < 0) break;
+     buf[i] = (char)ch;
+   }
+   return i;
+ }
+};
 
-   if ((total % 128) == 0) yield();
-   if (contentLength > 0 && total >= contentLength) break;
+// Hub 응답에서 쓰는 필드만 (hello / pair / approve / session / register_by_slot / heartbeat). 처음 사용 시 한 번 생성
+static StaticJsonDocument<384> s_hubRxFilter;
+
+static const JsonDocument& hubRxFilter() {
+ static bool built = false;
+ if (!built) {
+   static const char* const kFields[] = {
+     "status", "ok", "retry_after_ms",
+     "pairing_code", "pairing", "code", "pairing_expires_at", "expires_at",
+     "node_id", "canonical_node_id", "resolved_node_id",
+     "session_token", "node_token", "register_token", "node_auth_token", "tunnel_url",
+   };
+   for (size_t i = 0; i < sizeof(kFields) / sizeof(kFields[0]); i++) s_hubRxFilter[kFields[i]] = true;
+   // heartbeat / session 응답의 command poll 결과 (원소마다 같은 filter)
+   s_hubRxFilter["commands"][0]["id"] = true;
+   s_hubRxFilter["commands"][0]["name"] = true;
+   s_hubRxFilter["commands"][0]["args"] = true;
+   built = true;
  }
+ return s_hubRxFilter;
+}
 
- outBody[total] = '\0';
+// asyncHttp 2xx body: pump budget만큼 non-blocking reader로 모음 (chunked / close 경계 포함) → 끝나면 메모리에서 파싱
+// 소켓에서 바로 파싱하면 reader가 바이트를 기다리며 loopTick을 막으므로 blocking(safePostJson) 경로에서만 사용
+static char s_hubRxBody[limits::kHubDocBytes];
 
- if (useTls && total > 0 && *outStatus > 0) s_httpsFailCount = 0;
+static void httpSinkDone(HttpExchange& x, bool framed) {
+ if (x.cfg->debugHttp) {
+   ORBI_LOGD("[%s] json body=%u err=%s\n", x.logPrefix, (unsigned)x.total, DeserializationError(x.sinkErr).c_str());
+ }
+ httpFinish(x, framed);
+}
 
- c->stop();
- yield();
+// async: 1 = 완료, 0 = budget 소진, -1 = 대기
+static int httpSinkCollect(HttpExchange& x, size_t& used, size_t budget) {
+ HttpBodyReader rd(x, false);
+ while (used < budget) {
+   int ch = rd.read();
+   if (ch == kHttpReadPending) return -1;
+   if (ch < 0) {
+     // const char* 입력 → 문자열은 문서 pool로 복사 (s_hubRxBody는 다음 요청에서 재사용)
+     DeserializationError err = deserializeJson(*x.sink, (const char*)s_hubRxBody, x.sinkLen,
+                                                DeserializationOption::Filter(hubRxFilter()));
+     x.sinkErr = err.code();
+     httpSinkDone(x, rd.framed);
+     return 1;
+   }
+   used++;
+   if (x.sinkLen >= sizeof(s_hubRxBody)) {
+     // 끝까지 읽지 않고 닫음 (재사용 불가). 응답은 파싱 실패로 보임
+     ORBI_LOGW("[%s] body > %u bytes (ORBISYNC_HUB_DOC_BYTES) -> fail\n", x.logPrefix, (unsigned)sizeof(s_hubRxBody));
+     x.sinkErr = DeserializationError::NoMemory;
+     httpFinish(x, false);
+     return 1;
+   }
+   s_hubRxBody[x.sinkLen++] = (char)ch;
+ }
+ return 0;
+}
 
- return (total > 0 && *outStatus > 0);
+// safePostJson: 소켓에서 바로 문서 파싱 (바이트 대기는 블로킹). body 끝까지 읽었으면 완료까지 (true)
+static bool httpSinkParse(HttpExchange& x) {
+ HttpBodyReader rd(x, true);
+ DeserializationError err = deserializeJson(*x.sink, rd, DeserializationOption::Filter(hubRxFilter()));
+ x.sinkErr = err.code();
+ x.sinkParsed = true;
+ if (!rd.end) return false;
+ httpSinkDone(x, rd.framed);
+ return true;
 }
 
-// -----------------------------
-// URL parse helper
-// -----------------------------
-struct ParsedBaseUrl {
- char host[128];
- uint16_t port;
- bool useTls;
- char basePath[128]; // optional
-};
+// 문서 뒤 공백 / 남은 body / chunk trailer 소비 (다음 응답 경계 유지). budget만큼, 바이트가 없으면 다음 pump
+// 1 = 완료, 0 = budget 소진, -1 = 대기
+static int httpSinkDrain(HttpExchange& x, size_t& used, size_t budget) {
+ HttpBodyReader rd(x, false);
+ while (used < budget) {
+   int ch = rd.read();
+   if (ch == kHttpReadPending) return -1;
+   if (ch < 0) {
+     httpSinkDone(x, rd.framed);
+     return 1;
+   }
+   used++;
+ }
+ return 0;
+}
+
+// 최대 budget 바이트만큼 응답 처리. 완료(성공/실패)면 true
+static bool httpPump(HttpExchange& x, size_t budget) {
+ if (x.phase == HttpPhase::IDLE || x.phase == HttpPhase::DONE) return true;
+
+ WiFiClient* c = x.c;
+ size_t used = 0;
+
+ while (used < budget && x.phase != HttpPhase::DONE) {
+   uint32_t now = millis();
+
+   switch (x.phase) {
+     // ---- FIRST BYTE WAIT (중요) ----
+     case HttpPhase::FIRST_BYTE:
+       if (c->available() || (now - x.phaseMs) >= kHttpFirstByteWaitMs) {
+         x.phase = HttpPhase::HEADERS;
+         x.phaseMs = now;
+         break;
+       }
+       if (x.reused && !c->connected()) return httpRetryFresh(x);
+       return false;
+
+     // header read (connected() 조건 제거!)
+     case HttpPhase::HEADERS: {
+       uint32_t headerTimeoutMs = x.headerTimeoutMs ? x.headerTimeoutMs : kHttpHeaderTimeoutMs;
+       if ((now - x.phaseMs) >= headerTimeoutMs || x.headerBytes >= kHttpMaxHeaderBytes) {
+         if (x.cfg->debugHttp) {
+           ORBI_LOGW("[%s] header timeout (read=%u)\n", x.logPrefix, (unsigned)x.headerBytes);
+         }
+         httpFail(x);
+         return true;
+       }
+       if (!c->available()) {
+         // 재사용 연결은 유휴 중 서버가 닫았을 수 있음 → 즉시 재연결
+         if (x.reused && x.headerBytes == 0 && !c->connected()) return httpRetryFresh(x);
+         // 연결은 유지되는데 available이 늦는 경우가 있음
+         return false;
+       }
+       int ch = c->read();
+       if (ch < 0) return false;
+       used++;
+       x.headerBytes++;
+       if (x.headerBytes == 1 && x.m) x.m->ttfbMs.record(now - x.startMs);
+       if (ch == '\r') break;
+       if (ch != '\n') {
+         if (x.lp < sizeof(x.line) - 1) x.line[x.lp++] = (char)ch;
+         break;
+       }
+       x.line[x.lp] = '\0';
+       x.lp = 0;
+       if (x.line[0] != '\0') {
+         httpParseHeaderLine(x);
+         break;
+       }
+       // empty line => end header
+       x.phase = HttpPhase::BODY;
+       x.phaseMs = now;
+       x.bodyMode = x.chunked ? HttpBody::CHUNK_SIZE
+                  : x.hasContentLength ? HttpBody::LENGTH
+                  : HttpBody::UNTIL_CLOSE;  // 길이 정보 없음: 서버가 닫을 때까지 (재사용 불가)
+       x.sinkActive = x.sink && x.status >= 200 && x.status < 300;
+       x.sinkParsed = false;
+       x.sinkLen = 0;
+       break;
+     }
+
+     case HttpPhase::BODY: {
+       if ((now - x.phaseMs) >= kHttpBodyTimeoutMs) {
+         httpFinish(x, false);
+         return true;
+       }
+       if (x.sinkActive) {
+         if (!x.async && !x.sinkParsed) {
+           bool empty = x.bodyMode == HttpBody::LENGTH && x.remain == 0;
+           if (!empty && !c->available() && c->connected()) return false;
+           if (httpSinkParse(x)) return true;
+         }
+         int r = x.async ? httpSinkCollect(x, used, budget) : httpSinkDrain(x, used, budget);
+         if (r > 0) return true;
+         if (r < 0) return false;
+         break;
+       }
+       int r = 0;
+       switch (x.bodyMode) {
+         case HttpBody::LENGTH:
+           r = httpReadBytesStep(x, used, budget);
+           if (r != 0) { httpFinish(x, r > 0); return true; }
+           break;
+
+         case HttpBody::UNTIL_CLOSE: {
+           if (x.total >= x.outBodyMax - 1) { httpFinish(x, false); return true; }
+           int avail = c->available();
+           if (avail <= 0) {
+             // 연결이 끊겼고 더 없으면 종료
+             if (!c->connected()) { httpFinish(x, false); return true; }
+             return false;
+           }
+           size_t toRead = x.outBodyMax - 1 - x.total;
+           if (toRead > (size_t)avail) toRead = (size_t)avail;
+           if (toRead > budget - used) toRead = budget - used;
+           if (toRead > 256) toRead = 256;
+           int n = c->read((uint8_t*)(x.outBody + x.total), toRead);
+           if (n > 0) { x.total += (size_t)n; used += (size_t)n; }
+           break;
+         }
+
+         case HttpBody::CHUNK_SIZE:
+           r = httpReadLineStep(x, used);
+           if (r < 0) { httpFinish(x, false); return true; }
+           if (r > 0) {
+             x.remain = (size_t)strtoul(x.line, nullptr, 16);
+             x.bodyMode = (x.remain == 0) ? HttpBody::TRAILER : HttpBody::CHUNK_DATA;
+           }
+           break;
+
+         case HttpBody::CHUNK_DATA:
+           r = httpReadBytesStep(x, used, budget);
+           if (r < 0) { httpFinish(x, false); return true; }
+           if (r > 0) x.bodyMode = HttpBody::CHUNK_END;
+           break;
+
+         case HttpBody::CHUNK_END:
+           r = httpReadLineStep(x, used);
+           if (r < 0) { httpFinish(x, false); return true; }
+           if (r > 0) x.bodyMode = HttpBody::CHUNK_SIZE;
+           break;
+
+         case HttpBody::TRAILER:
+           // trailer 헤더 소비 (빈 줄까지)
+           r = httpReadLineStep(x, used);
+           if (r < 0) { httpFinish(x, false); return true; }
+           if (r > 0 && x.line[0] == '\0') { httpFinish(x, true); return true; }
+           break;
+       }
+       if (r == 0 && !c->available()) return false;
+       break;
+     }
+
+     default:
+       return true;
+   }
+ }
+ return x.phase == HttpPhase::DONE;
+}
 
+// 블로킹 POST: httpBegin 후 완료까지 pump
+static bool safePostJson(
+ const Config& cfg,
+ const char* host,
+ uint16_t port,
+ bool useTls,
+ const char* path,
+ const char* jsonBody,
+ int* outStatus,
+ char* outBody,
+ size_t outBodyMax,
+ const char* logPrefix
+) {
+ if (!host || !path || !outStatus || !outBody || outBodyMax == 0) return false;
+ outBody[0] = '\0';
+ *outStatus = 0;
+
+ s_http.async = false;
+ if (!httpBegin(s_http, cfg, host, port, useTls, path, jsonBody, outBody, outBodyMax, logPrefix)) {
+   httpMetricsDone(s_http);
+   return false;
+ }
+ while (!httpPump(s_http, 256)) {
+   if (!s_http.c->available()) delay(1);
+   yield();
+ }
+ httpMetricsDone(s_http);
+ *outStatus = s_http.status;
+ s_http.phase = HttpPhase::IDLE;
+ yield();
+
+ return s_http.ok;
+}
+
+// -----------------------------
+// URL parse helper
+// -----------------------------
+// https:// http:// wss:// ws:// (scheme 없으면 https). tunnelConnect도 같은 파서 사용
 static bool parseBaseUrl(const char* base, ParsedBaseUrl& out) {
  if (!base || !base[0]) return false;
 
@@ -485,6 +1381,8 @@ static bool parseBaseUrl(const char* base, ParsedBaseUrl& out) {
 
  if (strncmp(p, "https://", 8) == 0) { p += 8; out.useTls = true; out.port = 443; }
  else if (strncmp(p, "http://", 7) == 0) { p += 7; out.useTls = false; out.port = 80; }
+ else if (strncmp(p, "wss://", 6) == 0) { p += 6; out.useTls = true; out.port = 443; }
+ else if (strncmp(p, "ws://", 5) == 0) { p += 5; out.useTls = false; out.port = 80; }
  else { /* no scheme => https */ out.useTls = true; out.port = 443; }
 
  const char* hostStart = p;
@@ -519,24 +1417,26 @@ static bool parseBaseUrl(const char* base, ParsedBaseUrl& out) {
 }
 
 // 허브 통일 규칙: WS endpoint는 /ws/tunnel 로 고정.
-static bool buildWsTunnelUrl(const char* hubBaseUrl, char* outTunnelUrl, size_t urlSz) {
- if (!hubBaseUrl || !hubBaseUrl[0] || !outTunnelUrl || urlSz < 32) return false;
- ParsedBaseUrl u;
- if (!parseBaseUrl(hubBaseUrl, u)) return false;
- int n = snprintf(outTunnelUrl, urlSz, "wss://%s/ws/tunnel", u.host);
+static bool buildWsTunnelUrl(const ParsedBaseUrl& hub, char* outTunnelUrl, size_t urlSz) {
+ if (!outTunnelUrl || urlSz < 32) return false;
+ int n = snprintf(outTunnelUrl, urlSz, "wss://%s/ws/tunnel", hub.host);
  if (n <= 0 || (size_t)n >= urlSz) return false;
  return true;
 }
 
-// DEBUG ONLY: full token logging (remove in production)
+// DEBUG ONLY: full token logging (ORBISYNC_LOG_VERBOSE에서만 컴파일)
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_VERBOSE
 static void logTokenPrefix(const char* tag, const char* token) {
  if (!token || !token[0]) {
-   Serial.printf("[TUNNEL] %s (empty)\n", tag);
+   ORBI_LOGV("[TUNNEL] %s (empty)\n", tag);
    return;
  }
  size_t len = strlen(token);
- Serial.printf("[TUNNEL] %s bearer_token=%s (len=%u)\n", tag, token, (unsigned)len);
+ ORBI_LOGV("[TUNNEL] %s bearer_token=%s (len=%u)\n", tag, token, (unsigned)len);
 }
+#else
+#define logTokenPrefix(...) do {} while (0)
+#endif
 
 static bool joinPath(const char* basePath, const char* path, char* out, size_t outSz) {
  if (!out || outSz == 0 || !path) return false;
@@ -568,26 +1468,58 @@ OrbiSyncNode::OrbiSyncNode(const Config& config)
    tunnelBackoffIndex_(0),
    lastTunnelPingMs_(0),
    tunnelRegistered_(false),
+   resumeExpiresMs_(0),
+   resumePresented_(false),
+   tunnelFastRetryUsed_(false),
    approveMissingMacFailed_(false),
    lastHeartbeatMs_(0),
    wifiConnecting_(false),
-   httpBusy_(false),
+   lastTunnelStatusLogMs_(0),
+   lastTunnelSkipLogMs_(0),
+   memoryReportStage_(0),
+   httpOp_(HttpOp::NONE),
    stateChangeCb_(nullptr),
    errorCb_(nullptr),
    registeredCb_(nullptr),
    tunnelChangeCb_(nullptr),
    requestHandler_(nullptr),
    tunnelMessageCb_(nullptr),
-   httpRequestCb_(nullptr) {
+   tunnelTapCb_(nullptr),
+   httpRequestCb_(nullptr),
+   routeCount_(0),
+   commands_(),
+   commandCount_(0),
+   cmdAckPending_(),
+   cmdAckPendingCount_(0),
+   cmdAckInFlight_(0),
+   cmdRecent_(),
+   cmdRecentResult_(),
+   cmdRecentPos_(0),
+   metrics_(),
+   pingSentMs_(0),
+   outboxPending_(0)
+#if ORBISYNC_TASK_MODE
+   , netTask_(nullptr),
+   handoffActive_(false)
+#endif
+{
 
  nodeId_[0] = '\0';
  nodeToken_[0] = '\0';
  tunnelUrl_[0] = '\0';
  tunnelId_[0] = '\0';
  sessionToken_[0] = '\0';
+ resumeToken_[0] = '\0';
  pairingCode_[0] = '\0';
  pairingExpiresAt_[0] = '\0';
  pairingCodeValid_ = false;
+ tpl_.helloLen = 0;
+ tpl_.sessionLen = 0;
+ tpl_.heartbeatLen = 0;
+ tpl_.registerLen = 0;
+
+ hubUrlValid_ = parseBaseUrl(cfg_.hubBaseUrl, hubUrl_);
+ if (cfg_.hubBaseUrl && !hubUrlValid_) ORBI_LOGE("[HTTP] invalid hubBaseUrl: %s\n", cfg_.hubBaseUrl);
 }
 
 // -----------------------------
@@ -615,13 +1547,13 @@ void OrbiSyncNode::setState(State s) {
  if (state_ == s) return;
  State old = state_;
  state_ = s;
- Serial.printf("[STATE] %s -> %s\n", stateStr(old), stateStr(s));
+ ORBI_LOGI("[STATE] %s -> %s\n", stateStr(old), stateStr(s));
  if (s == State::ACTIVE && cfg_.enableTunnel) {
-   Serial.printf("[TUNNEL] ACTIVE entered tunnel_url_set=%d (next connect in %ums)\n",
+   ORBI_LOGI("[TUNNEL] ACTIVE entered tunnel_url_set=%d (next connect in %ums)\n",
      tunnelUrl_[0] ? 1 : 0, (unsigned)nextTunnelConnectMs_);
    if (tunnelUrl_[0]) nextTunnelConnectMs_ = 0;
  }
- if (stateChangeCb_) stateChangeCb_(old, s);
+ emitStateChange(old, s);
 }
 
 // -----------------------------
@@ -703,48 +1635,229 @@ bool OrbiSyncNode::isPairingExpired() const {
 // -----------------------------
 // Backoff
 // -----------------------------
-void OrbiSyncNode::advanceNetBackoff() { netBackoffMs_ = (netBackoffMs_ < kBackoffMaxMs / 2) ? (netBackoffMs_ * 2) : kBackoffMaxMs; }
-void OrbiSyncNode::advancePairBackoff() { pairBackoffMs_ = (pairBackoffMs_ < kBackoffMaxMs / 2) ? (pairBackoffMs_ * 2) : kBackoffMaxMs; }
+// -----------------------------
+// Scheduling (jitter)
+// -----------------------------
+// 재시도 backoff: decorrelated jitter  next = min(cap, random(base, prev * 3))
+//   → Hub 재시작 후 노드들이 같은 박자로 재시도하지 않음
+// 고정 주기(retry_after_ms, approveRetryMs 등): ±scheduleJitterPct 로 분산
+static constexpr uint8_t kDefaultJitterPct = 20;
+static constexpr uint32_t kMaxRetryAfterMs = 600000;  // Retry-After 상한 (10분)
+
+static uint32_t decorrelatedJitter(uint32_t prev, uint32_t base, uint32_t cap) {
+ uint32_t hi = (prev > cap / 3) ? cap : prev * 3;
+ if (hi <= base) return base;
+ return base + (uint32_t)random((long)(hi - base + 1));
+}
+
+static uint32_t spreadJitter(uint32_t ms, uint8_t pct) {
+ if (ms == 0 || pct == 0) return ms;
+ if (pct > 100) pct = 100;
+ uint32_t span = (uint32_t)((uint64_t)ms * pct / 100);
+ return ms - span + (uint32_t)random((long)(2 * span + 1));
+}
+
+uint32_t OrbiSyncNode::jitterAt(uint32_t delayMs) const {
+ uint8_t pct = cfg_.scheduleJitterPct ? cfg_.scheduleJitterPct : kDefaultJitterPct;
+ return millis() + spreadJitter(delayMs, pct);
+}
+
+/// 429/503이면 Retry-After(없으면 net backoff)만큼 nextMs를 미루고 true
+bool OrbiSyncNode::hubThrottled(int status, uint32_t& nextMs, const char* tag) {
+ if (status != 429 && status != 503) return false;
+ uint32_t waitMs = s_http.retryAfterMs;
+ if (waitMs > kMaxRetryAfterMs) waitMs = kMaxRetryAfterMs;
+ if (waitMs == 0) {
+   advanceNetBackoff();
+   waitMs = netBackoffMs_;
+ }
+ nextMs = jitterAt(waitMs);
+ ORBI_LOGW("[%s] hub busy status=%d retry_after=%ums\n", tag, status, (unsigned)waitMs);
+ return true;
+}
+
+void OrbiSyncNode::advanceNetBackoff() { netBackoffMs_ = decorrelatedJitter(netBackoffMs_, kBackoffMinMs, kBackoffMaxMs); }
+void OrbiSyncNode::advancePairBackoff() { pairBackoffMs_ = decorrelatedJitter(pairBackoffMs_, kBackoffMinMs, kBackoffMaxMs); }
 void OrbiSyncNode::resetNetBackoff() { netBackoffMs_ = kBackoffMinMs; }
 void OrbiSyncNode::resetPairBackoff() { pairBackoffMs_ = kBackoffMinMs; }
 
 // -----------------------------
 // HTTP unified
 // -----------------------------
+// 캐시된 hub endpoint + path → host/port/tls/fullPath (HTTPS 연속 실패 시 HTTP 강제)
+static bool resolveHubPath(const Config& cfg, const ParsedBaseUrl& hub, const char* path, ParsedBaseUrl& u,
+                           char* fullPath, size_t fullPathSz) {
+ u = hub;
+
+ // full path = basePath + path
+ if (!joinPath(u.basePath, path, fullPath, fullPathSz)) return false;
+
+ if (u.useTls && s_httpConn.httpsFailCount >= MAX_HTTPS_FAIL_COUNT) {
+   u.useTls = false;
+   u.port = 80;
+   if (cfg.debugHttp) ORBI_LOGD("[HTTP] HTTPS failed %u times -> force HTTP\n", s_httpConn.httpsFailCount);
+ }
+ return true;
+}
+
+// Hub 응답 파싱 문서 (stack 대신 static). 2xx body는 httpPump가 여기에 바로 stream 파싱
+// 요청 slot이 하나라 핸들러끼리 겹치지 않음
+static StaticJsonDocument<limits::kHubDocBytes> s_hubRxDoc;
+
+// Hub 요청 공용 outBody: 2xx가 아닌 응답 body만 담김 (오류 코드 확인 / log). httpBusy()로 보호
+static char s_httpResp[limits::kHubErrBodyBytes];
+
+// 2xx 응답은 이미 s_hubRxDoc에 있음. 그 외(오류 응답 body)는 outBody 사본을 같은 filter로 파싱
+static bool hubRxParse(const char* body, size_t len) {
+ if (s_http.sinkActive) return s_http.sinkErr == DeserializationError::Ok;
+ if (!body || len == 0) return false;
+ return !deserializeJson(s_hubRxDoc, body, len, DeserializationOption::Filter(hubRxFilter()));
+}
+
 bool OrbiSyncNode::postJsonUnified(const char* path, const char* body,
-                                  int* outStatus, char* outBody, size_t outBodyMax) {
+                                  int* outStatus, char* outBody, size_t outBodyMax, const char* bearer) {
  if (!cfg_.hubBaseUrl || !path || !outStatus || !outBody || outBodyMax == 0) return false;
 
  ParsedBaseUrl u;
- if (!parseBaseUrl(cfg_.hubBaseUrl, u)) return false;
+ char fullPath[256];
+ if (!hubUrlValid_ || !resolveHubPath(cfg_, hubUrl_, path, u, fullPath, sizeof(fullPath))) return false;
 
- // full path = basePath + path
+ httpMetricsStart(s_http, hubMetrics(httpOp_));
+ s_http.bearer = bearer;
+ s_http.sink = &s_hubRxDoc;
+ s_http.headerTimeoutMs = httpHeaderTimeoutFor(httpOp_);
+ return safePostJson(cfg_, u.host, u.port, u.useTls, fullPath, body, outStatus, outBody, outBodyMax, "HTTP");
+}
+
+bool OrbiSyncNode::startJsonUnified(HttpOp op, const char* path, const char* body,
+                                   char* outBody, size_t outBodyMax, const char* bearer) {
+ if (!cfg_.hubBaseUrl || !path || !outBody || outBodyMax == 0) return false;
+
+ ParsedBaseUrl u;
  char fullPath[256];
- if (!joinPath(u.basePath, path, fullPath, sizeof(fullPath))) return false;
+ if (!hubUrlValid_ || !resolveHubPath(cfg_, hubUrl_, path, u, fullPath, sizeof(fullPath))) return false;
+
+ httpMetricsStart(s_http, hubMetrics(op));
+ s_http.bearer = bearer;
+ s_http.sink = &s_hubRxDoc;
+ s_http.async = true;
+ s_http.headerTimeoutMs = httpHeaderTimeoutFor(op);
+ if (!httpBegin(s_http, cfg_, u.host, u.port, u.useTls, fullPath, body, outBody, outBodyMax, "HTTP")) {
+   httpMetricsDone(s_http);
+   s_http.phase = HttpPhase::IDLE;
+   return false;
+ }
+ httpOp_ = op;
+ s_http.owner = this;
+ return true;
+}
 
- bool useTls = u.useTls;
- uint16_t port = u.port;
+bool OrbiSyncNode::httpBusy() const {
+ return httpOp_ != HttpOp::NONE || (s_http.owner && s_http.owner != this);
+}
 
- if (useTls && s_httpsFailCount >= MAX_HTTPS_FAIL_COUNT) {
-   useTls = false;
-   port = 80;
-   if (cfg_.debugHttp) Serial.printf("[HTTP] HTTPS failed %u times -> force HTTP\n", s_httpsFailCount);
+/// asyncHttp: 진행 중인 요청을 조금씩 처리하고 완료 시 응답 핸들러 호출
+void OrbiSyncNode::pumpHttp() {
+ if (httpOp_ == HttpOp::NONE) return;
+ if (!httpPump(s_http, kHttpPumpBudget)) return;
+
+ HttpOp op = httpOp_;
+ httpOp_ = HttpOp::NONE;
+ s_http.owner = nullptr;
+ httpMetricsDone(s_http);
+ s_http.phase = HttpPhase::IDLE;
+
+ int status = s_http.ok ? s_http.status : -1;
+ char* body = s_http.outBody;
+ size_t len = strlen(body);  // sink로 파싱된 2xx면 0
+
+ switch (op) {
+   case HttpOp::HELLO: handleHelloResponse(status, body, len); break;
+   case HttpOp::PAIR: handlePairResponse(status, body, len); break;
+   case HttpOp::APPROVE: handleApproveResponse(status, body, len); break;
+   case HttpOp::SESSION: handleSessionResponse(status, body, len); break;
+   case HttpOp::REGISTER_BY_SLOT: handleRegisterBySlotResponse(status, body, len); break;
+   case HttpOp::HEARTBEAT: handleHeartbeatResponse(status, body, len); break;
+   default: break;
  }
+}
+
+// session long-poll: Hub가 응답을 최대 sessionLongPollMs 동안 보류 → header 대기를 그만큼 연장
+uint32_t OrbiSyncNode::httpHeaderTimeoutFor(HttpOp op) const {
+ if (op == HttpOp::SESSION && cfg_.sessionLongPollMs) return cfg_.sessionLongPollMs + kHttpHeaderTimeoutMs;
+ return 0;
+}
 
- return safePostJson(cfg_, u.host, port, useTls, fullPath, body, outStatus, outBody, outBodyMax, "HTTP");
+HubEndpointMetrics* OrbiSyncNode::hubMetrics(HttpOp op) {
+ if (op == HttpOp::NONE) return nullptr;
+ uint8_t i = (uint8_t)op - 1;  // HttpOp은 NONE 다음부터 HubEndpoint 순서
+ return i < (uint8_t)HubEndpoint::COUNT ? &metrics_.hub[i] : nullptr;
 }
 
+
 // -----------------------------
-// HELLO
+// Payload templates
 // -----------------------------
-static char s_helloBuf[512];
-static char s_helloResp[1024];
+// hello/session/heartbeat/register body는 Config + MAC에만 의존 → 처음 한 번만 직렬화
+// 재시도 때는 고정 위치 slot(nonce, uptime/heap/rssi)만 덮어씀 (JSON 재생성/snprintf 없음)
+// 숫자 slot은 고정 폭 + 공백 padding (JSON 토큰 사이 공백은 유효)
+// 버퍼는 노드별 (tpl_): 공유 연결의 노드가 번갈아 보내도 각자 한 번만 생성
+static const char kNonceSlot[] = "00000000";
+static const char kU32Slot[] = "0         ";   // uint32 최대 10자리
+static const char kRssiSlot[] = "0   ";         // "-100"까지
+
+static void patchHex8(char* p, uint32_t v) {
+ static const char kHex[] = "0123456789abcdef";
+ for (int8_t i = 7; i >= 0; i--) { p[i] = kHex[v & 0xF]; v >>= 4; }
+}
 
-void OrbiSyncNode::tryHello() {
- if (httpBusy_) return;
- uint32_t now = millis();
- if (now < nextHelloMs_) return;
+static void patchNumSlot(char* p, size_t width, uint32_t u, bool neg = false) {
+ char tmp[12];
+ uint8_t k = 0;
+ do { tmp[k++] = (char)('0' + u % 10); u /= 10; } while (u && k < sizeof(tmp));
+ size_t i = 0;
+ if (neg && i < width) p[i++] = '-';
+ while (k && i < width) p[i++] = tmp[--k];
+ while (i < width) p[i++] = ' ';
+}
+
+/// "key": 다음 값 위치 (문자열이면 여는 따옴표 다음). 없으면 0
+static uint16_t payloadSlotOffset(const char* buf, const char* key) {
+ char pat[24];
+ int pl = snprintf(pat, sizeof(pat), "\"%s\":", key);
+ if (pl <= 0 || (size_t)pl >= sizeof(pat)) return 0;
+ const char* p = strstr(buf, pat);
+ if (!p) return 0;
+ p += pl;
+ if (*p == '"') p++;
+ return (uint16_t)(p - buf);
+}
 
+static uint32_t payloadNonce() { return (uint32_t)random(0x7FFFFFFF); }
+
+/// JSON 문자열 필드 추가 (",\"key\":\"val\""). Hub 토큰/ID용 최소 escape. 넘치면 false
+static bool payloadAppendStr(char* out, size_t cap, size_t& n, const char* key, const char* val) {
+ int w = snprintf(out + n, (n < cap) ? cap - n : 0, ",\"%s\":\"", key);
+ if (w <= 0 || n + (size_t)w >= cap) return false;
+ n += (size_t)w;
+ for (const char* s = val; *s; s++) {
+   char c = *s;
+   if ((uint8_t)c < 0x20) continue;
+   if (c == '"' || c == '\\') { if (n + 1 >= cap) return false; out[n++] = '\\'; }
+   if (n + 1 >= cap) return false;
+   out[n++] = c;
+ }
+ if (n + 1 >= cap) return false;
+ out[n++] = '"';
+ out[n] = '\0';
+ return true;
+}
+
+// -----------------------------
+// HELLO
+// -----------------------------
+/// hello body 템플릿 생성 (tpl_.hello 자체가 요청 body, 이후 nonce만 갱신)
+bool OrbiSyncNode::buildHelloTemplate() {
  StaticJsonDocument<384> doc;
  doc["slot_id"] = cfg_.slotId ? cfg_.slotId : "";
  doc["firmware"] = (cfg_.firmwareVersion && cfg_.firmwareVersion[0]) ? cfg_.firmwareVersion : "1.0.0";
@@ -752,27 +1865,44 @@ void OrbiSyncNode::tryHello() {
  char capHashStr[9];
  snprintf(capHashStr, sizeof(capHashStr), "%08x", (unsigned)computeCapabilitiesHash());
  doc["capabilities_hash"] = capHashStr;
-
- char nonceStr[9];
- snprintf(nonceStr, sizeof(nonceStr), "%08x", (unsigned)random(0x7FFFFFFF));
- doc["nonce"] = nonceStr;
+ doc["nonce"] = kNonceSlot;
 
  JsonObject di = doc.createNestedObject("device_info");
  di["mac"] = getMacCStr();
  di["platform"] = "esp";
 
- size_t n = serializeJson(doc, s_helloBuf, sizeof(s_helloBuf));
- if (n == 0 || n >= sizeof(s_helloBuf)) return;
- s_helloBuf[n] = '\0';
+ size_t n = serializeJson(doc, tpl_.hello, sizeof(tpl_.hello));
+ if (n == 0 || n >= sizeof(tpl_.hello)) return false;
+ tpl_.hello[n] = '\0';
+ tpl_.helloNonceOff = payloadSlotOffset(tpl_.hello, "nonce");
+ if (!tpl_.helloNonceOff) return false;
+ tpl_.helloLen = (uint16_t)n;
+ return true;
+}
+
+void OrbiSyncNode::tryHello() {
+ if (httpBusy()) return;
+ uint32_t now = millis();
+ if (now < nextHelloMs_) return;
+
+ if (!tpl_.helloLen && !buildHelloTemplate()) return;
+ patchHex8(tpl_.hello + tpl_.helloNonceOff, payloadNonce());
+
+ s_httpResp[0] = '\0';
+ if (cfg_.asyncHttp) {
+   if (!startJsonUnified(HttpOp::HELLO, "/api/device/hello", tpl_.hello, s_httpResp, sizeof(s_httpResp))) {
+     handleHelloResponse(-1, s_httpResp, 0);
+   }
+   return;
+ }
 
- httpBusy_ = true;
+ httpOp_ = HttpOp::HELLO;
  int status = 0;
- s_helloResp[0] = '\0';
- bool ok = postJsonUnified("/api/device/hello", s_helloBuf, &status, s_helloResp, sizeof(s_helloResp));
- httpBusy_ = false;
+ bool ok = postJsonUnified("/api/device/hello", tpl_.hello, &status, s_httpResp, sizeof(s_httpResp));
+ httpOp_ = HttpOp::NONE;
 
  yield();
- handleHelloResponse(ok ? status : -1, s_helloResp, strlen(s_helloResp));
+ handleHelloResponse(ok ? status : -1, s_httpResp, strlen(s_httpResp));
 }
 
 static void maskPairingForLog(const char* s, char* buf, size_t bufLen) {
@@ -787,18 +1917,17 @@ static void maskPairingForLog(const char* s, char* buf, size_t bufLen) {
 }
 
 void OrbiSyncNode::handleHelloResponse(int status, const char* body, size_t len) {
- if (status < 200 || status >= 300 || !body || len == 0) {
-   Serial.printf("[HELLO] fail status=%d\n", status);
+ if (hubThrottled(status, nextHelloMs_, "HELLO")) return;
+ if (status < 200 || status >= 300) {
+   ORBI_LOGW("[HELLO] fail status=%d\n", status);
    advanceNetBackoff();
    nextHelloMs_ = millis() + netBackoffMs_;
    return;
  }
 
- StaticJsonDocument<512> doc;
- size_t parseLen = (len > 768) ? 768 : len; // 너무 길면 일부만 파싱
- DeserializationError err = deserializeJson(doc, body, parseLen);
- if (err) {
-   Serial.printf("[HELLO] parse err (len=%u)\n", (unsigned)len);
+ JsonDocument& doc = s_hubRxDoc;
+ if (!hubRxParse(body, len)) {
+   ORBI_LOGW("[HELLO] parse err (len=%u)\n", (unsigned)s_http.total);
    advanceNetBackoff();
    nextHelloMs_ = millis() + netBackoffMs_;
    return;
@@ -808,10 +1937,10 @@ void OrbiSyncNode::handleHelloResponse(int status, const char* body, size_t len)
  int retryMs = doc["retry_after_ms"] | 3000;
 
  if (strcmp(st, "DENIED") == 0) {
-   Serial.println("[HELLO] DENIED");
+   ORBI_LOGW("[HELLO] DENIED\n");
    setState(State::ERROR);
-   if (errorCb_) errorCb_("HELLO denied");
-   nextHelloMs_ = millis() + (uint32_t)retryMs;
+   emitError("HELLO denied");
+   nextHelloMs_ = jitterAt((uint32_t)retryMs);
    return;
  }
 
@@ -828,17 +1957,17 @@ void OrbiSyncNode::handleHelloResponse(int status, const char* body, size_t len)
  if (pc[0]) {
    storePairingFromHello(pc, exp);
    char masked[16]; maskPairingForLog(pc, masked, sizeof(masked));
-   Serial.printf("[HELLO] pairing key=%s value=%s expires=%s\n", usedKey, masked, (exp && exp[0]) ? exp : "(none)");
+   ORBI_LOGI("[HELLO] pairing key=%s value=%s expires=%s\n", usedKey, masked, (exp && exp[0]) ? exp : "(none)");
  } else {
    clearPairingCode();
-   Serial.println("[HELLO] no pairing_code (pending)");
+   ORBI_LOGI("[HELLO] no pairing_code (pending)\n");
  }
 
  resetNetBackoff();
- nextHelloMs_ = millis() + (uint32_t)retryMs;
- nextSessionPollMs_ = millis() + (uint32_t)retryMs;
- nextApproveMs_ = millis() + 500;
- nextPairMs_ = millis() + 500;
+ nextHelloMs_ = jitterAt((uint32_t)retryMs);
+ nextSessionPollMs_ = jitterAt((uint32_t)retryMs);
+ nextApproveMs_ = jitterAt(500);
+ nextPairMs_ = jitterAt(500);
 
  if (pairingCodeValid_) {
    if (cfg_.enableSelfApprove && cfg_.approveEndpointPath && cfg_.approveEndpointPath[0]) {
@@ -854,6 +1983,8 @@ void OrbiSyncNode::handleHelloResponse(int status, const char* body, size_t len)
 // -----------------------------
 // PAIR
 // -----------------------------
+static char s_pairBuf[512];
+
 bool OrbiSyncNode::postDevicePair(const char* code, int* outStatus,
                                  char* outBody, size_t outBodyMax) {
  StaticJsonDocument<512> doc;
@@ -864,38 +1995,50 @@ bool OrbiSyncNode::postDevicePair(const char* code, int* outStatus,
  di["mac"] = getMacCStr();
  di["platform"] = "esp";
 
- char buf[512];
- size_t n = serializeJson(doc, buf, sizeof(buf));
- if (n == 0 || n >= sizeof(buf)) return false;
- buf[n] = '\0';
+ size_t n = serializeJson(doc, s_pairBuf, sizeof(s_pairBuf));
+ if (n == 0 || n >= sizeof(s_pairBuf)) return false;
+ s_pairBuf[n] = '\0';
 
- return postJsonUnified("/api/device/pair", buf, outStatus, outBody, outBodyMax);
+ // asyncHttp: 요청만 시작 (결과는 handlePairResponse)
+ if (cfg_.asyncHttp) return startJsonUnified(HttpOp::PAIR, "/api/device/pair", s_pairBuf, outBody, outBodyMax);
+ return postJsonUnified("/api/device/pair", s_pairBuf, outStatus, outBody, outBodyMax);
 }
 
 void OrbiSyncNode::tryPairIfNeeded() {
  if (!pairingCodeValid_ || !pairingCode_[0]) return;
- if (httpBusy_) return;
+ if (httpBusy()) return;
  uint32_t now = millis();
  if (now < nextPairMs_) return;
 
  if (isPairingExpired()) {
    clearPairingCode();
    setState(State::HELLO);
-   nextHelloMs_ = millis() + 1000;
+   nextHelloMs_ = jitterAt(1000);
    return;
  }
 
- httpBusy_ = true;
+ s_httpResp[0] = '\0';
+ if (cfg_.asyncHttp) {
+   if (!postDevicePair(pairingCode_, nullptr, s_httpResp, sizeof(s_httpResp))) {
+     handlePairResponse(-1, s_httpResp, 0);
+   }
+   return;
+ }
+
+ httpOp_ = HttpOp::PAIR;
  int status = 0;
- char resp[1024];
- resp[0] = '\0';
- bool ok = postDevicePair(pairingCode_, &status, resp, sizeof(resp));
- httpBusy_ = false;
+ bool ok = postDevicePair(pairingCode_, &status, s_httpResp, sizeof(s_httpResp));
+ httpOp_ = HttpOp::NONE;
 
  yield();
+ handlePairResponse(ok ? status : -1, s_httpResp, strlen(s_httpResp));
+}
 
- if (!ok || status < 200 || status >= 300) {
-   Serial.printf("[PAIR] fail status=%d\n", status);
+void OrbiSyncNode::handlePairResponse(int status, char* body, size_t len) {
+ // 일시적 과부하: pairing code는 유지하고 같은 요청을 나중에 재시도
+ if (hubThrottled(status, nextPairMs_, "PAIR")) return;
+ if (status < 200 || status >= 300) {
+   ORBI_LOGW("[PAIR] fail status=%d\n", status);
    clearPairingCode();
    advancePairBackoff();
    setState(State::HELLO);
@@ -903,18 +2046,18 @@ void OrbiSyncNode::tryPairIfNeeded() {
    return;
  }
 
- StaticJsonDocument<1024> doc;
- if (deserializeJson(doc, resp)) {
-   Serial.println("[PAIR] parse err");
+ JsonDocument& doc = s_hubRxDoc;
+ if (!hubRxParse(body, len)) {
+   ORBI_LOGW("[PAIR] parse err\n");
    clearPairingCode();
    setState(State::HELLO);
-   nextHelloMs_ = millis() + 3000;
+   nextHelloMs_ = jitterAt(3000);
    return;
  }
 
  bool success = doc["ok"] | false;
  if (!success) {
-   Serial.println("[PAIR] ok=false");
+   ORBI_LOGW("[PAIR] ok=false\n");
    clearPairingCode();
    advancePairBackoff();
    setState(State::HELLO);
@@ -930,53 +2073,52 @@ void OrbiSyncNode::tryPairIfNeeded() {
  if (nid[0]) {
    strncpy(nodeId_, nid, sizeof(nodeId_) - 1);
    nodeId_[sizeof(nodeId_) - 1] = '\0';
-   Serial.printf("[PAIR] canonical node_id=%s (from hub)\n", nodeId_);
+   ORBI_LOGI("[PAIR] canonical node_id=%s (from hub)\n", nodeId_);
  }
  if (stok[0]) { strncpy(sessionToken_, stok, sizeof(sessionToken_) - 1); sessionToken_[sizeof(sessionToken_) - 1] = '\0'; }
  if (ntok[0]) { strncpy(nodeToken_, ntok, sizeof(nodeToken_) - 1); nodeToken_[sizeof(nodeToken_) - 1] = '\0'; }
- if (cfg_.hubBaseUrl && buildWsTunnelUrl(cfg_.hubBaseUrl, tunnelUrl_, sizeof(tunnelUrl_))) {
+ if (hubUrlValid_ && buildWsTunnelUrl(hubUrl_, tunnelUrl_, sizeof(tunnelUrl_))) {
    nextTunnelConnectMs_ = 0;
-   Serial.printf("[TUNNEL] from pair ws_url=%s\n", tunnelUrl_);
+   ORBI_LOGI("[TUNNEL] from pair ws_url=%s\n", tunnelUrl_);
  } else if (tun[0]) {
    // (레거시) 서버가 tunnel_url을 내려주는 경우
    strncpy(tunnelUrl_, tun, sizeof(tunnelUrl_) - 1);
    tunnelUrl_[sizeof(tunnelUrl_) - 1] = '\0';
    nextTunnelConnectMs_ = 0;
-   Serial.printf("[TUNNEL] from pair legacy tunnel_url=%s\n", tunnelUrl_);
+   ORBI_LOGI("[TUNNEL] from pair legacy tunnel_url=%s\n", tunnelUrl_);
  }
 
  resetPairBackoff();
  clearPairingCode();
 
- Serial.println("[PAIR] ok -> ACTIVE");
- if (registeredCb_) registeredCb_(nodeId_[0] ? nodeId_ : "");
+ ORBI_LOGI("[PAIR] ok -> ACTIVE\n");
+ emitRegistered();
  setState(State::ACTIVE);
  lastHeartbeatMs_ = millis();
- nextSessionPollMs_ = millis() + 60000;
+ nextSessionPollMs_ = jitterAt(60000);
 }
 
 // -----------------------------
 // APPROVE (self-approve)
 // ---- Hub 승인 API 호출 ----
 static char s_approveBuf[512];
-static char s_approveResp[2048];
 
 /// Hub에 approve 요청 전송 (세션 토큰 획득)
 void OrbiSyncNode::tryApprove() {
- if (httpBusy_ || approveMissingMacFailed_) return;
+ if (httpBusy() || approveMissingMacFailed_) return;
  if (!cfg_.approveEndpointPath || !cfg_.approveEndpointPath[0]) return;
 
  uint32_t now = millis();
  if (now < nextApproveMs_) return;
 
  if (!pairingCodeValid_ || !pairingCode_[0]) {
-   nextApproveMs_ = millis() + cfgOrDefaultU32(cfg_.approveRetryMs, 3000);
+   nextApproveMs_ = jitterAt(cfgOrDefaultU32(cfg_.approveRetryMs, 3000));
    return;
  }
 
  const char* mac = getMacCStr();
  if (!mac || !mac[0]) {
-   if (errorCb_) errorCb_("approve: MAC unavailable");
+   emitError("approve: MAC unavailable");
    approveMissingMacFailed_ = true;
    return;
  }
@@ -995,50 +2137,60 @@ void OrbiSyncNode::tryApprove() {
    fw
  );
  if (n <= 0 || (size_t)n >= sizeof(s_approveBuf)) {
-   nextApproveMs_ = millis() + 3000;
+   nextApproveMs_ = jitterAt(3000);
    return;
  }
 
- Serial.printf("[TUNNEL] request: method=POST path=%s body_len=%u\n", cfg_.approveEndpointPath ? cfg_.approveEndpointPath : "", (unsigned)n);
+ ORBI_LOGD("[TUNNEL] request: method=POST path=%s body_len=%u\n", cfg_.approveEndpointPath ? cfg_.approveEndpointPath : "", (unsigned)n);
 
  // approve는 postJsonUnified를 쓰되 path만 approveEndpointPath로
- httpBusy_ = true;
- int status = 0;
- s_approveResp[0] = '\0';
+ s_httpResp[0] = '\0';
+ if (cfg_.asyncHttp) {
+   if (!startJsonUnified(HttpOp::APPROVE, cfg_.approveEndpointPath, s_approveBuf, s_httpResp, sizeof(s_httpResp))) {
+     handleApproveResponse(-1, s_httpResp, 0);
+   }
+   return;
+ }
 
- bool ok = postJsonUnified(cfg_.approveEndpointPath, s_approveBuf, &status, s_approveResp, sizeof(s_approveResp));
- httpBusy_ = false;
+ httpOp_ = HttpOp::APPROVE;
+ int status = 0;
+ bool ok = postJsonUnified(cfg_.approveEndpointPath, s_approveBuf, &status, s_httpResp, sizeof(s_httpResp));
+ httpOp_ = HttpOp::NONE;
 
  yield();
+ handleApproveResponse(ok ? status : -1, s_httpResp, strlen(s_httpResp));
+}
 
- size_t respLen = strlen(s_approveResp);
- Serial.printf("[TUNNEL] response: status=%d body_len=%u\n", status, (unsigned)respLen);
- if (respLen > 0) logBodyPreview("APPROVE", s_approveResp, respLen);
+void OrbiSyncNode::handleApproveResponse(int status, char* body, size_t len) {
+ ORBI_LOGD("[TUNNEL] response: status=%d body_len=%u\n", status, (unsigned)len);
+ if (len > 0) logBodyPreview("APPROVE", body, len);
 
- if (!ok) {
-   Serial.println("[APPROVE] fail (timeout or connect)");
+ if (status < 0) {
+   ORBI_LOGW("[APPROVE] fail (timeout or connect)\n");
    advanceNetBackoff();
-   nextApproveMs_ = millis() + cfgOrDefaultU32(cfg_.approveRetryMs, 3000);
+   nextApproveMs_ = jitterAt(cfgOrDefaultU32(cfg_.approveRetryMs, 3000));
    return;
  }
 
- if (status == 400 && strstr(s_approveResp, "missing_mac")) {
-   Serial.println("[APPROVE] 400 missing_mac -> stop retry");
-   if (errorCb_) errorCb_("approve: missing_mac");
+ if (hubThrottled(status, nextApproveMs_, "APPROVE")) return;
+
+ if (status == 400 && strstr(body, "missing_mac")) {
+   ORBI_LOGW("[APPROVE] 400 missing_mac -> stop retry\n");
+   emitError("approve: missing_mac");
    approveMissingMacFailed_ = true;
    return;
  }
 
  if (status < 200 || status >= 300) {
-   Serial.printf("[APPROVE] fail http status=%d\n", status);
-   nextApproveMs_ = millis() + cfgOrDefaultU32(cfg_.approveRetryMs, 3000);
+   ORBI_LOGW("[APPROVE] fail http status=%d\n", status);
+   nextApproveMs_ = jitterAt(cfgOrDefaultU32(cfg_.approveRetryMs, 3000));
    return;
  }
 
- StaticJsonDocument<1536> doc;
- if (deserializeJson(doc, s_approveResp)) {
-   Serial.println("[APPROVE] parse err");
-   nextApproveMs_ = millis() + 3000;
+ JsonDocument& doc = s_hubRxDoc;
+ if (!hubRxParse(body, len)) {
+   ORBI_LOGW("[APPROVE] parse err\n");
+   nextApproveMs_ = jitterAt(3000);
    return;
  }
 
@@ -1059,11 +2211,11 @@ void OrbiSyncNode::tryApprove() {
  if (nid && nid[0]) {
    strncpy(nodeId_, nid, sizeof(nodeId_) - 1);
    nodeId_[sizeof(nodeId_) - 1] = '\0';
-   Serial.printf("[APPROVE] canonical node_id=%s (from hub)\n", nodeId_);
+   ORBI_LOGI("[APPROVE] canonical node_id=%s (from hub)\n", nodeId_);
  }
- if (tok && tok[0] && cfg_.hubBaseUrl && buildWsTunnelUrl(cfg_.hubBaseUrl, tunnelUrl_, sizeof(tunnelUrl_))) {
+ if (tok && tok[0] && hubUrlValid_ && buildWsTunnelUrl(hubUrl_, tunnelUrl_, sizeof(tunnelUrl_))) {
    nextTunnelConnectMs_ = 0;
-   Serial.printf("[TUNNEL] from approve ws_url=%s\n", tunnelUrl_);
+   ORBI_LOGI("[TUNNEL] from approve ws_url=%s\n", tunnelUrl_);
  } else if (tun && tun[0]) {
    // (레거시) 서버가 tunnel_url을 내려주는 경우
    strncpy(tunnelUrl_, tun, sizeof(tunnelUrl_) - 1);
@@ -1074,77 +2226,100 @@ void OrbiSyncNode::tryApprove() {
  resetNetBackoff();
  approveMissingMacFailed_ = false;
 
- if (registeredCb_) registeredCb_(nodeId_[0] ? nodeId_ : "");
+ emitRegistered();
  setState(State::ACTIVE);
  lastHeartbeatMs_ = millis();
- nextSessionPollMs_ = millis() + 60000;
+ nextSessionPollMs_ = jitterAt(60000);
 }
 
 // ---- 세션 폴링 ----
+bool OrbiSyncNode::buildSessionTemplate() {
+ StaticJsonDocument<256> doc;
+ doc["slot_id"] = cfg_.slotId ? cfg_.slotId : "";
+ doc["nonce"] = kNonceSlot;
+ // long-poll: Hub가 GRANTED/DENIED 또는 wait_ms 경과까지 응답을 보류
+ if (cfg_.sessionLongPollMs) doc["wait_ms"] = cfg_.sessionLongPollMs;
+
+ size_t n = serializeJson(doc, tpl_.session, sizeof(tpl_.session));
+ if (n == 0 || n >= sizeof(tpl_.session)) return false;
+ tpl_.session[n] = '\0';
+ tpl_.sessionNonceOff = payloadSlotOffset(tpl_.session, "nonce");
+ if (!tpl_.sessionNonceOff) return false;
+ tpl_.sessionLen = (uint16_t)n;
+ return true;
+}
+
 /// Hub에 session 폴링 요청 (PENDING → GRANTED 대기)
 void OrbiSyncNode::trySessionPoll() {
- if (httpBusy_) return;
+ if (httpBusy()) return;
  uint32_t now = millis();
  if (now < nextSessionPollMs_) return;
 
  const char* path = (cfg_.sessionEndpointPath && cfg_.sessionEndpointPath[0]) ? cfg_.sessionEndpointPath : "/api/device/session";
 
- StaticJsonDocument<256> doc;
- doc["slot_id"] = cfg_.slotId ? cfg_.slotId : "";
- char nonceStr[9];
- snprintf(nonceStr, sizeof(nonceStr), "%08x", (unsigned)random(0x7FFFFFFF));
- doc["nonce"] = nonceStr;
+ if (!tpl_.sessionLen && !buildSessionTemplate()) return;
+ patchHex8(tpl_.session + tpl_.sessionNonceOff, payloadNonce());
+ size_t n = tpl_.sessionLen;
 
- char buf[256];
- size_t n = serializeJson(doc, buf, sizeof(buf));
- if (n == 0 || n >= sizeof(buf)) return;
- buf[n] = '\0';
+ ORBI_LOGD("[TUNNEL] request: method=POST path=%s body_len=%u\n", path, (unsigned)n);
+ s_httpResp[0] = '\0';
+ if (cfg_.asyncHttp) {
+   if (!startJsonUnified(HttpOp::SESSION, path, tpl_.session, s_httpResp, sizeof(s_httpResp))) {
+     handleSessionResponse(-1, s_httpResp, 0);
+   }
+   return;
+ }
 
- Serial.printf("[TUNNEL] request: method=POST path=%s body_len=%u\n", path, (unsigned)n);
- httpBusy_ = true;
+ httpOp_ = HttpOp::SESSION;
  int status = 0;
- char resp[1024];
- resp[0] = '\0';
- bool ok = postJsonUnified(path, buf, &status, resp, sizeof(resp));
- httpBusy_ = false;
+ bool ok = postJsonUnified(path, tpl_.session, &status, s_httpResp, sizeof(s_httpResp));
+ httpOp_ = HttpOp::NONE;
 
  yield();
+ handleSessionResponse(ok ? status : -1, s_httpResp, strlen(s_httpResp));
+}
 
- size_t rl = strlen(resp);
- Serial.printf("[TUNNEL] response: status=%d body_len=%u\n", status, (unsigned)rl);
- if (rl > 0) logBodyPreview("SESSION", resp, rl);
+void OrbiSyncNode::handleSessionResponse(int status, char* body, size_t rl) {
+ const char* path = (cfg_.sessionEndpointPath && cfg_.sessionEndpointPath[0]) ? cfg_.sessionEndpointPath : "/api/device/session";
 
- if (!ok) {
-   Serial.println("[SESSION] fail (timeout or connect)");
+ ORBI_LOGD("[TUNNEL] response: status=%d body_len=%u\n", status, (unsigned)rl);
+ if (rl > 0) logBodyPreview("SESSION", body, rl);
+
+ if (status < 0) {
+   ORBI_LOGW("[SESSION] fail (timeout or connect)\n");
    advanceNetBackoff();
    nextSessionPollMs_ = millis() + netBackoffMs_;
    return;
  }
 
+ if (hubThrottled(status, nextSessionPollMs_, "SESSION")) return;
+
  if (status == 404) {
-   Serial.printf("[SESSION] fail http 404 path=%s\n", path);
-   nextSessionPollMs_ = millis() + 5000;
+   ORBI_LOGW("[SESSION] fail http 404 path=%s\n", path);
+   nextSessionPollMs_ = jitterAt(5000);
    return;
  }
 
- StaticJsonDocument<512> r;
- size_t pl = (rl > 512) ? 512 : rl;
- if (deserializeJson(r, resp, pl)) {
-   Serial.println("[SESSION] fail json parse");
-   nextSessionPollMs_ = millis() + 3000;
+ JsonDocument& r = s_hubRxDoc;
+ if (!hubRxParse(body, rl)) {
+   ORBI_LOGW("[SESSION] fail json parse\n");
+   nextSessionPollMs_ = jitterAt(3000);
    return;
  }
 
+ if (commandCount_) commandIngest(false);
+
  const char* st = r["status"] | "";
- int retryMs = r["retry_after_ms"] | 3000;
+ // long-poll이면 PENDING 응답 직후 바로 다시 대기 (Hub가 retry_after_ms로 조절 가능)
+ int retryMs = r["retry_after_ms"] | (cfg_.sessionLongPollMs ? 0 : 3000);
 
  if (strcmp(st, "GRANTED") == 0) {
    const char* tok = r["session_token"] | "";
    const char* tun = r["tunnel_url"] | "";
    if (tok[0]) { strncpy(sessionToken_, tok, sizeof(sessionToken_) - 1); sessionToken_[sizeof(sessionToken_) - 1] = '\0'; }
-   if (tok[0] && cfg_.hubBaseUrl && buildWsTunnelUrl(cfg_.hubBaseUrl, tunnelUrl_, sizeof(tunnelUrl_))) {
+   if (tok[0] && hubUrlValid_ && buildWsTunnelUrl(hubUrl_, tunnelUrl_, sizeof(tunnelUrl_))) {
      nextTunnelConnectMs_ = 0;
-     Serial.printf("[TUNNEL] from session ws_url=%s\n", tunnelUrl_);
+     ORBI_LOGI("[TUNNEL] from session ws_url=%s\n", tunnelUrl_);
    } else if (tun[0]) {
      // (레거시)
      strncpy(tunnelUrl_, tun, sizeof(tunnelUrl_) - 1);
@@ -1156,18 +2331,20 @@ void OrbiSyncNode::trySessionPoll() {
    lastHeartbeatMs_ = millis();
  } else if (strcmp(st, "DENIED") == 0) {
    setState(State::ERROR);
-   if (errorCb_) errorCb_("Session denied");
+   emitError("Session denied");
  }
 
- nextSessionPollMs_ = millis() + (uint32_t)retryMs;
+ nextSessionPollMs_ = jitterAt((uint32_t)retryMs);
 }
 
 // -----------------------------
 // register_by_slot
 // -----------------------------
+static char s_regSlotBuf[384];
+
 void OrbiSyncNode::tryRegisterBySlot() {
  if (!cfg_.preferRegisterBySlot || !cfg_.loginToken || !cfg_.loginToken[0]) return;
- if (httpBusy_) return;
+ if (httpBusy()) return;
 
  uint32_t now = millis();
  if (now < nextRegisterBySlotMs_) return;
@@ -1182,39 +2359,47 @@ void OrbiSyncNode::tryRegisterBySlot() {
  doc["platform"] = "esp";
  if (cfg_.firmwareVersion && cfg_.firmwareVersion[0]) doc["agent_version"] = cfg_.firmwareVersion;
 
- char buf[384];
- size_t n = serializeJson(doc, buf, sizeof(buf));
- if (n == 0 || n >= sizeof(buf)) return;
- buf[n] = '\0';
+ size_t n = serializeJson(doc, s_regSlotBuf, sizeof(s_regSlotBuf));
+ if (n == 0 || n >= sizeof(s_regSlotBuf)) return;
+ s_regSlotBuf[n] = '\0';
+
+ nextRegisterBySlotMs_ = jitterAt(cfgOrDefaultU32(cfg_.registerRetryMs, 4000));
+
+ ORBI_LOGD("[TUNNEL] request: method=POST path=/api/nodes/register_by_slot body_len=%u\n", (unsigned)n);
+ s_httpResp[0] = '\0';
+ if (cfg_.asyncHttp) {
+   if (!startJsonUnified(HttpOp::REGISTER_BY_SLOT, "/api/nodes/register_by_slot", s_regSlotBuf, s_httpResp, sizeof(s_httpResp))) {
+     handleRegisterBySlotResponse(-1, s_httpResp, 0);
+   }
+   return;
+ }
 
- Serial.printf("[TUNNEL] request: method=POST path=/api/nodes/register_by_slot body_len=%u\n", (unsigned)n);
- httpBusy_ = true;
+ httpOp_ = HttpOp::REGISTER_BY_SLOT;
  int status = 0;
- char resp[1024];
- resp[0] = '\0';
- bool ok = postJsonUnified("/api/nodes/register_by_slot", buf, &status, resp, sizeof(resp));
- httpBusy_ = false;
+ bool ok = postJsonUnified("/api/nodes/register_by_slot", s_regSlotBuf, &status, s_httpResp, sizeof(s_httpResp));
+ httpOp_ = HttpOp::NONE;
 
  yield();
+ handleRegisterBySlotResponse(ok ? status : -1, s_httpResp, strlen(s_httpResp));
+}
 
- nextRegisterBySlotMs_ = now + cfgOrDefaultU32(cfg_.registerRetryMs, 4000);
-
- size_t rl = strlen(resp);
- Serial.printf("[TUNNEL] response: status=%d body_len=%u\n", status, (unsigned)rl);
- if (rl > 0) logBodyPreview("REG_SLOT", resp, rl);
+void OrbiSyncNode::handleRegisterBySlotResponse(int status, char* body, size_t rl) {
+ ORBI_LOGD("[TUNNEL] response: status=%d body_len=%u\n", status, (unsigned)rl);
+ if (rl > 0) logBodyPreview("REG_SLOT", body, rl);
 
- if (!ok) {
-   Serial.println("[REG_SLOT] fail (timeout or connect)");
+ if (status < 0) {
+   ORBI_LOGW("[REG_SLOT] fail (timeout or connect)\n");
    return;
  }
+ if (hubThrottled(status, nextRegisterBySlotMs_, "REG_SLOT")) return;
  if (status < 200 || status >= 300) {
-   Serial.printf("[REG_SLOT] fail http status=%d\n", status);
+   ORBI_LOGW("[REG_SLOT] fail http status=%d\n", status);
    return;
  }
 
- StaticJsonDocument<512> r;
- if (deserializeJson(r, resp)) {
-   Serial.println("[REG_SLOT] fail json parse");
+ JsonDocument& r = s_hubRxDoc;
+ if (!hubRxParse(body, rl)) {
+   ORBI_LOGW("[REG_SLOT] fail json parse\n");
    return;
  }
 
@@ -1222,7 +2407,7 @@ void OrbiSyncNode::tryRegisterBySlot() {
  const char* authTok = r["node_auth_token"] | "";
  const char* tun = r["tunnel_url"] | "";
  if (!nid[0] || !authTok[0] || !tun[0]) {
-   Serial.println("[REG_SLOT] fail missing fields");
+   ORBI_LOGW("[REG_SLOT] fail missing fields\n");
    return;
  }
 
@@ -1235,51 +2420,225 @@ void OrbiSyncNode::tryRegisterBySlot() {
 
  char tid[64], thost[64];
  parseTunnelUrlParts(tunnelUrl_, tid, sizeof(tid), thost, sizeof(thost));
- Serial.printf("[TUNNEL] from register_by_slot tunnel_url=%s tunnel_id=%s tunnel_host=%s node=%s\n", tunnelUrl_, tid, thost, nodeId_);
+ ORBI_LOGI("[TUNNEL] from register_by_slot tunnel_url=%s tunnel_id=%s tunnel_host=%s node=%s\n", tunnelUrl_, tid, thost, nodeId_);
  nextTunnelConnectMs_ = 0;
  tunnelBackoffIndex_ = 0;
  tunnelBackoffMs_ = kTunnelBackoffMs[0];
 
- if (registeredCb_) registeredCb_(nodeId_);
+ emitRegistered();
  setState(State::ACTIVE);
  lastHeartbeatMs_ = millis();
 }
 
 // -----------------------------
-// Heartbeat (단편화 방지: String 금지)
+// Metrics
 // -----------------------------
-void OrbiSyncNode::tryHeartbeat() {
- if (!sessionToken_[0]) return;
- if (httpBusy_) return;
+static const char* const kMetricsPath = "/__orbisync/metrics";
+static const char* const kHubEndpointNames[] = {"hello", "pair", "approve", "session", "register_by_slot", "heartbeat"};
+
+// snprintf 누적. 버퍼를 넘으면 n = cap (overflow 표시) 이후 append 무시
+static void jsonAppend(char* out, size_t cap, size_t& n, const char* fmt, ...) {
+ if (n >= cap) return;
+ va_list ap;
+ va_start(ap, fmt);
+ int w = vsnprintf(out + n, cap - n, fmt, ap);
+ va_end(ap);
+ n = (w < 0 || (size_t)w >= cap - n) ? cap : n + (size_t)w;
+}
 
- uint32_t now = millis();
- if (now - lastHeartbeatMs_ < cfgOrDefaultU32(cfg_.heartbeatIntervalMs, 60000)) return;
+// full=false: heartbeat용 요약 (count/p50/p90), true: max/sum/bucket 포함
+static void appendHistogram(char* out, size_t cap, size_t& n, const char* name, const MetricHistogram& h, bool full) {
+ jsonAppend(out, cap, n, "\"%s\":{\"n\":%lu,\"p50\":%lu,\"p90\":%lu", name,
+            (unsigned long)h.count, (unsigned long)h.percentile(50), (unsigned long)h.percentile(90));
+ if (full) {
+   jsonAppend(out, cap, n, ",\"p99\":%lu,\"max\":%lu,\"sum\":%lu,\"b\":[",
+              (unsigned long)h.percentile(99), (unsigned long)h.max, (unsigned long)h.sum);
+   uint8_t last = ORBISYNC_METRICS_BUCKETS;
+   while (last > 0 && h.buckets[last - 1] == 0) last--;  // 뒤쪽 0 bucket 생략
+   for (uint8_t i = 0; i < last; i++) {
+     jsonAppend(out, cap, n, i ? ",%u" : "%u", (unsigned)h.buckets[i]);
+   }
+   jsonAppend(out, cap, n, "]");
+ }
+ jsonAppend(out, cap, n, "}");
+}
 
- StaticJsonDocument<256> doc;
+/// Metrics JSON (ArduinoJson 문서 없이 바로 버퍼에 씀). 반환: 쓴 길이 (NUL 제외), 버퍼 부족이면 0
+static size_t formatMetricsJson(const Metrics& m, char* out, size_t cap, bool full) {
+ if (!out || cap == 0) return 0;
+ size_t n = 0;
+ out[0] = '\0';
+ const TunnelMetrics& t = m.tunnel;
+ jsonAppend(out, cap, n, "{\"up\":%lu,\"heap\":%lu,\"arena_miss\":%lu,\"tunnel\":{",
+            (unsigned long)m.uptimeMs, (unsigned long)m.freeHeap, (unsigned long)m.arenaMisses);
+ jsonAppend(out, cap, n, "\"conn\":%lu,\"disc\":%lu,\"backoff\":%u,\"rx\":%lu,\"tx\":%lu,\"rx_b\":%lu,\"tx_b\":%lu,"
+            "\"req\":%lu,\"busy\":%lu,\"defer_to\":%lu,\"batched\":%lu,",
+            (unsigned long)t.connects, (unsigned long)t.disconnects, (unsigned)t.backoffStep,
+            (unsigned long)t.rxFrames, (unsigned long)t.txFrames, (unsigned long)t.rxBytes, (unsigned long)t.txBytes,
+            (unsigned long)t.requests, (unsigned long)t.busyRejects, (unsigned long)t.deferTimeouts,
+            (unsigned long)t.batchedMsgs);
+ if (full && t.compressIn) {
+   jsonAppend(out, cap, n, "\"z_in\":%lu,\"z_out\":%lu,\"inflated\":%lu,",
+              (unsigned long)t.compressIn, (unsigned long)t.compressOut, (unsigned long)t.inflated);
+ }
+ if (full && t.flowCredits) {
+   jsonAppend(out, cap, n, "\"flow_credits\":%lu,\"flow_waits\":%lu,\"flow_over\":%lu,\"flow_stalls\":%lu,",
+              (unsigned long)t.flowCredits, (unsigned long)t.flowWaits, (unsigned long)t.flowOverruns,
+              (unsigned long)t.flowStalls);
+ }
+ appendHistogram(out, cap, n, "parse_us", t.parseUs, full);
+ jsonAppend(out, cap, n, ",");
+ appendHistogram(out, cap, n, "handler_us", t.handlerUs, full);
+ jsonAppend(out, cap, n, ",");
+ appendHistogram(out, cap, n, "rtt_ms", t.pingRttMs, full);
+ jsonAppend(out, cap, n, "},\"hub\":{");
+ bool first = true;
+ for (uint8_t i = 0; i < (uint8_t)HubEndpoint::COUNT; i++) {
+   const HubEndpointMetrics& h = m.hub[i];
+   if (h.requests == 0) continue;
+   jsonAppend(out, cap, n, "%s\"%s\":{\"n\":%lu,\"err\":%lu,\"reuse\":%lu,", first ? "" : ",", kHubEndpointNames[i],
+              (unsigned long)h.requests, (unsigned long)h.failures, (unsigned long)h.reused);
+   if (full) jsonAppend(out, cap, n, "\"out_b\":%lu,\"in_b\":%lu,", (unsigned long)h.bytesOut, (unsigned long)h.bytesIn);
+   appendHistogram(out, cap, n, "connect_ms", h.connectMs, full);
+   jsonAppend(out, cap, n, ",");
+   appendHistogram(out, cap, n, "ttfb_ms", h.ttfbMs, full);
+   jsonAppend(out, cap, n, ",");
+   appendHistogram(out, cap, n, "total_ms", h.totalMs, full);
+   jsonAppend(out, cap, n, "}");
+   first = false;
+ }
+ jsonAppend(out, cap, n, "}}");
+ return n < cap ? n : 0;
+}
+
+const Metrics& OrbiSyncNode::getMetrics() {
+ metrics_.uptimeMs = millis();
+ metrics_.freeHeap = ESP.getFreeHeap();
+ metrics_.arenaMisses = s_tunnelArenaMisses;
+ metrics_.tunnel.backoffStep = tunnelBackoffIndex_;
+ return metrics_;
+}
+
+// -----------------------------
+// Heartbeat (단편화 방지: String 금지)
+// -----------------------------
+bool OrbiSyncNode::heartbeatDue(uint32_t now) const {
+ return sessionToken_[0] && (now - lastHeartbeatMs_ >= heartbeatPeriodMs());
+}
+
+// heartbeat 템플릿: 닫는 '}' 없는 prefix. metrics 요약만 매번 뒤에 붙임
+bool OrbiSyncNode::buildHeartbeatTemplate() {
+ StaticJsonDocument<384> doc;
  doc["slot_id"] = cfg_.slotId ? cfg_.slotId : "";
- char nonceStr[9];
- snprintf(nonceStr, sizeof(nonceStr), "%08x", (unsigned)random(0x7FFFFFFF));
- doc["nonce"] = nonceStr;
+ doc["nonce"] = kNonceSlot;
  doc["firmware"] = (cfg_.firmwareVersion && cfg_.firmwareVersion[0]) ? cfg_.firmwareVersion : "1.0.0";
- doc["uptime_ms"] = (unsigned long)now;
+ doc["uptime_ms"] = serialized(kU32Slot, sizeof(kU32Slot) - 1);
 #if defined(ESP8266) || defined(ESP32)
- doc["free_heap"] = ESP.getFreeHeap();
- doc["rssi"] = WiFi.RSSI();
+ doc["free_heap"] = serialized(kU32Slot, sizeof(kU32Slot) - 1);
+ doc["rssi"] = serialized(kRssiSlot, sizeof(kRssiSlot) - 1);
 #endif
  char capHashStr[9];
  snprintf(capHashStr, sizeof(capHashStr), "%08x", (unsigned)computeCapabilitiesHash());
  doc["capabilities_hash"] = capHashStr;
 
- char buf[256];
- size_t n = serializeJson(doc, buf, sizeof(buf));
- if (n == 0 || n >= sizeof(buf)) return;
- buf[n] = '\0';
+ size_t n = serializeJson(doc, tpl_.heartbeat, sizeof(tpl_.heartbeat));
+ if (n < 2 || n >= sizeof(tpl_.heartbeat)) return false;
+ tpl_.heartbeat[--n] = '\0';  // '}' 제거
+ tpl_.hbNonceOff = payloadSlotOffset(tpl_.heartbeat, "nonce");
+ tpl_.hbUptimeOff = payloadSlotOffset(tpl_.heartbeat, "uptime_ms");
+ tpl_.hbHeapOff = payloadSlotOffset(tpl_.heartbeat, "free_heap");
+ tpl_.hbRssiOff = payloadSlotOffset(tpl_.heartbeat, "rssi");
+ if (!tpl_.hbNonceOff || !tpl_.hbUptimeOff) return false;
+ tpl_.heartbeatLen = (uint16_t)n;
+ return true;
+}
+
+size_t OrbiSyncNode::buildHeartbeatJson(char* out, size_t cap, uint32_t now) {
+ if (!tpl_.heartbeatLen && !buildHeartbeatTemplate()) return 0;
+ size_t n = tpl_.heartbeatLen;
+ if (n + 2 > cap) return 0;
+ memcpy(out, tpl_.heartbeat, n);
+ patchHex8(out + tpl_.hbNonceOff, payloadNonce());
+ patchNumSlot(out + tpl_.hbUptimeOff, sizeof(kU32Slot) - 1, now);
+#if defined(ESP8266) || defined(ESP32)
+ if (tpl_.hbHeapOff) patchNumSlot(out + tpl_.hbHeapOff, sizeof(kU32Slot) - 1, (uint32_t)ESP.getFreeHeap());
+ if (tpl_.hbRssiOff) {
+   int rssi = WiFi.RSSI();
+   patchNumSlot(out + tpl_.hbRssiOff, sizeof(kRssiSlot) - 1, (uint32_t)(rssi < 0 ? -rssi : rssi), rssi < 0);
+ }
+#endif
+
+ // 요약 metrics (이미 JSON 텍스트라 그대로 이어 붙임, 자리가 없으면 생략)
+ static const char kMetricsKey[] = ",\"metrics\":";
+ size_t room = cap - n - 1;
+ if (room > sizeof(kMetricsKey) + 2) {
+   size_t mn = formatMetricsJson(getMetrics(), out + n + sizeof(kMetricsKey) - 1, room - (sizeof(kMetricsKey) - 1) - 1, false);
+   if (mn > 0) {
+     memcpy(out + n, kMetricsKey, sizeof(kMetricsKey) - 1);
+     n += sizeof(kMetricsKey) - 1 + mn;
+   }
+ }
+ out[n++] = '}';
+ out[n] = '\0';
+ return n;
+}
+
+// 터널이 등록돼 있으면 heartbeat는 ping frame에 실림 (tunnelLoop). 여기서는 터널이 없을 때만 HTTP POST
+static char s_heartbeatBuf[768];
+
+void OrbiSyncNode::tryHeartbeat() {
+ if (tunnelRegistered_) return;
+ if (httpBusy()) return;
+
+ uint32_t now = millis();
+ if (!heartbeatDue(now)) return;
+ lastHeartbeatMs_ = now;  // 실패해도 다음 주기까지 대기 (heartbeat는 best-effort)
+
+ // 대기 중인 command ack 자리는 metrics보다 우선
+ static constexpr size_t kAckReserve = 192;
+ size_t hn = buildHeartbeatJson(s_heartbeatBuf, sizeof(s_heartbeatBuf) - (cmdAckPendingCount_ ? kAckReserve : 0), now);
+ if (!hn) return;
+ commandAppendAcks(s_heartbeatBuf, sizeof(s_heartbeatBuf), hn);
+
+ const char* path = (cfg_.heartbeatEndpointPath && cfg_.heartbeatEndpointPath[0]) ? cfg_.heartbeatEndpointPath : "/api/device/heartbeat";
+ s_httpResp[0] = '\0';
+ if (cfg_.asyncHttp) {
+   if (!startJsonUnified(HttpOp::HEARTBEAT, path, s_heartbeatBuf, s_httpResp, sizeof(s_httpResp), sessionToken_)) {
+     handleHeartbeatResponse(-1, s_httpResp, 0);
+   }
+   return;
+ }
+
+ httpOp_ = HttpOp::HEARTBEAT;
+ int status = 0;
+ bool ok = postJsonUnified(path, s_heartbeatBuf, &status, s_httpResp, sizeof(s_httpResp), sessionToken_);
+ httpOp_ = HttpOp::NONE;
+
+ yield();
+ handleHeartbeatResponse(ok ? status : -1, s_httpResp, strlen(s_httpResp));
+}
 
- // Authorization 헤더는 safePostJson에서 처리하지 않으므로(간소화),
- // 여기서는 heartbeat를 생략하거나, 별도 구현이 필요.
- // 지금 안정화 목표는 "HELLO/APPROVE/SESSION/터널"이라 heartbeat는 기본 OFF를 권장.
- // 필요하면 이후 "Authorization: Bearer" 포함 POST를 별도로 추가하자.
- lastHeartbeatMs_ = now;
+void OrbiSyncNode::handleHeartbeatResponse(int status, char* body, size_t len) {
+ commandAcksDelivered(status >= 200 && status < 300);
+ if (status < 0) {
+   ORBI_LOGW("[HEARTBEAT] fail (timeout or connect)\n");
+   return;
+ }
+ if (status == 401 || status == 403) {
+   // Hub가 세션을 더 이상 인정하지 않음 → 세션 재요청
+   ORBI_LOGW("[HEARTBEAT] session rejected status=%d -> re-poll session\n", status);
+   sessionToken_[0] = '\0';
+   nextSessionPollMs_ = 0;
+   setState(State::PENDING_POLL);
+   return;
+ }
+ if (status < 200 || status >= 300) {
+   ORBI_LOGW("[HEARTBEAT] fail http status=%d\n", status);
+   return;
+ }
+ ORBI_LOGD("[HEARTBEAT] ok status=%d body_len=%u\n", status, (unsigned)len);
+ // command poll 결과 (body가 없거나 JSON이 아니면 command 없음)
+ if (commandCount_ && hubRxParse(body, len)) commandIngest(false);
 }
 
 // -----------------------------
@@ -1287,6 +2646,8 @@ void OrbiSyncNode::tryHeartbeat() {
 // -----------------------------
 void OrbiSyncNode::runStateMachine() {
  yield();
+ // asyncHttp: 진행 중인 Hub 요청 처리 (WiFi 끊김도 여기서 실패로 정리됨)
+ if (cfg_.asyncHttp) pumpHttp();
  ensureWiFi();
  if (WiFi.status() != WL_CONNECTED) return;
 
@@ -1327,7 +2688,9 @@ void OrbiSyncNode::runStateMachine() {
    case State::TUNNEL_CONNECTING:
    case State::TUNNEL_CONNECTED:
      tunnelLoop();
-     // tryHeartbeat(); // 필요하면 켜기
+     tunnelBatchTick(millis());
+     tryHeartbeat();
+     commandPumpAcks();
      break;
 
    case State::ERROR:
@@ -1344,10 +2707,11 @@ void OrbiSyncNode::runStateMachine() {
  static uint32_t lastDiag = 0;
  if (millis() - lastDiag > 5000) {
    lastDiag = millis();
-   Serial.printf("[DIAG] heap=%u maxblk=%u frag=%u%% state=%s\n",
+   ORBI_LOGD("[DIAG] heap=%u maxblk=%u frag=%u%% arena_miss=%u state=%s\n",
      ESP.getFreeHeap(),
      ESP.getMaxFreeBlockSize(),
      ESP.getHeapFragmentation(),
+     (unsigned)s_tunnelArenaMisses,
      stateStr(state_)
    );
  }
@@ -1355,113 +2719,520 @@ void OrbiSyncNode::runStateMachine() {
 }
 
 void OrbiSyncNode::loopTick() {
+ if (cfg_.memoryReport && memoryReportStage_ == 0) {
+   memoryReportStage_ = 1;
+   logMemoryBudget();
+ }
+#if ORBISYNC_TASK_MODE
+ if (cfg_.taskMode) {
+   taskUserTick();
+   commandRun();
+   return;
+ }
+ runStateMachine();
+ commandRun();
+ if (cfg_.idleWait) {
+   idleWaitFor(nextWakeupMs());
+   return;
+ }
+#else
  runStateMachine();
+ commandRun();
+#endif
  yield();
 }
 
-// ---- WebSocket 이벤트 콜백 (메모리 할당 없음) ----
-static void wsEvent(WStype_t type, uint8_t* payload, size_t len) {
- if (!s_nodeForWs) return;
+// -----------------------------
+// 사용자 콜백 전달
+// -----------------------------
+// task mode에서는 콜백을 network task에서 부르지 않고 queue에 넣어 loopTick(사용자 core)에서 호출.
+// 등록/터널 문자열은 전달 시점의 nodeId_/tunnelUrl_을 넘김.
+#if ORBISYNC_TASK_MODE
+namespace {
+enum : uint8_t { kEvState, kEvError, kEvRegistered, kEvTunnel };
+struct TaskEvent {
+  OrbiSyncNodeType* node;
+  uint8_t kind;
+  uint8_t a;        /// state: old / tunnel: connected
+  uint8_t b;        /// state: new
+  const char* msg;  /// error (정적 문자열)
+};
 
- switch (type) {
-   case WStype_CONNECTED: {
-     if (!s_nodeForWs) return;
-     const char* url = s_nodeForWs->getTunnelUrl();
-     Serial.println("========================================");
-     Serial.println("[TUNNEL] WebSocket Handshake SUCCESS");
-     Serial.println("========================================");
-     Serial.printf("URL: %s\n", url ? url : "(none)");
-     Serial.println("HTTP Upgrade: 101 Switching Protocols");
-     Serial.println("Connection: Upgrade");
-     Serial.println("Upgrade: websocket");
-     Serial.println("Sec-WebSocket-Accept: <server-response>");
-     Serial.println("========================================");
-     Serial.println("[TUNNEL] Sending register message...");
-     s_nodeForWs->tunnelSendRegister();
-     break;
-   }
+/// network task → loopTick 요청 전달. 응답 writer/요청 view는 network task가 대기하는 동안 유효
+struct TaskRequest {
+  OrbiSyncNodeType* node;
+  const TunnelHttpRequest* req;
+  TunnelHttpResponseWriter* res;
+  const char* method;
+  const char* path;
+  uint32_t seq;
+};
 
-   case WStype_DISCONNECTED: {
-     // Try to get close code/reason if available (library-dependent)
-     Serial.printf("[TUNNEL] disconnected len=%u (will reconnect with backoff)\n", (unsigned)len);
-     if (len > 0 && payload) {
-       // Some libraries pass close code as first 2 bytes
-       if (len >= 2) {
-         uint16_t closeCode = (payload[0] << 8) | payload[1];
-         Serial.printf("[TUNNEL] close_code=%u\n", closeCode);
+/// loopTick → network task: deferred 응답의 end() / chunk flush
+struct TaskWriterOp {
+  TunnelHttpResponseWriter* w;
+  bool end;
+};
+
+/// loopTick → network task: sendTunnelEvent (json은 malloc 사본, network task가 free)
+struct TaskSendOp {
+  OrbiSyncNodeType* node;
+  char* json;
+  uint32_t id;
+  bool persist;
+};
+}  // namespace
+
+static constexpr uint8_t kTaskEventDepth = 8;
+static constexpr uint8_t kTaskRequestDepth = 2;
+static constexpr uint8_t kTaskSendDepth = 4;
+static constexpr uint32_t kDefaultTaskStackBytes = 8192;
+
+// handoff 상태: (seq << 2) | state. 취소된 요청이 queue에 남아도 seq가 달라 실행되지 않음
+enum : uint32_t { kHandoffPending = 0, kHandoffTaken = 1, kHandoffDone = 2, kHandoffCancelled = 3 };
+
+static SpscQueue<TaskEvent, kTaskEventDepth> s_taskEvents;          // network task → loopTick
+static SpscQueue<TaskRequest, kTaskRequestDepth> s_taskRequests;    // network task → loopTick
+static SpscQueue<TaskWriterOp, ORBISYNC_TUNNEL_MAX_STREAMS> s_taskWriterOps;  // loopTick → network task (writer당 최대 1개)
+static SpscQueue<TaskSendOp, kTaskSendDepth> s_taskSends;           // loopTick → network task
+static uint32_t s_handoffSeq = 0;
+static uint32_t s_handoffState = 0;
+// network task는 gateway에 하나: task mode 노드를 모두 차례로 실행
+static TaskHandle_t s_netTask = nullptr;
+static OrbiSyncNodeType* s_taskNodes[ORBISYNC_TUNNEL_MAX_NODES];
+static uint8_t s_taskNodeCount = 0;
+
+static void taskPushEvent(const TaskEvent& ev) {
+ if (!s_taskEvents.push(ev)) ORBI_LOGW("[TASK] event queue full, callback dropped (kind=%u)\n", (unsigned)ev.kind);
+}
+#endif
+
+void OrbiSyncNode::emitStateChange(State old, State s) {
+#if ORBISYNC_TASK_MODE
+ if (netTask_ && xTaskGetCurrentTaskHandle() == (TaskHandle_t)netTask_) {
+   if (stateChangeCb_) taskPushEvent({this, kEvState, (uint8_t)old, (uint8_t)s, nullptr});
+   return;
+ }
+#endif
+ if (stateChangeCb_) stateChangeCb_(old, s);
+}
+
+void OrbiSyncNode::emitError(const char* msg) {
+#if ORBISYNC_TASK_MODE
+ if (netTask_ && xTaskGetCurrentTaskHandle() == (TaskHandle_t)netTask_) {
+   if (errorCb_) taskPushEvent({this, kEvError, 0, 0, msg});
+   return;
+ }
+#endif
+ if (errorCb_) errorCb_(msg);
+}
+
+void OrbiSyncNode::emitRegistered() {
+#if ORBISYNC_TASK_MODE
+ if (netTask_ && xTaskGetCurrentTaskHandle() == (TaskHandle_t)netTask_) {
+   if (registeredCb_) taskPushEvent({this, kEvRegistered, 0, 0, nullptr});
+   return;
+ }
+#endif
+ if (registeredCb_) registeredCb_(nodeId_[0] ? nodeId_ : "");
+}
+
+void OrbiSyncNode::emitTunnelChange(bool connected) {
+#if ORBISYNC_TASK_MODE
+ if (netTask_ && xTaskGetCurrentTaskHandle() == (TaskHandle_t)netTask_) {
+   if (tunnelChangeCb_) taskPushEvent({this, kEvTunnel, (uint8_t)(connected ? 1 : 0), 0, nullptr});
+   return;
+ }
+#endif
+ if (tunnelChangeCb_) tunnelChangeCb_(connected, tunnelUrl_[0] ? tunnelUrl_ : "");
+}
+
+bool OrbiSyncNode::tunnelQueueWriterOp(TunnelHttpResponseWriter& w, bool end) {
+#if ORBISYNC_TASK_MODE
+ if (taskOnNetworkSide()) return false;
+ __atomic_store_n(&w.taskOpPending_, true, __ATOMIC_RELEASE);
+ TaskWriterOp op = {&w, end};
+ // writer당 op는 최대 1개라 queue는 가득 차지 않지만, 만약을 위해 대기
+ while (!s_taskWriterOps.push(op)) vTaskDelay(1);
+ // chunk: body_ 버퍼를 network task가 보낼 때까지 대기 (loopTick core가 기다리는 유일한 경우)
+ if (!end) {
+   while (__atomic_load_n(&w.taskOpPending_, __ATOMIC_ACQUIRE)) vTaskDelay(1);
+ }
+ return true;
+#else
+ (void)w;
+ (void)end;
+ return false;
+#endif
+}
+
+#if ORBISYNC_TASK_MODE
+// -----------------------------
+// ESP32 task mode (Config::taskMode)
+// -----------------------------
+// network task(taskCore, 기본 core 0): runStateMachine/tunnelLoop/Hub HTTP, 모든 WS 송신.
+// loopTick(사용자 core): 콜백 전달 + 넘겨받은 터널 요청의 handler 실행.
+// 요청 view(TunnelHttpRequest)는 network task의 수신 문서를 가리키므로, 요청을 넘긴 뒤
+// network task는 handler가 끝날 때까지(최대 tunnelDeferTimeoutMs) 대기하고 그동안 handler는
+// 응답을 직접 전송할 수 있음. handler 밖(deferred)의 end()/chunk는 s_taskWriterOps로 넘김.
+// 노드가 여럿이면 모두 idleWait일 때만 가장 이른 nextWakeupMs까지 대기
+void OrbiSyncNode::taskEntry(void* arg) {
+ (void)arg;
+ for (;;) {
+   uint8_t n = __atomic_load_n(&s_taskNodeCount, __ATOMIC_ACQUIRE);
+   bool idle = n > 0;
+   uint32_t waitMs = kWakeupIdleMaxMs;
+   for (uint8_t i = 0; i < n; i++) {
+     OrbiSyncNode* node = s_taskNodes[i];
+     node->taskNetworkTick();
+     if (!node->cfg_.idleWait) {
+       idle = false;
+       continue;
+     }
+     uint32_t w = node->nextWakeupMs();
+     if (w < waitMs) waitMs = w;
+   }
+   if (idle) s_taskNodes[0]->idleWaitFor(waitMs);
+   else vTaskDelay(1);
+ }
+}
+
+void OrbiSyncNode::taskStart() {
+ if (s_taskNodeCount >= ORBISYNC_TUNNEL_MAX_NODES) {
+   ORBI_LOGE("[TASK] too many task mode nodes (max %u) -> loopTick mode\n", (unsigned)ORBISYNC_TUNNEL_MAX_NODES);
+   cfg_.taskMode = false;
+   return;
+ }
+ if (!s_netTask) {
+   uint32_t stack = cfgOrDefaultU32(cfg_.taskStackBytes, kDefaultTaskStackBytes);
+   TaskHandle_t h = nullptr;
+   if (xTaskCreatePinnedToCore(taskEntry, "orbisync", stack, nullptr, ORBISYNC_TASK_PRIORITY, &h, cfg_.taskCore) != pdPASS) {
+     ORBI_LOGE("[TASK] network task create failed (stack=%u) -> loopTick mode\n", (unsigned)stack);
+     cfg_.taskMode = false;
+     return;
+   }
+   s_netTask = h;
+   ORBI_LOGI("[TASK] network task started core=%u stack=%u\n", (unsigned)cfg_.taskCore, (unsigned)stack);
+ }
+ netTask_ = s_netTask;
+ s_taskNodes[s_taskNodeCount] = this;
+ __atomic_store_n(&s_taskNodeCount, (uint8_t)(s_taskNodeCount + 1), __ATOMIC_RELEASE);
+}
+
+bool OrbiSyncNode::taskOnNetworkSide() const {
+ return !netTask_ || handoffActive_ || xTaskGetCurrentTaskHandle() == (TaskHandle_t)netTask_;
+}
+
+void OrbiSyncNode::taskUserTick() {
+ if (!netTask_) {
+   taskStart();
+   if (!netTask_) return;
+ }
+
+ // queue는 노드 공유: 어느 노드의 loopTick이든 전부 꺼내 해당 노드 콜백으로 전달
+ TaskEvent ev;
+ while (s_taskEvents.pop(ev)) {
+   OrbiSyncNode& n = *ev.node;
+   switch (ev.kind) {
+     case kEvState:
+       if (n.stateChangeCb_) n.stateChangeCb_((State)ev.a, (State)ev.b);
+       break;
+     case kEvError:
+       if (n.errorCb_) n.errorCb_(ev.msg);
+       break;
+     case kEvRegistered:
+       if (n.registeredCb_) n.registeredCb_(n.nodeId_[0] ? n.nodeId_ : "");
+       break;
+     case kEvTunnel:
+       if (n.tunnelChangeCb_) n.tunnelChangeCb_(ev.a != 0, n.tunnelUrl_[0] ? n.tunnelUrl_ : "");
+       break;
+   }
+ }
+
+ TaskRequest r;
+ while (s_taskRequests.pop(r)) {
+   uint32_t expect = (r.seq << 2) | kHandoffPending;
+   if (!__atomic_compare_exchange_n(&s_handoffState, &expect, (r.seq << 2) | kHandoffTaken,
+                                    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+     continue;  // network task가 이미 504로 응답
+   }
+   r.node->handoffActive_ = true;
+   r.node->tunnelServeHandlers(*r.req, *r.res, r.method, r.path);
+   r.node->handoffActive_ = false;
+   __atomic_store_n(&s_handoffState, (r.seq << 2) | kHandoffDone, __ATOMIC_RELEASE);
+   xTaskNotifyGive(s_netTask);
+ }
+ yield();
+}
+
+void OrbiSyncNode::taskNetworkTick() {
+ taskDrainWriterOps();
+ runStateMachine();
+}
+
+void OrbiSyncNode::taskDrainWriterOps() {
+ TaskWriterOp op;
+ while (s_taskWriterOps.pop(op)) {
+   TunnelHttpResponseWriter& w = *op.w;
+   OrbiSyncNode* node = static_cast<OrbiSyncNode*>(w.node_);  // writer를 가진 노드로 전송
+   // window 대기: taskOpPending_를 유지 (chunk면 loopTick core가 credit까지 기다림 = Hub backpressure)
+   if (w.inUse_ && node && !node->tunnelWriterSend(w)) continue;
+   __atomic_store_n(&w.taskOpPending_, false, __ATOMIC_RELEASE);
+ }
+
+ TaskSendOp send;
+ while (s_taskSends.pop(send)) {
+   send.node->tunnelEventSend(send.json, send.id, send.persist);
+   free(send.json);
+ }
+}
+
+bool OrbiSyncNode::taskHandoffRequest(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res,
+                                      const char* method, const char* path) {
+ // injectTunnelFrame() 등 loopTick core에서 들어온 요청은 그 자리에서 처리
+ if (xTaskGetCurrentTaskHandle() != (TaskHandle_t)netTask_) return false;
+
+ uint32_t seq = ++s_handoffSeq;
+ __atomic_store_n(&s_handoffState, (seq << 2) | kHandoffPending, __ATOMIC_RELEASE);
+ TaskRequest r = {this, &req, &res, method, path, seq};
+ if (!s_taskRequests.push(r)) {
+   // loopTick이 멈춰 취소된 요청이 쌓여 있음 → handler를 network task에서 돌리지 않고 503
+   metrics_.tunnel.busyRejects++;
+   res.setStatus(503);
+   res.setHeader("Content-Type", "application/json");
+   res.write("{\"ok\":false,\"error\":\"busy\"}");
+   res.end();
+   return true;
+ }
+
+ uint32_t limit = cfgOrDefaultU32(cfg_.tunnelDeferTimeoutMs, kDefaultTunnelDeferTimeoutMs);
+ if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(limit)) == 0) {
+   uint32_t expect = (seq << 2) | kHandoffPending;
+   if (__atomic_compare_exchange_n(&s_handoffState, &expect, (seq << 2) | kHandoffCancelled,
+                                   false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+     metrics_.tunnel.deferTimeouts++;
+     ORBI_LOGW("[TASK] loopTick did not take request in %ums -> 504\n", (unsigned)limit);
+     res.setStatus(504);
+     res.setHeader("Content-Type", "text/plain");
+     res.write("Gateway Timeout");
+     res.end();
+     return true;
+   }
+   // handler가 이미 실행 중 → 끝날 때까지 대기 (요청 view가 살아 있어야 함)
+   ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+ }
+ return true;
+}
+#endif
+
+// -----------------------------
+// Idle wait (Config::idleWait)
+// -----------------------------
+// nextWakeupMs: 상태머신이 다음에 실제로 할 일이 생기는 시각. timer 비교는 try*/tunnelLoop와 같은 식.
+// 열린 소켓은 readiness를 직접 알 수 없어(WS 수신은 WebSocketsClient 내부) idleWaitMaxMs마다 확인.
+
+// 절대 시각 at (now < at 형태 timer)
+static void wakeupAt(uint32_t& best, uint32_t now, uint32_t at) {
+ uint32_t d = (now < at) ? at - now : 0;
+ if (d < best) best = d;
+}
+
+// last + interval (now - last >= interval 형태 timer)
+static void wakeupAfter(uint32_t& best, uint32_t now, uint32_t last, uint32_t interval) {
+ uint32_t elapsed = now - last;
+ uint32_t d = (elapsed >= interval) ? 0 : interval - elapsed;
+ if (d < best) best = d;
+}
+
+uint32_t OrbiSyncNode::nextWakeupMs() const {
+ if (WiFi.status() != WL_CONNECTED) return kWakeupWifiPollMs;
+
+ uint32_t now = millis();
+ uint32_t best = kWakeupIdleMaxMs;
+ uint32_t ioPollMs = cfg_.idleWaitMaxMs ? cfg_.idleWaitMaxMs : kDefaultIdleWaitMaxMs;
+ bool httpIdle = !httpBusy();
+
+ // asyncHttp 요청 진행 중: 응답 바이트 확인
+ if (!httpIdle && ioPollMs < best) best = ioPollMs;
+
+ switch (state_) {
+   case State::BOOT:
+   case State::GRANTED:
+   case State::ERROR:
+     return 0;  // 다음 runStateMachine에서 바로 전이
+
+   case State::HELLO:
+     if (httpIdle) wakeupAt(best, now, nextHelloMs_);
+     break;
+
+   case State::PAIR_SUBMIT:
+     if (httpIdle && pairingCodeValid_ && pairingCode_[0]) wakeupAt(best, now, nextPairMs_);
+     break;
+
+   case State::PENDING_POLL:
+     if (!httpIdle) break;
+     if (cfg_.preferRegisterBySlot && cfg_.loginToken && cfg_.loginToken[0]) {
+       wakeupAt(best, now, nextRegisterBySlotMs_);
+     }
+     if (cfg_.enableSelfApprove && cfg_.approveEndpointPath && cfg_.approveEndpointPath[0] &&
+         !sessionToken_[0] && !approveMissingMacFailed_) {
+       wakeupAt(best, now, nextApproveMs_);
+     }
+     if (!sessionToken_[0]) wakeupAt(best, now, nextSessionPollMs_);
+     break;
+
+   case State::ACTIVE:
+   case State::TUNNEL_CONNECTING:
+   case State::TUNNEL_CONNECTED: {
+     if (s_link.disconnectPending) return 0;
+     // 실행 끝난 command ack (터널 등록 중이면 바로 전송)
+     if (!cmdAcks_.empty() || (tunnelRegistered_ && cmdAckPendingCount_ && !cmdAckInFlight_)) return 0;
+     uint32_t hbInterval = heartbeatPeriodMs();
+     // HTTP heartbeat (터널 미등록, command poll 겸함) 또는 ping에 실리는 heartbeat
+     if (sessionToken_[0] && (tunnelRegistered_ || httpIdle)) wakeupAfter(best, now, lastHeartbeatMs_, hbInterval);
+
+     if (!cfg_.enableTunnel || !tunnelUrl_[0] || (!nodeToken_[0] && !sessionToken_[0])) break;
+     if (!s_link.ws || linkIndexOf(this) < 0) {
+       wakeupAt(best, now, nextTunnelConnectMs_);
+       break;
+     }
+     if (ioPollMs < best) best = ioPollMs;
+     if (tunnelRegistered_) wakeupAfter(best, now, lastTunnelPingMs_, kTunnelPingIntervalMs);
+     if (s_link.txBatchCount) {
+       if (!cfg_.tunnelBatchMaxDelayMs) return 0;
+       wakeupAfter(best, now, s_link.txBatchFirstMs, cfg_.tunnelBatchMaxDelayMs);
+     }
+     uint32_t deferMs = cfgOrDefaultU32(cfg_.tunnelDeferTimeoutMs, kDefaultTunnelDeferTimeoutMs);
+     for (uint8_t i = 0; i < ORBISYNC_TUNNEL_MAX_STREAMS; i++) {
+       const TunnelHttpResponseWriter& w = streams_[i];
+       if (w.inUse_ && w.deferred_ && !w.ended_) wakeupAfter(best, now, w.startedMs_, deferMs);
+       if (w.inUse_ && w.flowHeld_) {
+         if (flowAllows(w.frameCost(w.bodyLen_))) return 0;  // 다른 노드의 수신에서 credit이 들어옴
+         wakeupAfter(best, now, s_link.flowLastCreditMs, kFlowStallMs);
+       }
+     }
+     break;
+   }
+
+   default:
+     break;
+ }
+ return best;
+}
+
+void OrbiSyncNode::idleWaitFor(uint32_t ms) {
+#if ORBISYNC_TASK_MODE
+ // vTaskDelay 동안 CPU는 idle task → WiFi modem sleep(ESP32 기본), PM 설정 시 자동 light sleep
+ uint32_t start = millis();
+ while (millis() - start < ms) {
+   if (s_http.owner && s_http.c && s_http.c->available()) return;
+   if (netTask_ && (!s_taskWriterOps.empty() || !s_taskSends.empty())) return;
+   for (uint8_t i = 0, n = __atomic_load_n(&s_taskNodeCount, __ATOMIC_ACQUIRE); i < n; i++) {
+     if (!s_taskNodes[i]->cmdAcks_.empty()) return;  // loopTick이 command 실행을 마침
+   }
+   uint32_t left = ms - (millis() - start);
+   vTaskDelay(pdMS_TO_TICKS(left < kIdleSliceMs ? left : kIdleSliceMs));
+ }
+#else
+ (void)ms;
+#endif
+}
+
+// ---- WebSocket 이벤트 콜백 (메모리 할당 없음) ----
+// 연결 이벤트는 owner(nodes[0])가 받고, 수신 frame은 owner의 dispatch에서 node_id로 분배
+static void wsEvent(WStype_t type, uint8_t* payload, size_t len) {
+ OrbiSyncNodeType* owner = s_link.nodeCount ? s_link.nodes[0] : nullptr;
+ if (!owner) return;
+
+ switch (type) {
+   case WStype_CONNECTED: {
+     const char* url = owner->getTunnelUrl();
+     ORBI_LOGD("========================================\n");
+     ORBI_LOGI("[TUNNEL] WebSocket Handshake SUCCESS\n");
+     ORBI_LOGD("========================================\n");
+     ORBI_LOGD("URL: %s\n", url ? url : "(none)");
+     ORBI_LOGD("HTTP Upgrade: 101 Switching Protocols\n");
+     ORBI_LOGD("Connection: Upgrade\n");
+     ORBI_LOGD("Upgrade: websocket\n");
+     ORBI_LOGD("Sec-WebSocket-Accept: <server-response>\n");
+     ORBI_LOGD("========================================\n");
+     owner->tunnelOnConnected();
+     break;
+   }
+
+   case WStype_DISCONNECTED: {
+     // Try to get close code/reason if available (library-dependent)
+     ORBI_LOGI("[TUNNEL] disconnected len=%u (will reconnect with backoff)\n", (unsigned)len);
+     if (len > 0 && payload) {
+       // Some libraries pass close code as first 2 bytes
+       if (len >= 2) {
+         uint16_t closeCode = (payload[0] << 8) | payload[1];
+         ORBI_LOGI("[TUNNEL] close_code=%u\n", closeCode);
+         // normal / going away / service restart (Hub 배포)
+         if (closeCode == 1000 || closeCode == 1001 || closeCode == 1012) s_link.gracefulClose = true;
          if (len > 2) {
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_INFO
            constexpr size_t kReasonPreview = 64;
-           size_t rlen = (len - 2) > kReasonPreview ? kReasonPreview : (len - 2);
            Serial.printf("[TUNNEL] close_reason=");
-           for (size_t i = 2; i < 2 + rlen; i++) {
-             char c = (char)payload[i];
-             Serial.print((c >= 32 && c < 127) ? c : '.');
-           }
-           if (len > 2 + kReasonPreview) Serial.print("...");
-           Serial.println();
+           logPreview(payload + 2, len - 2, kReasonPreview);
+#endif
          }
        }
      }
-     s_tunnelDisconnectPending = true;
+     s_link.disconnectPending = true;
      break;
    }
 
    case WStype_ERROR: {
-     Serial.println("========================================");
-     Serial.println("[TUNNEL] WebSocket Handshake FAILED");
-     Serial.println("========================================");
-     Serial.printf("Error payload length: %u\n", (unsigned)len);
+     ORBI_LOGE("========================================\n");
+     ORBI_LOGE("[TUNNEL] WebSocket Handshake FAILED\n");
+     ORBI_LOGE("========================================\n");
+     ORBI_LOGE("Error payload length: %u\n", (unsigned)len);
      if (len > 0 && payload) {
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_ERROR
        constexpr size_t kErrorPreview = 128;
-       size_t pl = len > kErrorPreview ? kErrorPreview : len;
        Serial.printf("Error data: ");
-       for (size_t i = 0; i < pl; i++) {
-         char c = (char)payload[i];
-         Serial.print((c >= 32 && c < 127) ? c : '.');
-       }
-       if (len > kErrorPreview) Serial.print("...");
-       Serial.println();
+       logPreview(payload, len, kErrorPreview);
+#endif
      }
-     Serial.println("Possible causes:");
-     Serial.println("1. TLS/SSL handshake failed (certificate/SNI issue)");
-     Serial.println("2. Server rejected HTTP Upgrade request");
-     Serial.println("3. Network connectivity issue");
-     Serial.println("4. Wrong host/port/path");
-     Serial.println("5. Authorization header rejected");
-     Serial.println("========================================");
-     s_tunnelDisconnectPending = true;
+     ORBI_LOGE("Possible causes:\n");
+     ORBI_LOGE("1. TLS/SSL handshake failed (certificate/SNI issue)\n");
+     ORBI_LOGE("2. Server rejected HTTP Upgrade request\n");
+     ORBI_LOGE("3. Network connectivity issue\n");
+     ORBI_LOGE("4. Wrong host/port/path\n");
+     ORBI_LOGE("5. Authorization header rejected\n");
+     ORBI_LOGE("========================================\n");
+     s_link.disconnectPending = true;
      break;
    }
 
    case WStype_TEXT:
-     if (s_nodeForWs && payload && len > 0) {
+     if (payload && len > 0) {
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_VERBOSE
        constexpr size_t kWsRxPreview = 256;
-       size_t pl = len > kWsRxPreview ? kWsRxPreview : len;
        Serial.printf("[WS_RX] len=%u data=", (unsigned)len);
-       for (size_t i = 0; i < pl; i++) {
-         char c = (char)payload[i];
-         Serial.print((c >= 32 && c < 127) ? c : '.');
-       }
-       if (len > kWsRxPreview) Serial.print("...");
-       Serial.println();
-       s_nodeForWs->tunnelHandleMessage(payload, len);
+       logPreview(payload, len, kWsRxPreview);
+#endif
+       owner->tunnelHandleMessage(payload, len);
      }
      break;
 
    case WStype_BIN:
-     Serial.printf("[TUNNEL] rx BIN len=%u (ignored)\n", (unsigned)len);
+     if (payload && len > 0) {
+       owner->tunnelHandleBinaryMessage(payload, len);
+     }
      break;
 
    case WStype_PING:
-     Serial.println("[TUNNEL] rx PING");
+     ORBI_LOGD("[TUNNEL] rx PING\n");
      break;
 
    case WStype_PONG:
-     Serial.println("[TUNNEL] rx PONG");
+     ORBI_LOGD("[TUNNEL] rx PONG\n");
      break;
 
    default:
-     Serial.printf("[TUNNEL] ws_event type=%d len=%u\n", (int)type, (unsigned)len);
+     ORBI_LOGD("[TUNNEL] ws_event type=%d len=%u\n", (int)type, (unsigned)len);
      break;
  }
 }
@@ -1469,67 +3240,405 @@ static void wsEvent(WStype_t type, uint8_t* payload, size_t len) {
 // -----------------------------
 // ---- 터널 연결 루프 (재연결/keepalive) ----
 /// 터널 연결 상태 확인 및 재연결 처리
+// -----------------------------
+// Outbox (Config::tunnelOutbox)
+// -----------------------------
+// 터널이 끊긴 동안의 응답/이벤트를 보관했다가 register_ack 후 순서대로 전송 (보드 공유 RAM ring)
+// - record는 잘리지 않음: 끝에 자리가 없으면 wrap 표시 후 0부터. OutboxRec 정렬 단위로 배치
+// - 노드별 순서 유지: 다른 노드 record는 건너뛰고, 보낸 record는 head부터 정리
+// - RAM outbox는 재부팅 시 사라짐 (토큰 RAM-only 정책). LittleFS에는 persist 이벤트만 (ORBISYNC_OUTBOX_SPILL)
+namespace {
+struct OutboxRec {
+  const void* node;
+  uint32_t id;      /// 0 = 중복 검사 없음
+  uint16_t len;     /// data 길이 (NUL 제외)
+  uint8_t flags;
+  uint8_t reserved;
+};
+}  // namespace
+
+enum : uint8_t { kOutboxBinary = 0x01, kOutboxSent = 0x02, kOutboxWrap = 0x04 };
+
+struct Outbox {
+ uint8_t* buf;    // 첫 push에서 할당
+ uint16_t head;   // 가장 오래된 record
+ uint16_t tail;   // 다음 쓸 위치
+ uint16_t count;
+};
+using limits::kOutboxBytes;
+static Outbox s_outbox = {};
+static uint32_t s_outboxRecent[kOutboxRecentIds];
+static uint8_t s_outboxRecentPos = 0;
+
+// FNV-1a. salt: chunk seq 등 (같은 request_id의 조각 구분). 0은 "id 없음"이라 피함
+static uint32_t outboxIdHash(const char* id, uint32_t salt) {
+ if (!id || !id[0]) return 0;
+ uint32_t h = 2166136261u;
+ for (const char* p = id; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+ h = (h ^ salt) * 16777619u;
+ return h ? h : 1;
+}
+
+static uint16_t outboxRecSize(size_t len) {
+ const size_t align = alignof(OutboxRec);
+ return (uint16_t)((sizeof(OutboxRec) + len + 1 + align - 1) & ~(align - 1));
+}
+
+// record 위치 보정: wrap 표시 또는 header 자리가 없으면 0
+static uint16_t outboxAt(uint16_t pos) {
+ if (kOutboxBytes - pos < sizeof(OutboxRec)) return 0;
+ return (((const OutboxRec*)(s_outbox.buf + pos))->flags & kOutboxWrap) ? 0 : pos;
+}
+
+// checkRecent: 최근 전송한 이벤트 id까지 (응답은 보관 중인 것만 검사 — Hub 재요청에는 다시 응답)
+static bool outboxHasId(uint32_t id, bool checkRecent) {
+ if (!id) return false;
+ if (checkRecent) {
+   for (uint8_t i = 0; i < kOutboxRecentIds; i++) {
+     if (s_outboxRecent[i] == id) return true;
+   }
+ }
+ uint16_t pos = s_outbox.head;
+ for (uint16_t i = 0; i < s_outbox.count; i++) {
+   pos = outboxAt(pos);
+   const OutboxRec* r = (const OutboxRec*)(s_outbox.buf + pos);
+   if (r->id == id && !(r->flags & kOutboxSent)) return true;
+   pos += outboxRecSize(r->len);
+ }
+ return false;
+}
+
+static void outboxRememberId(uint32_t id) {
+ if (!id) return;
+ s_outboxRecent[s_outboxRecentPos] = id;
+ s_outboxRecentPos = (uint8_t)((s_outboxRecentPos + 1) % kOutboxRecentIds);
+}
+
+static bool outboxPush(const void* node, const uint8_t* data, size_t len, bool binary, uint32_t id) {
+ if (sizeof(OutboxRec) + len + alignof(OutboxRec) > kOutboxBytes) return false;
+ if (!s_outbox.buf) s_outbox.buf = (uint8_t*)malloc(kOutboxBytes);
+ if (!s_outbox.buf) return false;
+
+ uint16_t need = outboxRecSize(len);
+ uint16_t pos;
+ if (s_outbox.count == 0) {
+   s_outbox.head = s_outbox.tail = 0;
+   pos = 0;
+ } else if (s_outbox.tail > s_outbox.head) {
+   // 사용 중: [head, tail). 빈 곳: [tail, 끝), [0, head)
+   if (kOutboxBytes - s_outbox.tail >= need) {
+     pos = s_outbox.tail;
+   } else if (s_outbox.head >= need) {
+     if (kOutboxBytes - s_outbox.tail >= sizeof(OutboxRec)) {
+       ((OutboxRec*)(s_outbox.buf + s_outbox.tail))->flags = kOutboxWrap;
+     }
+     pos = 0;
+   } else {
+     return false;
+   }
+ } else {
+   // wrap 됨: 빈 곳은 [tail, head)
+   if (s_outbox.head - s_outbox.tail < need) return false;
+   pos = s_outbox.tail;
+ }
+
+ OutboxRec* r = (OutboxRec*)(s_outbox.buf + pos);
+ r->node = node;
+ r->id = id;
+ r->len = (uint16_t)len;
+ r->flags = binary ? kOutboxBinary : 0;
+ r->reserved = 0;
+ uint8_t* d = (uint8_t*)(r + 1);
+ memcpy(d, data, len);
+ d[len] = '\0';  // text는 tunnelSendText에 그대로
+ s_outbox.tail = (uint16_t)(pos + need);
+ s_outbox.count++;
+ return true;
+}
+
+// 앞쪽의 보낸 record 정리
+static void outboxTrim() {
+ while (s_outbox.count) {
+   uint16_t pos = outboxAt(s_outbox.head);
+   const OutboxRec* r = (const OutboxRec*)(s_outbox.buf + pos);
+   if (!(r->flags & kOutboxSent)) {
+     s_outbox.head = pos;
+     return;
+   }
+   s_outbox.head = (uint16_t)(pos + outboxRecSize(r->len));
+   s_outbox.count--;
+ }
+ s_outbox.head = s_outbox.tail = 0;
+}
+
+#if ORBISYNC_OUTBOX_SPILL
+// record: id(4) + len(2, LE) + json. 재부팅 후에도 남음 → 다음 등록 때 전송 (읽은 위치는 RAM, 재부팅 시 처음부터)
+static const char kOutboxSpillPath[] = "/orbisync_outbox";
+static constexpr size_t kOutboxSpillHeader = 6;
+static bool s_spillPending = true;  // 부팅 직후 이전 파일 확인
+static bool s_spillMounted = false;
+static uint32_t s_spillReadPos = 0;
+
+static bool outboxSpillMount() {
+ if (!s_spillMounted) s_spillMounted = LittleFS.begin();
+ return s_spillMounted;
+}
+
+static bool outboxSpillAppend(const char* json, size_t len, uint32_t id) {
+ if (len > 0xFFFF || !outboxSpillMount()) return false;
+ File f = LittleFS.open(kOutboxSpillPath, "a");
+ if (!f) return false;
+ bool ok = false;
+ if (f.size() + kOutboxSpillHeader + len <= ORBISYNC_OUTBOX_SPILL_BYTES) {
+   uint8_t hdr[kOutboxSpillHeader];
+   memcpy(hdr, &id, 4);
+   hdr[4] = (uint8_t)(len & 0xFF);
+   hdr[5] = (uint8_t)(len >> 8);
+   ok = f.write(hdr, sizeof(hdr)) == sizeof(hdr) && f.write((const uint8_t*)json, len) == len;
+ }
+ f.close();
+ if (ok) s_spillPending = true;
+ return ok;
+}
+#endif
+
+static bool outboxSpillPending() {
+#if ORBISYNC_OUTBOX_SPILL
+ return s_spillPending;
+#else
+ return false;
+#endif
+}
+
+bool OrbiSyncNode::tunnelSendOrQueue(const uint8_t* data, size_t len, bool binary, uint32_t id) {
+ if (!cfg_.tunnelOutbox) return binary ? tunnelSendBinary(data, len) : tunnelSendText((const char*)data);
+
+ if (outboxHasId(id, false)) {
+   metrics_.tunnel.outboxDeduped++;
+   return true;
+ }
+ // 먼저 보관된 메시지가 있으면 순서를 위해 뒤에 줄 섬
+ if (!outboxPending_ && tunnelTxReady()) {
+   if (binary ? tunnelSendBinary(data, len) : tunnelSendText((const char*)data)) return true;
+ }
+ tunnelBatchToOutbox();  // 끊긴 연결에 남은 batch가 이 메시지보다 앞
+ if (!outboxPush(this, data, len, binary, id)) {
+   metrics_.tunnel.outboxDropped++;
+   ORBI_LOGW("[TUNNEL] outbox full, message dropped len=%u\n", (unsigned)len);
+   return false;
+ }
+ outboxPending_++;
+ metrics_.tunnel.outboxQueued++;
+ ORBI_LOGD("[TUNNEL] outbox queued len=%u pending=%u\n", (unsigned)len, (unsigned)outboxPending_);
+ return true;
+}
+
+bool OrbiSyncNode::tunnelBatchToOutbox() {
+ if (!cfg_.tunnelOutbox || s_link.txBatchCount == 0) return false;
+ bool ok;
+ if (s_link.txBatchCount == 1) {
+   ok = outboxPush(this, (const uint8_t*)s_link.txBatch + 1, s_link.txBatchLen - 1, false, 0);  // '[' 생략
+ } else {
+   s_link.txBatch[s_link.txBatchLen++] = ']';
+   ok = outboxPush(this, (const uint8_t*)s_link.txBatch, s_link.txBatchLen, false, 0);
+ }
+ if (ok) {
+   outboxPending_++;
+   metrics_.tunnel.outboxQueued += s_link.txBatchCount;
+ } else {
+   metrics_.tunnel.outboxDropped += s_link.txBatchCount;
+   ORBI_LOGW("[TUNNEL] outbox full, batch dropped msgs=%u\n", (unsigned)s_link.txBatchCount);
+ }
+ s_link.txBatchLen = 0;
+ s_link.txBatchCount = 0;
+ return ok;
+}
+
+void OrbiSyncNode::outboxDrain(uint8_t maxMsgs) {
+ if (!tunnelTxReady()) return;
+ uint8_t sent = 0;
+ bool failed = false;
+
+ uint16_t pos = s_outbox.head;
+ for (uint16_t i = 0; i < s_outbox.count && outboxPending_ && sent < maxMsgs; i++) {
+   pos = outboxAt(pos);
+   OutboxRec* r = (OutboxRec*)(s_outbox.buf + pos);
+   pos += outboxRecSize(r->len);
+   if (r->node != this || (r->flags & kOutboxSent)) continue;
+   if (!flowAllows(r->len)) { failed = true; break; }  // flow_credit 뒤 tunnelLoop에서 이어서
+   const uint8_t* d = (const uint8_t*)(r + 1);
+   bool ok = (r->flags & kOutboxBinary) ? tunnelSendBinary(d, r->len) : tunnelSendText((const char*)d);
+   if (!ok) { failed = true; break; }
+   r->flags |= kOutboxSent;
+   outboxRememberId(r->id);
+   outboxPending_--;
+   sent++;
+ }
+ outboxTrim();
+
+#if ORBISYNC_OUTBOX_SPILL
+ // RAM(이 노드) 다음 LittleFS. 파일은 노드 구분 없음 — 먼저 등록된 노드가 전송
+ if (!failed && !outboxPending_ && s_spillPending && sent < maxMsgs && outboxSpillMount()) {
+   File f = LittleFS.open(kOutboxSpillPath, "r");
+   bool eof = !f;
+   if (f) {
+     f.seek(s_spillReadPos);
+     while (sent < maxMsgs) {
+       uint8_t hdr[kOutboxSpillHeader];
+       if ((size_t)f.read(hdr, sizeof(hdr)) != sizeof(hdr)) { eof = true; break; }
+       size_t len = (size_t)hdr[4] | ((size_t)hdr[5] << 8);
+       if (!flowAllows(len)) break;  // 읽은 위치는 그대로 → credit 뒤 같은 record부터
+       bool heap;
+       char* buf = (char*)arenaTake(ARENA_TX_OUT, len + 1, heap);
+       if (!buf) break;
+       bool ok = (size_t)f.read((uint8_t*)buf, len) == len;
+       if (ok) {
+         buf[len] = '\0';
+         ok = tunnelSendText(buf);
+       }
+       arenaGive(buf, heap);
+       if (!ok) break;
+       uint32_t id;
+       memcpy(&id, hdr, 4);
+       outboxRememberId(id);
+       s_spillReadPos += kOutboxSpillHeader + len;
+       sent++;
+     }
+     f.close();
+   }
+   if (eof) {
+     LittleFS.remove(kOutboxSpillPath);
+     s_spillReadPos = 0;
+     s_spillPending = false;
+   }
+ }
+#else
+ (void)failed;
+#endif
+
+ if (sent) ORBI_LOGI("[TUNNEL] outbox sent=%u pending=%u\n", (unsigned)sent, (unsigned)outboxPending_);
+}
+
+bool OrbiSyncNode::sendTunnelEvent(const char* json, const char* id, bool persist) {
+ if (!json || !json[0]) return false;
+ uint32_t h = outboxIdHash(id, 0);
+#if ORBISYNC_TASK_MODE
+ // task mode: WS 송신은 network task만. 사본을 넘기고 결과는 기다리지 않음 (보관 여부는 network task가 결정)
+ if (!taskOnNetworkSide()) {
+   size_t n = strlen(json);
+   char* copy = (char*)malloc(n + 1);
+   if (!copy) return false;
+   memcpy(copy, json, n + 1);
+   TaskSendOp op = {this, copy, h, persist};
+   if (!s_taskSends.push(op)) {
+     free(copy);
+     return false;
+   }
+   return true;
+ }
+#endif
+ return tunnelEventSend(json, h, persist);
+}
+
+bool OrbiSyncNode::tunnelEventSend(const char* json, uint32_t id, bool persist) {
+ if (!cfg_.tunnelOutbox) return tunnelSendText(json);
+ if (outboxHasId(id, true)) {
+   metrics_.tunnel.outboxDeduped++;
+   return true;
+ }
+ size_t n = strlen(json);
+ uint32_t dropped = metrics_.tunnel.outboxDropped;
+ if (tunnelSendOrQueue((const uint8_t*)json, n, false, id)) {
+   outboxRememberId(id);
+   return true;
+ }
+#if ORBISYNC_OUTBOX_SPILL
+ // 토큰이 들어 있으면 플래시에 쓰지 않음 (RAM-only 정책)
+ bool secret = (sessionToken_[0] && strstr(json, sessionToken_)) || (nodeToken_[0] && strstr(json, nodeToken_));
+ if (persist && !secret && outboxSpillAppend(json, n, id)) {
+   metrics_.tunnel.outboxDropped = dropped;  // RAM에선 밀렸지만 파일에 보관됨
+   metrics_.tunnel.outboxQueued++;
+   outboxRememberId(id);
+   return true;
+ }
+#else
+ (void)persist;
+ (void)dropped;
+#endif
+ return false;
+}
+
 void OrbiSyncNode::tunnelLoop() {
  uint32_t now = millis();
 
- if (s_tunnelDisconnectPending) {
-   s_tunnelDisconnectPending = false;
-   WebSocketsClient* client = s_wsClient;
-   OrbiSyncNodeType* node = s_nodeForWs;
-   s_wsClient = nullptr;
-   s_nodeForWs = nullptr;
-   if (client) {
-     client->disconnect();
-     delete client;
-   }
-   if (node) node->tunnelDisconnectCleanup();
+ if (s_link.disconnectPending) {
+   tunnelLinkClose();
    return;
  }
 
  if (!cfg_.enableTunnel) {
-   if (now - s_lastTunnelSkipLogMs >= kTunnelStatusLogIntervalMs) {
-     s_lastTunnelSkipLogMs = now;
-     Serial.println("[TUNNEL] skip: enableTunnel=0");
+   if (now - lastTunnelSkipLogMs_ >= kTunnelStatusLogIntervalMs) {
+     lastTunnelSkipLogMs_ = now;
+     ORBI_LOGI("[TUNNEL] skip: enableTunnel=0\n");
    }
    return;
  }
  if (!tunnelUrl_[0]) {
-   if (now - s_lastTunnelSkipLogMs >= kTunnelStatusLogIntervalMs) {
-     s_lastTunnelSkipLogMs = now;
-     Serial.println("[TUNNEL] skip: no tunnel_url (session/pair/approve not returned tunnel_url)");
+   if (now - lastTunnelSkipLogMs_ >= kTunnelStatusLogIntervalMs) {
+     lastTunnelSkipLogMs_ = now;
+     ORBI_LOGI("[TUNNEL] skip: no tunnel_url (session/pair/approve not returned tunnel_url)\n");
    }
    return;
  }
  if (!nodeToken_[0] && !sessionToken_[0]) {
-   if (now - s_lastTunnelSkipLogMs >= kTunnelStatusLogIntervalMs) {
-     s_lastTunnelSkipLogMs = now;
-     Serial.println("[TUNNEL] skip: no node_token or session_token");
+   if (now - lastTunnelSkipLogMs_ >= kTunnelStatusLogIntervalMs) {
+     lastTunnelSkipLogMs_ = now;
+     ORBI_LOGI("[TUNNEL] skip: no node_token or session_token\n");
    }
    return;
  }
 
- if (s_wsClient) {
-   s_wsClient->loop();
-   if (!s_wsClient) return;
-
-   if (s_wsClient->isConnected()) {
-     if (now - s_lastTunnelStatusLogMs >= kTunnelStatusLogIntervalMs) {
-       s_lastTunnelStatusLogMs = now;
-       Serial.printf("[TUNNEL] connected=%s (registered=%d)\n", tunnelRegistered_ ? "true" : "false", tunnelRegistered_ ? 1 : 0);
+ int linkIdx = s_link.ws ? linkIndexOf(this) : -1;
+ if (linkIdx >= 0) {
+   // 연결에 있는 노드 누구든 WS를 돌림 (owner가 터널 상태가 아니어도 합류 노드가 수신 유지)
+   s_link.ws->loop();
+   if (!s_link.ws) return;
+
+   if (s_link.ws->isConnected()) {
+     tunnelPollStreams();
+     if (tunnelRegistered_ && (outboxPending_ || outboxSpillPending())) outboxDrain(kOutboxDrainBurst);
+     if (now - lastTunnelStatusLogMs_ >= kTunnelStatusLogIntervalMs) {
+       lastTunnelStatusLogMs_ = now;
+       ORBI_LOGI("[TUNNEL] connected=%s (registered=%d)\n", tunnelRegistered_ ? "true" : "false", tunnelRegistered_ ? 1 : 0);
      }
-     if (tunnelRegistered_ && (now - lastTunnelPingMs_ >= kTunnelPingIntervalMs)) {
-       StaticJsonDocument<64> pingDoc;
-       pingDoc["type"] = "ping";
-       char pingBuf[64];
-       size_t n = serializeJson(pingDoc, pingBuf, sizeof(pingBuf));
-       if (n > 0 && n < sizeof(pingBuf)) {
+     // ping과 heartbeat를 한 frame으로: heartbeat 주기가 되면 ping을 앞당겨 heartbeat를 실어 보냄
+     bool hbDue = heartbeatDue(now);
+     if (tunnelRegistered_ && (hbDue || now - lastTunnelPingMs_ >= kTunnelPingIntervalMs)) {
+       static const char kHeartbeatKey[] = ",\"heartbeat\":";
+       bool heap;
+       char* pingBuf = (char*)arenaTake(ARENA_TX_OUT, kPingBufBytes, heap);
+       if (pingBuf) {
+         // 공유 연결의 합류 노드는 node_id로 구분 (heartbeat는 노드별)
+         size_t n;
+         if (linkIdx > 0) n = (size_t)snprintf(pingBuf, kPingBufBytes, "{\"type\":\"ping\",\"node_id\":\"%s\"", nodeId_);
+         else n = (size_t)snprintf(pingBuf, kPingBufBytes, "{\"type\":\"ping\"");
+         if (hbDue) {
+           memcpy(pingBuf + n, kHeartbeatKey, sizeof(kHeartbeatKey) - 1);
+           size_t hn = buildHeartbeatJson(pingBuf + n + sizeof(kHeartbeatKey) - 1, kPingBufBytes - n - sizeof(kHeartbeatKey), now);
+           if (hn) n += sizeof(kHeartbeatKey) - 1 + hn;
+           else hbDue = false;  // 직렬화 실패 → 일반 ping
+         }
+         pingBuf[n++] = '}';
          pingBuf[n] = '\0';
          if (tunnelSendText(pingBuf)) {
            lastTunnelPingMs_ = now;
-           Serial.println("[TUNNEL] ping sent");
+           pingSentMs_ = now;
+           if (hbDue) lastHeartbeatMs_ = now;
+           ORBI_LOGD("[TUNNEL] ping sent%s len=%u\n", hbDue ? " +heartbeat" : "", (unsigned)n);
          } else {
-           Serial.println("[TUNNEL] ping send failed");
+           ORBI_LOGW("[TUNNEL] ping send failed\n");
          }
+         arenaGive(pingBuf, heap);
        }
      }
    }
@@ -1539,8 +3648,19 @@ void OrbiSyncNode::tunnelLoop() {
 
  if (now < nextTunnelConnectMs_) return;
 
- Serial.printf("[TUNNEL] start attempt state=%s heap=%u millis=%lu\n", stateStr(state_), (unsigned)ESP.getFreeHeap(), (unsigned long)now);
- Serial.printf("[TUNNEL] reconnect: node_id=%s tunnel_id=%s\n", nodeId_[0] ? nodeId_ : "(none)", tunnelId_[0] ? tunnelId_ : "(none)");
+ // 다른 노드가 연 연결: 합류하거나(tunnelMultiplex) 연결이 닫힐 때까지 대기
+ if (s_link.ws) {
+   if (tunnelLinkJoin()) return;
+   nextTunnelConnectMs_ = now + kTunnelBackoffMs[0];
+   if (now - lastTunnelSkipLogMs_ >= kTunnelStatusLogIntervalMs) {
+     lastTunnelSkipLogMs_ = now;
+     ORBI_LOGI("[TUNNEL] skip: link in use by another node (multiplex=%d)\n", cfg_.tunnelMultiplex ? 1 : 0);
+   }
+   return;
+ }
+
+ ORBI_LOGI("[TUNNEL] start attempt state=%s heap=%u millis=%lu\n", stateStr(state_), (unsigned)ESP.getFreeHeap(), (unsigned long)now);
+ ORBI_LOGI("[TUNNEL] reconnect: node_id=%s tunnel_id=%s\n", nodeId_[0] ? nodeId_ : "(none)", tunnelId_[0] ? tunnelId_ : "(none)");
  setState(State::TUNNEL_CONNECTING);
  tunnelConnect();
  nextTunnelConnectMs_ = now + tunnelBackoffMs_;
@@ -1548,63 +3668,70 @@ void OrbiSyncNode::tunnelLoop() {
 
 /// WebSocket 연결 시작 (wss://hub.orbisync.io/ws/tunnel)
 void OrbiSyncNode::tunnelConnect() {
- if (s_wsClient) return;
+ if (s_link.ws) return;
 
  const char* url = tunnelUrl_;
  if (!url || !url[0]) return;
 
+ // WS/TLS client보다 먼저 확보 (heap이 쪼개지기 전에 큰 블록 하나)
+ tunnelArenaReserve();
+ if (cfg_.tunnelBatchFrames && !s_link.txBatch) s_link.txBatch = (char*)malloc(limits::kTunnelBatchBytes);
+
  const char* auth = sessionToken_[0] ? sessionToken_ : nullptr;
  if (!auth || !auth[0]) {
-   Serial.println("[TUNNEL] skip connect: session_token empty (run approve first)");
-   nextTunnelConnectMs_ = millis() + 3000;
+   ORBI_LOGW("[TUNNEL] skip connect: session_token empty (run approve first)\n");
+   nextTunnelConnectMs_ = jitterAt(3000);
    nextApproveMs_ = 0;
    return;
  }
 
- bool ssl = (strncmp(url, "wss://", 6) == 0);
- if (!ssl && strncmp(url, "ws://", 5) != 0) {
-   Serial.printf("[TUNNEL] invalid URL scheme: %s (expected wss:// or ws://)\n", url);
+ if (strncmp(url, "wss://", 6) != 0 && strncmp(url, "ws://", 5) != 0) {
+   ORBI_LOGE("[TUNNEL] invalid URL scheme: %s (expected wss:// or ws://)\n", url);
    return;
  }
 
- const char* hostStart = ssl ? url + 6 : url + 5;
- const char* pathStart = strchr(hostStart, '/');
- if (!pathStart) pathStart = "/";
-
- char host[128];
- size_t hostLen = (size_t)(pathStart - hostStart);
- if (hostLen >= sizeof(host)) hostLen = sizeof(host) - 1;
- memcpy(host, hostStart, hostLen);
- host[hostLen] = '\0';
-
- uint16_t port = ssl ? 443 : 80;
+ ParsedBaseUrl u;
+ if (!parseBaseUrl(url, u)) {
+   ORBI_LOGE("[TUNNEL] invalid URL: %s\n", url);
+   return;
+ }
+ const bool ssl = u.useTls;
+ const char* host = u.host;
+ const uint16_t port = u.port;
+ const char* pathStart = u.basePath[0] ? u.basePath : "/";
 
  // Validate path (must be /ws/tunnel)
  if (strcmp(pathStart, "/ws/tunnel") != 0) {
-   Serial.printf("[TUNNEL] WARNING: path=%s (expected /ws/tunnel)\n", pathStart);
- }
-
- Serial.println("========================================");
- Serial.println("[TUNNEL] WebSocket Handshake Debug");
- Serial.println("========================================");
- Serial.printf("URL: %s\n", url);
- Serial.printf("Host: %s\n", host);
- Serial.printf("Port: %u\n", port);
- Serial.printf("Path: %s\n", pathStart);
- Serial.printf("SSL/TLS: %s\n", ssl ? "YES (wss://)" : "NO (ws://)");
- Serial.println("----------------------------------------");
- Serial.println("Expected HTTP Upgrade Request:");
- Serial.printf("GET %s HTTP/1.1\r\n", pathStart);
- Serial.printf("Host: %s\r\n", host);
- Serial.println("Connection: Upgrade");
- Serial.println("Upgrade: websocket");
- Serial.println("Sec-WebSocket-Key: <base64-random>");
- Serial.println("Sec-WebSocket-Version: 13");
- Serial.printf("Authorization: Bearer <token>\r\n");
- Serial.println("========================================");
-
- s_wsClient = new WebSocketsClient();
- s_nodeForWs = this;
+   ORBI_LOGW("[TUNNEL] WARNING: path=%s (expected /ws/tunnel)\n", pathStart);
+ }
+
+ ORBI_LOGD("========================================\n");
+ ORBI_LOGD("[TUNNEL] WebSocket Handshake Debug\n");
+ ORBI_LOGD("========================================\n");
+ ORBI_LOGD("URL: %s\n", url);
+ ORBI_LOGD("Host: %s\n", host);
+ ORBI_LOGD("Port: %u\n", port);
+ ORBI_LOGD("Path: %s\n", pathStart);
+ ORBI_LOGD("SSL/TLS: %s\n", ssl ? "YES (wss://)" : "NO (ws://)");
+ ORBI_LOGD("----------------------------------------\n");
+ ORBI_LOGD("Expected HTTP Upgrade Request:\n");
+ ORBI_LOGD("GET %s HTTP/1.1\r\n", pathStart);
+ ORBI_LOGD("Host: %s\r\n", host);
+ ORBI_LOGD("Connection: Upgrade\n");
+ ORBI_LOGD("Upgrade: websocket\n");
+ ORBI_LOGD("Sec-WebSocket-Key: <base64-random>\n");
+ ORBI_LOGD("Sec-WebSocket-Version: 13\n");
+ ORBI_LOGD("Authorization: Bearer <token>\r\n");
+ ORBI_LOGD("========================================\n");
+
+ metrics_.tunnel.connects++;
+ s_link.ws = wsClientAcquire();
+ if (!s_link.ws) {
+   ORBI_LOGE("[TUNNEL] ERROR: WebSocket client alloc failed\n");
+   return;
+ }
+ s_link.nodeCount = 0;
+ linkAdd(this, cfg_.slotId);
 
  // Enable debug mode if available (Links2004 WebSocketsClient may support this)
  // Note: Some versions use enableHeartbeat() or setReconnectInterval() for keepalive
@@ -1617,59 +3744,160 @@ void OrbiSyncNode::tunnelConnect() {
    // Links2004 WebSocketsClient uses WiFiClientSecure internally
    // For ESP32: WiFiClientSecure defaults to insecure if no CA is set
    // For ESP8266: BearSSL needs explicit setInsecure() - but we can't access it here
-   Serial.println("[TUNNEL] Calling beginSSL() - TLS handshake will start");
-   s_wsClient->beginSSL(host, port, pathStart);
+   ORBI_LOGD("[TUNNEL] Calling beginSSL() - TLS handshake will start\n");
+   s_link.ws->beginSSL(host, port, pathStart);
  } else {
-   Serial.println("[TUNNEL] Calling begin() - non-TLS connection");
-   s_wsClient->begin(host, port, pathStart);
+   ORBI_LOGD("[TUNNEL] Calling begin() - non-TLS connection\n");
+   s_link.ws->begin(host, port, pathStart);
+ }
+
+ // resume token: upgrade 요청에 실으면 Hub가 이전 등록을 이어받음 (register 왕복 생략)
+ // begin()이 extra header를 기본값(Origin)으로 되돌리므로 그 뒤에 설정
+ resumePresented_ = false;
+ if (resumeToken_[0] && (!resumeExpiresMs_ || (int32_t)(resumeExpiresMs_ - millis()) > 0)) {
+   char extra[176];
+   int en = snprintf(extra, sizeof(extra), "Origin: file://\r\nX-OrbiSync-Resume: %s", resumeToken_);
+   if (en > 0 && (size_t)en < sizeof(extra)) {
+     s_link.ws->setExtraHeaders(extra);
+     resumePresented_ = true;
+     ORBI_LOGD("[TUNNEL] resume token presented\n");
+   }
  }
 
  // Set authorization header BEFORE onEvent (order matters)
- char authHeader[320];
+ char authHeader[limits::kTokenBytes + 16];
  int ahLen = snprintf(authHeader, sizeof(authHeader), "Bearer %s", auth);
  if (ahLen > 0 && (size_t)ahLen < sizeof(authHeader)) {
-   s_wsClient->setAuthorization(authHeader);
+   s_link.ws->setAuthorization(authHeader);
    // DEBUG ONLY: full token logging (remove in production)
    logTokenPrefix("[TUNNEL] auth_header_set=1", auth);
-   Serial.printf("[TUNNEL] Authorization header length: %d bytes\n", ahLen);
-   Serial.printf("[TUNNEL] Authorization header: %s\n", authHeader);
+   ORBI_LOGD("[TUNNEL] Authorization header length: %d bytes\n", ahLen);
+   ORBI_LOGV("[TUNNEL] Authorization header: %s\n", authHeader);
  } else {
-   Serial.println("[TUNNEL] ERROR: auth_header_set=0 (buffer fail)");
-   Serial.printf("[TUNNEL] Token length: %zu, Buffer size: %zu\n", strlen(auth), sizeof(authHeader));
+   ORBI_LOGE("[TUNNEL] ERROR: auth_header_set=0 (buffer fail)\n");
+   ORBI_LOGE("[TUNNEL] Token length: %zu, Buffer size: %zu\n", strlen(auth), sizeof(authHeader));
  }
 
  // Set event callback
- s_wsClient->onEvent(wsEvent);
+ s_link.ws->onEvent(wsEvent);
 
- Serial.printf("[TUNNEL] WebSocket client initialized\n");
- Serial.printf("[TUNNEL] SNI/Host=%s (should match hub.orbisync.io)\n", host);
- Serial.println("[TUNNEL] Waiting for connection result...");
- Serial.println("========================================");
+ ORBI_LOGD("[TUNNEL] WebSocket client initialized\n");
+ ORBI_LOGD("[TUNNEL] SNI/Host=%s (should match hub.orbisync.io)\n", host);
+ ORBI_LOGD("[TUNNEL] Waiting for connection result...\n");
+ ORBI_LOGD("========================================\n");
 }
 
-void OrbiSyncNode::tunnelDisconnectCleanup() {
+void OrbiSyncNode::tunnelOnConnected() {
+ if (!resumePresented_) {
+   ORBI_LOGD("[TUNNEL] Sending register message...\n");
+   tunnelSendRegister();
+   return;
+ }
+ // Hub가 upgrade에서 resume token을 확인함 → register 없이 활성 (거절이면 resume_ack/register_ack error)
+ emitTunnelChange(true);
+ metrics_.tunnel.resumes++;
+ ORBI_LOGI("[TUNNEL] resumed without register\n");
+ tunnelMarkRegistered();
+}
+
+void OrbiSyncNode::tunnelMarkRegistered() {
+ tunnelRegistered_ = true;
+ tunnelFastRetryUsed_ = false;
+ tunnelBackoffIndex_ = 0;
+ tunnelBackoffMs_ = kTunnelBackoffMs[0];
+ setState(State::TUNNEL_CONNECTED);
+ lastTunnelPingMs_ = millis();
+ ORBI_LOGI("[TUNNEL] connected=true (registered=1)\n");
+ if (outboxPending_ || outboxSpillPending()) outboxDrain(kOutboxDrainBurst);  // 끊긴 동안 보관한 메시지 먼저
+ if (cfg_.memoryReport && memoryReportStage_ == 1) {
+   memoryReportStage_ = 2;  // TLS/WS handshake까지 지난 stack peak
+   logMemoryBudget();
+ }
+}
+
+void OrbiSyncNode::tunnelResumeRejected(const char* reason) {
+ ORBI_LOGW("[TUNNEL] resume rejected reason=%s -> full register\n", reason);
+ resumePresented_ = false;
  tunnelRegistered_ = false;
- if (tunnelChangeCb_) tunnelChangeCb_(false, tunnelUrl_[0] ? tunnelUrl_ : "");
+ setState(State::TUNNEL_CONNECTING);
+ tunnelSendRegister();
+}
+
+void OrbiSyncNode::tunnelDisconnectCleanup(bool graceful) {
+ metrics_.tunnel.disconnects++;
+ pingSentMs_ = 0;
+ // resume token으로 열다가 활성 전에 끊김 → Hub가 token을 거절했을 수 있으니 다음은 전체 register
+ if (resumePresented_ && !tunnelRegistered_) resumeToken_[0] = '\0';
+ tunnelRegistered_ = false;
+ resumePresented_ = false;
+ tunnelReleaseStreams();
+ emitTunnelChange(false);
 
  if (state_ == State::TUNNEL_CONNECTING || state_ == State::TUNNEL_CONNECTED) {
    setState(State::ACTIVE);
  }
 
+ // Hub rolling deploy 등 정상 종료: 한 번은 바로 재연결, 실패하면 첫 단계부터 backoff
+ if (graceful && !tunnelFastRetryUsed_) {
+   tunnelFastRetryUsed_ = true;
+   tunnelBackoffIndex_ = 0;
+   tunnelBackoffMs_ = kTunnelBackoffMs[0];
+   nextTunnelConnectMs_ = millis();
+   metrics_.tunnel.fastRetries++;
+   ORBI_LOGI("[TUNNEL] graceful close -> reconnect now\n");
+   return;
+ }
+
  if (tunnelBackoffIndex_ < kTunnelBackoffSteps - 1) tunnelBackoffIndex_++;
- tunnelBackoffMs_ = kTunnelBackoffMs[tunnelBackoffIndex_];
+ tunnelBackoffMs_ = decorrelatedJitter(tunnelBackoffMs_, kTunnelBackoffMs[0], kTunnelBackoffMs[kTunnelBackoffSteps - 1]);
  nextTunnelConnectMs_ = millis() + tunnelBackoffMs_;
- Serial.printf("[TUNNEL] fail disconnected backoff=%ums step=%u\n", (unsigned)tunnelBackoffMs_, (unsigned)tunnelBackoffIndex_);
+ ORBI_LOGI("[TUNNEL] fail disconnected backoff=%ums step=%u\n", (unsigned)tunnelBackoffMs_, (unsigned)tunnelBackoffIndex_);
 }
 
-void OrbiSyncNode::tunnelDisconnect() {
- WebSocketsClient* client = s_wsClient;
- s_wsClient = nullptr;
- s_nodeForWs = nullptr;
+void OrbiSyncNode::tunnelLinkClose() {
+ WebSocketsClient* client = s_link.ws;
+ OrbiSyncNodeType* nodes[ORBISYNC_TUNNEL_MAX_NODES];
+ uint8_t count = s_link.nodeCount;
+ memcpy(nodes, s_link.nodes, sizeof(nodes));
+ if (count) nodes[0]->tunnelBatchToOutbox();
+ bool graceful = s_link.gracefulClose;
+ s_link.ws = nullptr;
+ s_link.nodeCount = 0;
+ s_link.disconnectPending = false;
+ s_link.gracefulClose = false;
+ s_link.txBatchLen = 0;  // 끊긴 연결의 미전송 batch는 버림
+ s_link.txBatchCount = 0;
+ s_link.flowWindow = 0;  // 다음 연결의 register_ack가 다시 알려줌
+ s_link.flowOutstanding = 0;
+
+ wsClientRelease(client);
+ for (uint8_t i = 0; i < count; i++) nodes[i]->tunnelDisconnectCleanup(graceful);
+}
+
+bool OrbiSyncNode::tunnelLinkJoin() {
+ OrbiSyncNodeType* owner = s_link.nodeCount ? s_link.nodes[0] : nullptr;
+ if (!owner || !cfg_.tunnelMultiplex || !owner->cfg_.tunnelMultiplex) return false;
+ if (strcmp(owner->tunnelUrl_, tunnelUrl_) != 0) return false;
+ // owner 등록이 끝난 연결에만 (Hub가 연결 인증을 마친 뒤)
+ if (!s_link.ws->isConnected() || !owner->tunnelRegistered_) return false;
+ if (s_link.nodeCount >= ORBISYNC_TUNNEL_MAX_NODES) return false;
+ if (!sessionToken_[0]) return false;
+
+ linkAdd(this, cfg_.slotId);
+ ORBI_LOGI("[TUNNEL] join shared link node_id=%s slot=%s nodes=%u\n",
+   nodeId_[0] ? nodeId_ : "(none)", cfg_.slotId ? cfg_.slotId : "", (unsigned)s_link.nodeCount);
+ setState(State::TUNNEL_CONNECTING);
+ tunnelSendRegister();
+ return true;
+}
 
- if (client) {
-   client->disconnect();
-   delete client;
+void OrbiSyncNode::tunnelDisconnect() {
+ int idx = linkIndexOf(this);
+ if (idx == 0) {
+   tunnelLinkClose();  // owner: 공유 연결 전체 종료
+   return;
  }
+ linkRemove(idx);      // 합류 노드: 연결은 두고 이 노드만 빠짐
  tunnelDisconnectCleanup();
 }
 
@@ -1679,44 +3907,141 @@ void OrbiSyncNode::setSessionToken(const char* token) {
  sessionToken_[sizeof(sessionToken_) - 1] = '\0';
 }
 
-bool OrbiSyncNode::tunnelSendText(const char* text) {
- if (!s_wsClient || !s_wsClient->isConnected() || !text) return false;
- return s_wsClient->sendTXT(text);
+bool OrbiSyncNode::tunnelTxReady() const {
+ return tunnelTapCb_ || (s_link.ws && linkIndexOf(this) >= 0 && s_link.ws->isConnected());
 }
 
-void OrbiSyncNode::tunnelSendRegister() {
- if (!s_wsClient || !s_wsClient->isConnected()) return;
- if (tunnelChangeCb_) tunnelChangeCb_(true, tunnelUrl_[0] ? tunnelUrl_ : "");
+bool OrbiSyncNode::tunnelWriteFrame(const uint8_t* data, size_t len, bool binary) {
+ metrics_.tunnel.txFrames++;
+ metrics_.tunnel.txBytes += len;
+ bool ok;
+ if (tunnelTapCb_) ok = tunnelTapCb_(data, len, binary);
+ else ok = binary ? s_link.ws->sendBIN(data, len) : s_link.ws->sendTXT(data, len);
+ // flow window: 모든 송신 frame (ping/이벤트 포함)을 Hub가 읽어야 credit으로 돌아옴
+ if (ok && s_link.flowWindow) {
+   if (!s_link.flowOutstanding) s_link.flowLastCreditMs = millis();
+   s_link.flowOutstanding += (uint32_t)len;
+ }
+ return ok;
+}
 
- /// Hub에 register 요청 전송 (터널 등록)
- // /ws/tunnel registry: auth_token 필수(세션 토큰)
- if (!sessionToken_[0]) {
-   Serial.println("[TUNNEL] register skip: session_token empty");
+bool OrbiSyncNode::tunnelFlushBatch() {
+ if (s_link.txBatchCount == 0) return true;
+ bool ok;
+ if (s_link.txBatchCount == 1) {
+   ok = tunnelWriteFrame((const uint8_t*)s_link.txBatch + 1, s_link.txBatchLen - 1, false);  // '[' 생략
+ } else {
+   s_link.txBatch[s_link.txBatchLen++] = ']';
+   ok = tunnelWriteFrame((const uint8_t*)s_link.txBatch, s_link.txBatchLen, false);
+   metrics_.tunnel.batchedMsgs += s_link.txBatchCount;
+   if (!ok) s_link.txBatchLen--;  // ']' 제거 (outbox로 옮길 때 다시 붙임)
+ }
+ if (!ok && tunnelBatchToOutbox()) return true;
+ if (!ok) ORBI_LOGW("[TUNNEL] batch send failed msgs=%u len=%u\n", (unsigned)s_link.txBatchCount, (unsigned)s_link.txBatchLen);
+ s_link.txBatchLen = 0;
+ s_link.txBatchCount = 0;
+ return ok;
+}
+
+void OrbiSyncNode::tunnelBatchTick(uint32_t now) {
+ if (s_link.txBatchCount == 0) return;
+ if (!tunnelTapCb_ && linkIndexOf(this) < 0) return;  // 공유 batch: 연결에 있는 노드만 flush/폐기
+ if (!tunnelTxReady()) {
+   tunnelBatchToOutbox();
+   s_link.txBatchLen = 0;
+   s_link.txBatchCount = 0;
    return;
  }
+ if (cfg_.tunnelBatchMaxDelayMs && (now - s_link.txBatchFirstMs) < cfg_.tunnelBatchMaxDelayMs) return;
+ tunnelFlushBatch();
+}
+
+bool OrbiSyncNode::tunnelSendText(const char* text) {
+ if (!text || !tunnelTxReady()) return false;
+ size_t n = strlen(text);
 
+ // register_ack 전에는 Hub가 batch를 모름 → 단독 frame
+ if (!s_link.txBatch || !cfg_.tunnelBatchFrames || !tunnelRegistered_ || n + 2 > limits::kTunnelBatchBytes) {
+   if (!tunnelFlushBatch()) return false;
+   return tunnelWriteFrame((const uint8_t*)text, n, false);
+ }
+ // '[' 또는 ',' + 메시지 + 닫는 ']' 자리
+ if (s_link.txBatchLen + 1 + n + 1 > limits::kTunnelBatchBytes || s_link.txBatchCount == 0xFF) tunnelFlushBatch();
+ if (s_link.txBatchCount == 0) s_link.txBatchFirstMs = millis();
+ s_link.txBatch[s_link.txBatchLen++] = s_link.txBatchCount ? ',' : '[';
+ memcpy(s_link.txBatch + s_link.txBatchLen, text, n);
+ s_link.txBatchLen += n;
+ s_link.txBatchCount++;
+ return true;
+}
+
+bool OrbiSyncNode::tunnelSendBinary(const uint8_t* data, size_t len) {
+ if (!data || !tunnelTxReady()) return false;
+ tunnelFlushBatch();  // 순서 유지
+ return tunnelWriteFrame(data, len, true);
+}
+
+void OrbiSyncNode::injectTunnelFrame(uint8_t* payload, size_t len, bool binary) {
+ if (binary) tunnelHandleBinaryMessage(payload, len);
+ else tunnelHandleMessage(payload, len);
+}
+
+// register frame 템플릿: 닫는 '}' 없는 prefix (Config/MAC 기반 필드만)
+
+bool OrbiSyncNode::buildRegisterTemplate() {
  char machineId[80];
  getMachineId(machineId, sizeof(machineId));
 
- StaticJsonDocument<512> doc;
+ StaticJsonDocument<384> doc;
  doc["type"] = "register";
- if (nodeId_[0]) doc["node_id"] = nodeId_;
  doc["slot_id"] = cfg_.slotId && cfg_.slotId[0] ? cfg_.slotId : "";
  doc["machine_id"] = machineId;
  doc["mac"] = getMacCStr();
  doc["firmware"] = (cfg_.firmwareVersion && cfg_.firmwareVersion[0]) ? cfg_.firmwareVersion : "1.0.0";
- doc["auth_token"] = sessionToken_;
+ if (cfg_.tunnelStreamResponses) doc["stream_responses"] = true;  // proxy_response_chunk 사용 알림
+ // binary frame에는 node_id가 없어 공유 연결의 합류 노드는 JSON frame만 받음
+ bool joined = linkIndexOf(this) > 0;
+ if (cfg_.tunnelBinaryFrames && !joined) doc["binary_frames"] = kBinFrameVersion; // binary 요청 수신 가능
+ if (cfg_.tunnelBatchFrames) doc["batch_frames"] = true;  // JSON 배열 frame 송수신
+ doc["flow_control"] = true;  // register_ack flow_window → flow_credit으로 송신 조절
+
+ size_t n = serializeJson(doc, tpl_.reg, sizeof(tpl_.reg));
+ if (n < 2 || n >= sizeof(tpl_.reg)) return false;
+ tpl_.reg[--n] = '\0';  // '}' 제거
+ tpl_.registerLen = (uint16_t)n;
+ tpl_.registerJoined = joined;
+ return true;
+}
+
+void OrbiSyncNode::tunnelSendRegister() {
+ if (!tunnelTxReady()) return;
+ emitTunnelChange(true);
+
+ /// Hub에 register 요청 전송 (터널 등록)
+ // /ws/tunnel registry: auth_token 필수(세션 토큰)
+ if (!sessionToken_[0]) {
+   ORBI_LOGW("[TUNNEL] register skip: session_token empty\n");
+   return;
+ }
+
+ bool stale = !tpl_.registerLen || tpl_.registerJoined != (linkIndexOf(this) > 0);
+ if (stale && !buildRegisterTemplate()) return;
 
- char buf[512];
- size_t n = serializeJson(doc, buf, sizeof(buf));
- if (n == 0 || n >= sizeof(buf)) return;
+ // 고정 부분 복사 + 세션마다 바뀌는 node_id/auth_token만 추가
+ char buf[sizeof(tpl_.reg) + limits::kTokenBytes + 64];
+ size_t n = tpl_.registerLen;
+ memcpy(buf, tpl_.reg, n + 1);
+ if (nodeId_[0] && !payloadAppendStr(buf, sizeof(buf) - 1, n, "node_id", nodeId_)) return;
+ if (!payloadAppendStr(buf, sizeof(buf) - 1, n, "auth_token", sessionToken_)) return;
+ buf[n++] = '}';
  buf[n] = '\0';
 
- Serial.print("[TUNNEL] register payload: ");
- Serial.println(buf);
+ // buf에는 auth_token(세션 토큰)이 있음 → DEBUG는 고정 부분만, 전체는 VERBOSE
+ ORBI_LOGD("[TUNNEL] register payload: %s,...}\n", tpl_.reg);
+ ORBI_LOGV("[TUNNEL] register payload (full): %s\n", buf);
 
  bool ok = tunnelSendText(buf);
- Serial.printf("[TUNNEL] register sent ok=%d\n", ok ? 1 : 0);
+ ORBI_LOGI("[TUNNEL] register sent ok=%d\n", ok ? 1 : 0);
 }
 
 // ---- WebSocket 메시지 핸들러 ----
@@ -1725,15 +4050,119 @@ void OrbiSyncNode::tunnelHandleMessage(const char* payload) {
  tunnelHandleMessage((const uint8_t*)payload, strlen(payload));
 }
 
+// 수신 frame은 한 번만 파싱하고 핸들러가 같은 문서를 사용 (stack 대신 static, 재파싱 없음)
+static StaticJsonDocument<limits::kTunnelRxDocBytes> s_tunnelRxDoc;
+static const uint8_t* s_tunnelRxPayload = nullptr;
+static JsonObject s_tunnelRxMsg;  // 현재 처리 중인 메시지 (batch frame이면 배열 원소)
+
 /// Hub → Node 메시지 처리 (HTTP_REQ, register_ack, RPC 등)
 void OrbiSyncNode::tunnelHandleMessage(const uint8_t* payload, size_t len) {
  if (!payload || len == 0) return;
 
- // JSON 파싱 (복사 없음)
- StaticJsonDocument<1536> peek;
- DeserializationError err = deserializeJson(peek, payload, len);
+ metrics_.tunnel.rxFrames++;
+ metrics_.tunnel.rxBytes += len;
+ uint32_t t0 = micros();
+ DeserializationError err = deserializeJson(s_tunnelRxDoc, payload, len);
+ metrics_.tunnel.parseUs.record(micros() - t0);
  if (err) {
-   Serial.printf("[TUNNEL] rx parse err len=%u\n", (unsigned)len);
+   ORBI_LOGW("[TUNNEL] rx parse err=%s len=%u doc=%u\n", err.c_str(), (unsigned)len, (unsigned)sizeof(s_tunnelRxDoc));
+   if (err == DeserializationError::NoMemory) tunnelRejectOversized(payload, len);
+   return;
+ }
+
+ s_tunnelRxPayload = payload;
+ if (s_tunnelRxDoc.is<JsonArray>()) {
+   // batch frame: [msg, msg, ...] → 원소마다 같은 경로로 처리 (문서는 하나, 재파싱 없음)
+   for (JsonObject m : s_tunnelRxDoc.as<JsonArray>()) {
+     s_tunnelRxMsg = m;
+     tunnelDispatchMessage(payload, len);
+   }
+ } else {
+   s_tunnelRxMsg = s_tunnelRxDoc.as<JsonObject>();
+   tunnelDispatchMessage(payload, len);
+ }
+ s_tunnelRxMsg = JsonObject();
+ s_tunnelRxPayload = nullptr;
+}
+
+/// JSON "headers" 객체 → view (문자열은 s_tunnelRxDoc 안, 복사 없음)
+static void collectJsonHeaders(TunnelHttpRequest& req, JsonObject headers) {
+ if (!headers) return;
+ for (JsonPair p : headers) {
+   JsonString k = p.key();
+   JsonString v = p.value().as<JsonString>();
+   if (!k.c_str() || !v.c_str()) continue;
+   if (!req.addHeader(k.c_str(), k.size(), v.c_str(), v.size())) {
+     ORBI_LOGD("[TUNNEL] headers > %u, rest ignored\n", (unsigned)TUNNEL_MAX_HEADERS);
+     break;
+   }
+ }
+}
+
+/// frame이 ORBISYNC_TUNNEL_RX_DOC_SIZE를 넘을 때: 식별 필드만 filter 파싱해서 413 응답
+void OrbiSyncNode::tunnelRejectOversized(const uint8_t* payload, size_t len) {
+ StaticJsonDocument<64> filter;
+ filter["type"] = true;
+ filter["stream_id"] = true;
+ filter["request_id"] = true;
+ filter["req_id"] = true;
+
+ StaticJsonDocument<256> ids;
+ if (deserializeJson(ids, payload, len, DeserializationOption::Filter(filter))) return;
+
+ const char* type = ids["type"] | "";
+ if (strcmp(type, "proxy_request") == 0) {
+   TunnelHttpResponseWriter* res =
+       tunnelAcquireStream(ids["request_id"] | ids["req_id"] | "", TunnelHttpResponseWriter::kFormatProxy, false, false);
+   if (!res) return;
+   res->setStatus(413);
+   res->setHeader("Content-Type", "text/plain");
+   res->write("Payload Too Large");
+   res->end();
+ } else if (strcmp(type, "HTTP_REQ") == 0) {
+   const char* streamId = ids["stream_id"] | "";
+   if (!streamId[0]) return;
+   StaticJsonDocument<256> errDoc;
+   errDoc["type"] = "HTTP_RES";
+   errDoc["stream_id"] = streamId;
+   errDoc["status"] = 413;
+   JsonObject errHeaders = errDoc.createNestedObject("headers");
+   errHeaders["content-type"] = "text/plain";
+   errDoc["body"] = "Payload Too Large";
+   char errBuf[256];
+   size_t errLen = serializeJson(errDoc, errBuf, sizeof(errBuf));
+   if (errLen > 0 && errLen < sizeof(errBuf)) {
+     errBuf[errLen] = '\0';
+     tunnelSendOrQueue((const uint8_t*)errBuf, errLen, false, outboxIdHash(streamId, 0));
+   }
+ }
+}
+
+// 공유 연결: frame의 node_id(없으면 slot_id)와 일치하는 노드. 못 찾으면 nullptr (→ 받은 노드가 처리)
+static OrbiSyncNodeType* linkRouteFor(JsonObject msg) {
+ if (s_link.nodeCount < 2) return nullptr;
+ const char* nid = msg["node_id"] | "";
+ if (nid[0]) {
+   for (uint8_t i = 0; i < s_link.nodeCount; i++) {
+     if (strcmp(s_link.nodes[i]->getNodeId(), nid) == 0) return s_link.nodes[i];
+   }
+ }
+ const char* slot = msg["slot_id"] | "";
+ if (slot[0]) {
+   for (uint8_t i = 0; i < s_link.nodeCount; i++) {
+     if (s_link.slots[i] && strcmp(s_link.slots[i], slot) == 0) return s_link.nodes[i];
+   }
+ }
+ return nullptr;
+}
+
+void OrbiSyncNode::tunnelDispatchMessage(const uint8_t* payload, size_t len) {
+ JsonObject peek = s_tunnelRxMsg;
+ if (peek.isNull()) return;
+
+ OrbiSyncNodeType* target = linkRouteFor(peek);
+ if (target && target != this) {
+   target->tunnelDispatchMessage(payload, len);
    return;
  }
 
@@ -1742,44 +4171,107 @@ void OrbiSyncNode::tunnelHandleMessage(const uint8_t* payload, size_t len) {
    const char* method = peek["method"] | "GET";
    const char* path = peek["path"] | "/";
    JsonVariant bodyV = peek["body"];
+
+   char idBuf[24];
+   bool idNumeric = !peek["id"].is<const char*>();
+   const char* id = peek["id"].as<const char*>();
+   if (idNumeric) {
+     snprintf(idBuf, sizeof(idBuf), "%ld", peek["id"].as<long>());
+     id = idBuf;
+   }
+   TunnelHttpResponseWriter* slot = tunnelAcquireStream(id, TunnelHttpResponseWriter::kFormatRpc, false, idNumeric);
+   if (!slot) return;
+   TunnelHttpResponseWriter& res = *slot;
+
+   // body: 객체/배열은 JSON 텍스트로, 문자열은 그대로
+   char bodyBuf[384];
+   const uint8_t* body = nullptr;
    size_t bodyLen = 0;
-   if (bodyV.is<JsonObject>() || bodyV.is<JsonArray>()) bodyLen = measureJson(bodyV);
-   else if (bodyV.is<const char*>()) bodyLen = strlen(bodyV.as<const char*>());
- 
-   if (peek["id"].is<const char*>()) {
-     Serial.printf("[HTTP_TUNNEL] id=%s method=%s path=%s body_len=%u\n", peek["id"].as<const char*>(), method, path, (unsigned)bodyLen);
-   } else {
-     Serial.printf("[HTTP_TUNNEL] id=%ld method=%s path=%s body_len=%u\n", peek["id"].as<long>(), method, path, (unsigned)bodyLen);
-   }
- 
-   bool isLedOn = (strcmp(path, "/led/on") == 0) || (strstr(path, "led/on") != nullptr);
-   int value = 1;
-   if (bodyV.is<JsonObject>()) value = bodyV["value"] | 1;
- 
-   if (isLedOn && cfg_.ledPin >= 0) {
-     digitalWrite(cfg_.ledPin, value ? LOW : HIGH);
-   }
- 
-   StaticJsonDocument<384> resp;
-   if (peek["id"].is<const char*>()) resp["id"] = peek["id"].as<const char*>();
-   else resp["id"] = peek["id"].as<long>();
-   resp["status"] = 200;
-   JsonObject b = resp.createNestedObject("body");
-   b["ok"] = true;
-   if (isLedOn) b["value"] = value ? 1 : 0;
- 
-   char out[512];
-   size_t n = serializeJson(resp, out, sizeof(out));
-   if (n > 0 && n < sizeof(out)) {
-     out[n] = '\0';
-     tunnelSendText(out);
+   if (bodyV.is<JsonObject>() || bodyV.is<JsonArray>()) {
+     bodyLen = serializeJson(bodyV, bodyBuf, sizeof(bodyBuf));
+     if (bodyLen >= sizeof(bodyBuf)) {
+       res.setStatus(413);
+       res.write("{\"ok\":false,\"error\":\"payload_too_large\"}");
+       res.end();
+       return;
+     }
+     body = (const uint8_t*)bodyBuf;
+   } else if (bodyV.is<const char*>()) {
+     body = (const uint8_t*)bodyV.as<const char*>();
+     bodyLen = strlen((const char*)body);
    }
+
+   ORBI_LOGD("[HTTP_TUNNEL] id=%s method=%s path=%s body_len=%u\n", res.requestId_, method, path, (unsigned)bodyLen);
+
+   TunnelHttpRequest req = {};
+   req.requestId = res.requestId_;
+   req.streamId = res.requestId_;
+   req.tunnelId = nodeId_;
+   req.method = method;
+   req.path = path;
+   req.query = "";
+   req.body = body;
+   req.bodyLen = bodyLen;
+
+   tunnelServeHttpRequest(req, res);
    return;
  }
 
  const char* type = peek["type"] | "";
  if (!type[0]) return;
 
+ // command push (터널 등록 중에는 poll 대신 Hub가 바로 보냄)
+ if (strcmp(type, "command") == 0 || strcmp(type, "commands") == 0) {
+   commandIngest(true);
+   return;
+ }
+
+ // ping 응답 → RTT
+ if (strcmp(type, "pong") == 0) {
+   if (pingSentMs_) metrics_.tunnel.pingRttMs.record(millis() - pingSentMs_);
+   pingSentMs_ = 0;
+   return;
+ }
+
+ // resume 결과 (resume token으로 연결한 경우). 거절이면 같은 연결에서 전체 register
+ if (strcmp(type, "resume_ack") == 0) {
+   const char* st = peek["status"] | "";
+   const char* resume = peek["resume_token"] | "";
+   if (strcmp(st, "ok") != 0) {
+     resumeToken_[0] = '\0';
+     tunnelResumeRejected(peek["reason"] | "RESUME_REJECTED");
+     return;
+   }
+   if (resume[0] && strlen(resume) < sizeof(resumeToken_)) {
+     strcpy(resumeToken_, resume);
+     uint32_t ttl = peek["resume_ttl_ms"] | 0u;
+     resumeExpiresMs_ = ttl ? millis() + ttl : 0;
+   }
+   uint32_t window = peek["flow_window"] | 0u;
+   if (window) flowSetWindow(window);
+   ORBI_LOGI("[TUNNEL] resume ok\n");
+   return;
+ }
+
+ // Hub가 읽은 송신 bytes 반환 (register_ack flow_window로 켠 경우). window를 함께 주면 크기 변경
+ if (strcmp(type, "flow_credit") == 0) {
+   uint32_t bytes = peek["bytes"] | 0u;
+   uint32_t window = peek["window"] | 0u;
+   if (!s_link.flowWindow) return;
+   s_link.flowOutstanding = bytes < s_link.flowOutstanding ? s_link.flowOutstanding - bytes : 0;
+   s_link.flowLastCreditMs = millis();
+   if (window) s_link.flowWindow = window;
+   metrics_.tunnel.flowCredits++;
+   return;  // 기다리던 응답 / outbox는 tunnelLoop에서 이어서 (수신 콜백 안에서 보내지 않음)
+ }
+
+ // Hub가 곧 연결을 닫음 (배포/drain): 끊기면 첫 재연결은 지연 없이
+ if (strcmp(type, "goaway") == 0) {
+   s_link.gracefulClose = true;
+   ORBI_LOGI("[TUNNEL] goaway received\n");
+   return;
+ }
+
  // register_ack 처리: Hub가 register 요청 승인
  if (strcmp(type, "register_ack") == 0) {
    const char* st = peek["status"] | "";
@@ -1789,67 +4281,85 @@ void OrbiSyncNode::tunnelHandleMessage(const uint8_t* payload, size_t len) {
    const char* tid = peek["tunnel_id"] | "";
    const char* tunUrl = peek["tunnel_url"] | peek["ws_url"] | "";
    const char* thost = peek["tunnel_host"] | peek["domain"] | peek["host"] | "";
-
-   Serial.println("================================\n[TUNNEL REGISTER ACK]");
-   Serial.printf("status    = %s\n", st);
-   if (nid && nid[0]) Serial.printf("node_id   = %s\n", nid);
-   if (tid && tid[0]) Serial.printf("tunnel_id = %s\n", tid);
-   if (tunUrl && tunUrl[0]) Serial.printf("url       = %s\n", tunUrl);
-   if (thost && thost[0]) Serial.printf("host      = %s\n", thost);
-   if (reason[0]) Serial.printf("reason    = %s\n", reason);
-   if (detail[0]) Serial.printf("detail    = %s\n", detail);
-   Serial.println("================================");
+   const char* resume = peek["resume_token"] | "";
+   uint32_t resumeTtl = peek["resume_ttl_ms"] | 0u;
+   uint32_t flowWindow = peek["flow_window"] | 0u;
+
+   ORBI_LOGI("================================\n[TUNNEL REGISTER ACK]\n");
+   ORBI_LOGI("status    = %s\n", st);
+   if (nid && nid[0]) ORBI_LOGI("node_id   = %s\n", nid);
+   if (tid && tid[0]) ORBI_LOGI("tunnel_id = %s\n", tid);
+   if (tunUrl && tunUrl[0]) ORBI_LOGI("url       = %s\n", tunUrl);
+   if (thost && thost[0]) ORBI_LOGI("host      = %s\n", thost);
+   if (reason[0]) ORBI_LOGI("reason    = %s\n", reason);
+   if (detail[0]) ORBI_LOGI("detail    = %s\n", detail);
+   ORBI_LOGI("================================\n");
 
    if (strcmp(st, "ok") == 0) {
      bool updated = false;
      if (nid && nid[0]) {
        strncpy(nodeId_, nid, sizeof(nodeId_) - 1);
        nodeId_[sizeof(nodeId_) - 1] = '\0';
-       Serial.printf("[TUNNEL_ACK] ok node_id=%s\n", nodeId_);
+       ORBI_LOGI("[TUNNEL_ACK] ok node_id=%s\n", nodeId_);
        updated = true;
      }
      if (tid && tid[0]) {
        strncpy(tunnelId_, tid, sizeof(tunnelId_) - 1);
        tunnelId_[sizeof(tunnelId_) - 1] = '\0';
-       Serial.printf("[TUNNEL_ACK] ok tunnel_id=%s\n", tunnelId_);
+       ORBI_LOGI("[TUNNEL_ACK] ok tunnel_id=%s\n", tunnelId_);
        updated = true;
      }
      if (tunUrl && tunUrl[0]) {
        // Store tunnel_url if provided (may differ from constructed URL)
        strncpy(tunnelUrl_, tunUrl, sizeof(tunnelUrl_) - 1);
        tunnelUrl_[sizeof(tunnelUrl_) - 1] = '\0';
-       Serial.printf("[TUNNEL_ACK] ok tunnel_url=%s\n", tunnelUrl_);
+       ORBI_LOGI("[TUNNEL_ACK] ok tunnel_url=%s\n", tunnelUrl_);
        updated = true;
      }
      if (!updated) {
-       Serial.println("[TUNNEL_ACK] ok (no node_id/tunnel_id/tunnel_url in response)");
+       ORBI_LOGI("[TUNNEL_ACK] ok (no node_id/tunnel_id/tunnel_url in response)\n");
+     }
+     if (resume[0] && strlen(resume) < sizeof(resumeToken_)) {
+       strcpy(resumeToken_, resume);
+       resumeExpiresMs_ = resumeTtl ? millis() + resumeTtl : 0;
+       ORBI_LOGD("[TUNNEL_ACK] resume token stored ttl=%u\n", (unsigned)resumeTtl);
      }
-     tunnelRegistered_ = true;
-     tunnelBackoffIndex_ = 0;
-     tunnelBackoffMs_ = kTunnelBackoffMs[0];
-     setState(State::TUNNEL_CONNECTED);
-     lastTunnelPingMs_ = millis();
-     Serial.println("[TUNNEL] connected=true (registered=1)");
+     if (flowWindow) {
+       flowSetWindow(flowWindow);
+       ORBI_LOGI("[TUNNEL_ACK] ok flow_window=%u\n", (unsigned)flowWindow);
+     }
+     tunnelMarkRegistered();
      if (tunnelMessageCb_) { }
      return;
    }
 
-   Serial.printf("[TUNNEL] register_ack status=error reason=%s detail=%s\n", reason, detail[0] ? detail : "(none)");
+   ORBI_LOGW("[TUNNEL] register_ack status=error reason=%s detail=%s\n", reason, detail[0] ? detail : "(none)");
+   resumeToken_[0] = '\0';
+   if (resumePresented_ || strncmp(reason, "RESUME_", 7) == 0) {
+     tunnelResumeRejected(reason);
+     return;
+   }
    if (strcmp(reason, "MISSING_AUTH_TOKEN") == 0) {
-     Serial.println("[TUNNEL] action: re-run approve to get session_token");
+     ORBI_LOGW("[TUNNEL] action: re-run approve to get session_token\n");
      sessionToken_[0] = '\0';
      nextApproveMs_ = 0;
-     nextTunnelConnectMs_ = millis() + 3000;
+     nextTunnelConnectMs_ = jitterAt(3000);
    } else if (strcmp(reason, "SLOT_ID_MISMATCH") == 0) {
-     Serial.println("[TUNNEL] action: align slot_id with token or fix payload");
+     ORBI_LOGW("[TUNNEL] action: align slot_id with token or fix payload\n");
      nextTunnelConnectMs_ = millis() + tunnelBackoffMs_;
    } else if (strcmp(reason, "SESSION_TOKEN_MISSING_SLOT_ID") == 0) {
-     Serial.println("[TUNNEL] action: check approve response / token type");
+     ORBI_LOGW("[TUNNEL] action: check approve response / token type\n");
      nextApproveMs_ = 0;
-     nextTunnelConnectMs_ = millis() + 3000;
+     nextTunnelConnectMs_ = jitterAt(3000);
    } else {
      nextTunnelConnectMs_ = millis() + tunnelBackoffMs_;
    }
+   // 공유 연결의 합류 노드: 연결은 두고 이 노드만 빠진 뒤 nextTunnelConnectMs_에 다시 합류
+   int idx = linkIndexOf(this);
+   if (idx > 0) {
+     linkRemove(idx);
+     setState(State::ACTIVE);
+   }
    return;
  }
 
@@ -1858,104 +4368,68 @@ void OrbiSyncNode::tunnelHandleMessage(const uint8_t* payload, size_t len) {
    const char* streamId = peek["stream_id"] | "";
    const char* method = peek["method"] | "GET";
    const char* path = peek["path"] | "/";
-   
-   Serial.printf("[HTTP_REQ] stream_id=%s method=%s path=%s\n", streamId ? streamId : "(none)", method, path);
-   
+   const char* query = peek["query"] | "";
+   const char* body = peek["body"] | "";
+
+   ORBI_LOGD("[HTTP_REQ] stream_id=%s method=%s path=%s\n", streamId ? streamId : "(none)", method, path);
+
    // stream_id 검증 (응답 매칭 필수)
    if (!streamId || !streamId[0]) {
-     Serial.println("[HTTP_REQ] ERROR: missing stream_id, cannot send HTTP_RES");
+     ORBI_LOGE("[HTTP_REQ] ERROR: missing stream_id, cannot send HTTP_RES\n");
      return;
    }
-   
-   // Handle LED control
-   bool ledOn = false;
-   bool ledOff = false;
-   if (strcmp(path, "/led/on") == 0) {
-     ledOn = true;
-   } else if (strcmp(path, "/led/off") == 0) {
-     ledOff = true;
-   }
-   
-   int status = 200;
-   const char* bodyText = "OK";
-   
-   if (ledOn && cfg_.ledPin >= 0) {
-     digitalWrite(cfg_.ledPin, LOW);  // LOW = ON for most ESP32 boards
-     bodyText = "OK LED ON";
-     Serial.println("[HTTP_REQ] LED turned ON");
-   } else if (ledOff && cfg_.ledPin >= 0) {
-     digitalWrite(cfg_.ledPin, HIGH);  // HIGH = OFF for most ESP32 boards
-     bodyText = "OK LED OFF";
-     Serial.println("[HTTP_REQ] LED turned OFF");
-   } else if ((ledOn || ledOff) && cfg_.ledPin < 0) {
-     status = 500;
-     bodyText = "LED pin not configured";
-     Serial.println("[HTTP_REQ] ERROR: LED pin not configured");
-   }
-   
-   // Node → Hub HTTP 응답 전송
-   StaticJsonDocument<512> respDoc;
-   respDoc["type"] = "HTTP_RES";
-   respDoc["stream_id"] = streamId;  // 요청과 동일한 stream_id 사용
-   respDoc["status"] = status;
-   JsonObject headersObj = respDoc.createNestedObject("headers");
-   headersObj["content-type"] = "text/plain";
-   respDoc["body"] = bodyText;
-   
-   char respBuf[512];
-   size_t respLen = serializeJson(respDoc, respBuf, sizeof(respBuf));
-   if (respLen > 0 && respLen < sizeof(respBuf)) {
-     respBuf[respLen] = '\0';
-     bool sent = tunnelSendText(respBuf);
-     if (sent) {
-       Serial.printf("[HTTP_RES] sent stream_id=%s status=%d body=%s\n", streamId, status, bodyText);
-     } else {
-       Serial.printf("[HTTP_RES] FAILED to send stream_id=%s status=%d (WS not connected?)\n", streamId, status);
-     }
-   } else {
-     Serial.printf("[HTTP_RES] FAILED: buffer too small (needed %u, have %u)\n", (unsigned)respLen, (unsigned)sizeof(respBuf));
-     // Try to send error response with smaller body
-     StaticJsonDocument<256> errDoc;
-     errDoc["type"] = "HTTP_RES";
-     errDoc["stream_id"] = streamId;
-     errDoc["status"] = 500;
-     JsonObject errHeaders = errDoc.createNestedObject("headers");
-     errHeaders["content-type"] = "text/plain";
-     errDoc["body"] = "Internal error: response buffer overflow";
-     char errBuf[256];
-     size_t errLen = serializeJson(errDoc, errBuf, sizeof(errBuf));
-     if (errLen > 0 && errLen < sizeof(errBuf)) {
-       errBuf[errLen] = '\0';
-       tunnelSendText(errBuf);
-     }
-   }
+
+   TunnelHttpRequest req = {};
+   req.requestId = streamId;
+   req.streamId = streamId;
+   req.tunnelId = nodeId_;
+   req.method = method;
+   req.path = path;
+   req.query = query;
+   req.body = body[0] ? (const uint8_t*)body : nullptr;
+   req.bodyLen = strlen(body);
+
+   collectJsonHeaders(req, peek["headers"]);
+
+   // Node → Hub HTTP 응답은 HTTP_RES 형식 (요청과 동일한 stream_id)
+   TunnelHttpResponseWriter* slot = tunnelAcquireStream(streamId, TunnelHttpResponseWriter::kFormatHttpRes, false, false);
+   if (!slot) return;
+   TunnelHttpResponseWriter& res = *slot;
+
+   tunnelServeHttpRequest(req, res);
    return;
  }
 
  // proxy_request 처리 (레거시 형식)
  if (strcmp(type, "proxy_request") == 0) {
+#if ORBISYNC_LOG_LEVEL >= ORBISYNC_LOG_DEBUG
    const char* reqId = peek["request_id"] | peek["req_id"] | "";
    const char* method = peek["method"] | "GET";
    const char* path = peek["path"] | "/";
    const char* bodyB64 = peek["body"] | "";
    size_t bodyLen = bodyB64 && bodyB64[0] ? (strlen(bodyB64) / 4) * 3 : 0;
-   Serial.printf("[HTTP_TUNNEL] req_id=%s method=%s path=%s body_len=%u\n", reqId, method, path, (unsigned)bodyLen);
+   ORBI_LOGD("[HTTP_TUNNEL] req_id=%s method=%s path=%s body_len=%u\n", reqId, method, path, (unsigned)bodyLen);
+#endif
    tunnelHandleProxyRequest(payload, len);
    return;
  }
 
  if (cfg_.debugHttp) {
-   Serial.printf("[TUNNEL] rx type=%s len=%u\n", type, (unsigned)len);
+   ORBI_LOGD("[TUNNEL] rx type=%s len=%u\n", type, (unsigned)len);
  }
 }
 
 void OrbiSyncNode::tunnelHandleProxyRequest(const uint8_t* payload, size_t len) {
  if (!payload || len == 0) return;
 
- StaticJsonDocument<1536> doc;
- if (deserializeJson(doc, payload, len)) {
-   Serial.println("[HTTP_REQ] parse err");
-   return;
+ // tunnelHandleMessage에서 온 경우 이미 파싱된 메시지 사용
+ JsonObject doc = s_tunnelRxMsg;
+ if (payload != s_tunnelRxPayload) {
+   if (deserializeJson(s_tunnelRxDoc, payload, len)) {
+     ORBI_LOGW("[HTTP_REQ] parse err\n");
+     return;
+   }
+   doc = s_tunnelRxDoc.as<JsonObject>();
  }
 
  const char* reqId = doc["request_id"] | doc["req_id"] | "";
@@ -1970,25 +4444,21 @@ void OrbiSyncNode::tunnelHandleProxyRequest(const uint8_t* payload, size_t len)
 
  if (bodyB64 && bodyB64[0]) {
    size_t b64Len = strlen(bodyB64);
-   bodyLen = (b64Len / 4) * 3 + 4;
+   bodyLen = base64DecodedMaxLen(b64Len);
    if (bodyLen > maxBody) {
-     Serial.printf("[HTTP_REQ] body too large %u -> 413\n", (unsigned)bodyLen);
-     TunnelHttpResponseWriter res;
-     res.node_ = this;
-     strncpy(res.requestId_, reqId, sizeof(res.requestId_) - 1);
-     res.requestId_[sizeof(res.requestId_) - 1] = '\0';
-     res.setStatus(413);
-     res.setHeader("Content-Type", "text/plain");
-     res.write("Payload Too Large");
-     res.end();
+     ORBI_LOGW("[HTTP_REQ] body too large %u -> 413\n", (unsigned)bodyLen);
+     TunnelHttpResponseWriter* res = tunnelAcquireStream(reqId, TunnelHttpResponseWriter::kFormatProxy, false, false);
+     if (!res) return;
+     res->setStatus(413);
+     res->setHeader("Content-Type", "text/plain");
+     res->write("Payload Too Large");
+     res->end();
      return;
    }
-   bodyDec = (uint8_t*)malloc(bodyLen);
-   if (bodyDec) {
-     bodyLen = base64Decode(bodyDec, bodyB64, strlen(bodyB64));
-   } else {
-     bodyLen = 0;
-   }
+   // 문서 안의 base64 문자열 자리에 그대로 decode (별도 버퍼 없음, 문서는 이 요청 동안만 사용)
+   // 문자열 중복 제거를 꺼 두었으므로 (파일 첫 부분) batch의 다른 메시지 / header와 bytes를 공유하지 않음
+   bodyDec = (uint8_t*)const_cast<char*>(bodyB64);
+   bodyLen = base64Decode(bodyDec, bodyB64, b64Len);
  }
 
  TunnelHttpRequest req = {};
@@ -2001,82 +4471,1067 @@ void OrbiSyncNode::tunnelHandleProxyRequest(const uint8_t* payload, size_t len)
  req.body = bodyDec;
  req.bodyLen = bodyLen;
  req.headerCount = 0;
+ collectJsonHeaders(req, doc["headers"]);
+ if (!tunnelInflateRequest(req, false)) return;
+
+ TunnelHttpResponseWriter* res = tunnelAcquireStream(reqId, TunnelHttpResponseWriter::kFormatProxy, false, false);
+ if (res) tunnelServeHttpRequest(req, *res);
+}
 
- JsonObject headers = doc["headers"];
- if (headers) {
-   for (JsonPair p : headers) {
-     if (req.headerCount >= TUNNEL_MAX_HEADERS) break;
-     const char* k = p.key().c_str();
-     const char* v = p.value().as<const char*>();
-     if (k && v) {
-       strncpy(req.headers[req.headerCount].key, k, 23);
-       req.headers[req.headerCount].key[23] = '\0';
-       strncpy(req.headers[req.headerCount].value, v, 79);
-       req.headers[req.headerCount].value[79] = '\0';
-       req.headerCount++;
+// -----------------------------
+// 압축 (Config::tunnelCompress)
+// -----------------------------
+// 응답: 첫 frame에서 Accept-Encoding / 크기로 결정 → 이후 chunk는 같은 deflate stream (OrbiSyncDeflate.h)
+// 요청: Content-Encoding gzip/deflate body를 s_inflateBuf에 해제 (handler 호출 동안만 사용, 처음 필요할 때 할당)
+static constexpr uint16_t kDefaultCompressMinBytes = 256;
+static uint8_t* s_inflateBuf = nullptr;
+static size_t s_inflateCap = 0;
+
+bool OrbiSyncNode::tunnelCompressBegin(TunnelHttpResponseWriter& res, bool chunk) {
+ if (res.contentEnc_) return true;
+ if (!res.acceptEnc_ || (chunk && res.chunkSeq_ > 0)) return false;
+ if (res.bodyTotal_ < cfgOrDefaultU32(cfg_.tunnelCompressMinBytes, kDefaultCompressMinBytes)) return false;
+ if (res.statusCode_ == 204 || res.statusCode_ == 304) return false;
+ int lenIdx = -1;
+ for (uint8_t i = 0; i < res.headerCount_; i++) {
+   if (strcasecmp(res.headers_[i].key, "Content-Encoding") == 0) return false;  // handler가 직접 인코딩
+   if (strcasecmp(res.headers_[i].key, "Content-Length") == 0) lenIdx = i;
+   // 이미 압축된 형식은 다시 압축해도 줄지 않음
+   if (strcasecmp(res.headers_[i].key, "Content-Type") == 0) {
+     const char* ct = res.headers_[i].value;
+     if ((strncasecmp(ct, "image/", 6) == 0 && !strstr(ct, "svg")) || strncasecmp(ct, "video/", 6) == 0 ||
+         strncasecmp(ct, "audio/", 6) == 0 || strstr(ct, "zip") || strstr(ct, "compressed")) {
+       return false;
+     }
+   }
+ }
+ if (lenIdx < 0 && res.headerCount_ >= TUNNEL_MAX_RESPONSE_HEADERS) return false;
+ if (!deflateBegin(res.deflate_, res.acceptEnc_)) return false;
+
+ // Content-Length는 원본 길이라 맞지 않음 → 그 자리를 Content-Encoding으로
+ if (lenIdx < 0) lenIdx = res.headerCount_++;
+ strcpy(res.headers_[lenIdx].key, "Content-Encoding");
+ strcpy(res.headers_[lenIdx].value, encodingName(res.acceptEnc_));
+ res.contentEnc_ = res.acceptEnc_;
+ return true;
+}
+
+size_t OrbiSyncNode::tunnelCompressBody(TunnelHttpResponseWriter& res, uint8_t* out, bool final) {
+ size_t n = deflateWrite(res.deflate_, res.body_, res.bodyLen_, out, final);
+ metrics_.tunnel.compressIn += res.bodyLen_;
+ metrics_.tunnel.compressOut += n;
+ return n;
+}
+
+bool OrbiSyncNode::tunnelInflateRequest(TunnelHttpRequest& req, bool binary) {
+ if (!cfg_.tunnelCompress || !req.body || !req.bodyLen) return true;
+ size_t ceLen = 0;
+ const char* ce = req.getHeader("Content-Encoding", &ceLen);
+ if (!ce) return true;
+ uint8_t enc = encodingFromName(ce, ceLen);
+ if (enc == kEncodingNone) return true;
+
+ int status = 415;
+ const char* msg = "Unsupported Media Type";
+ if (enc != kEncodingUnsupported) {
+   size_t maxBody = cfgOrDefaultSz(cfg_.maxTunnelBodyBytes, kDefaultMaxTunnelBody);
+   if (s_inflateCap < maxBody) {
+     free(s_inflateBuf);
+     s_inflateBuf = (uint8_t*)malloc(maxBody);
+     s_inflateCap = s_inflateBuf ? maxBody : 0;
+   }
+   size_t outLen = 0;
+   bool tooLarge = false;
+   if (s_inflateBuf && inflateBody(req.body, req.bodyLen, s_inflateBuf, maxBody, outLen, tooLarge)) {
+     ORBI_LOGD("[HTTP_REQ] inflated %s %u -> %u\n", encodingName(enc), (unsigned)req.bodyLen, (unsigned)outLen);
+     metrics_.tunnel.inflated++;
+     req.body = s_inflateBuf;
+     req.bodyLen = outLen;
+     // handler에는 해제된 body로 보이도록
+     static const char kIdentity[] = "identity";
+     for (uint8_t i = 0; i < req.headerCount; i++) {
+       TunnelHeaderView& h = req.headers[i];
+       if (h.value == ce) {
+         h.value = kIdentity;
+         h.valueLen = sizeof(kIdentity) - 1;
+       }
      }
+     return true;
    }
+   status = (tooLarge || !s_inflateBuf) ? 413 : 400;
+   msg = (status == 413) ? "Payload Too Large" : "Bad Request";
  }
+ ORBI_LOGW("[HTTP_REQ] content-encoding %.*s -> %d\n", (int)ceLen, ce, status);
+ TunnelHttpResponseWriter* res =
+     tunnelAcquireStream(req.requestId, TunnelHttpResponseWriter::kFormatProxy, binary, false);
+ if (!res) return false;
+ res->setStatus(status);
+ res->setHeader("Content-Type", "text/plain");
+ res->write(msg);
+ res->end();
+ return false;
+}
 
- TunnelHttpResponseWriter res;
- res.node_ = this;
- strncpy(res.requestId_, reqId, sizeof(res.requestId_) - 1);
- res.requestId_[sizeof(res.requestId_) - 1] = '\0';
+// -----------------------------
+// Tunnel stream pool
+// -----------------------------
+// streams_[]: 응답 writer를 stream_id 기준으로 보관. handler가 defer()하면 slot을 유지하고
+// 나중에 loopTick()에서 응답. 빈 slot이 없으면 handler 호출 없이 즉시 503.
+
+/// binary frame big-endian u16
+static uint8_t* binPut16(uint8_t* p, uint16_t v) {
+ p[0] = (uint8_t)(v >> 8);
+ p[1] = (uint8_t)(v & 0xFF);
+ return p + 2;
+}
 
- bool isLedOn = (strstr(path, "led/on") != nullptr);
+TunnelHttpResponseWriter* OrbiSyncNode::findTunnelStream(const char* streamId) {
+ if (!streamId || !streamId[0]) return nullptr;
+ for (uint8_t i = 0; i < ORBISYNC_TUNNEL_MAX_STREAMS; i++) {
+   if (streams_[i].inUse_ && strcmp(streams_[i].requestId_, streamId) == 0) return &streams_[i];
+ }
+ return nullptr;
+}
 
- if (isLedOn) {
-   res.setStatus(200);
-   res.setHeader("Content-Type", "application/json");
-   res.write("{\"ok\":true,\"value\":1}");
-   res.end();
+TunnelHttpResponseWriter* OrbiSyncNode::tunnelAcquireStream(const char* id, uint8_t format, bool binary, bool idNumeric) {
+ if (!id) id = "";
+ // Hub 재전송: 같은 id가 아직 처리 중이면 원래 요청이 응답함
+ if (findTunnelStream(id)) {
+   ORBI_LOGW("[TUNNEL] duplicate stream id=%s (in flight, ignored)\n", id);
+   return nullptr;
+ }
+
+ for (uint8_t i = 0; i < ORBISYNC_TUNNEL_MAX_STREAMS; i++) {
+   TunnelHttpResponseWriter& w = streams_[i];
+   if (w.inUse_) continue;
+   bool streaming = (format == TunnelHttpResponseWriter::kFormatProxy) && cfg_.tunnelStreamResponses;
+   w.reset(this, format, binary, streaming);
+   w.idNumeric_ = idNumeric;
+   strncpy(w.requestId_, id, sizeof(w.requestId_) - 1);
+   w.requestId_[sizeof(w.requestId_) - 1] = '\0';
+   w.inUse_ = true;
+   return &w;
+ }
+
+ metrics_.tunnel.busyRejects++;
+ ORBI_LOGW("[TUNNEL] streams busy (%u) id=%s -> 503\n", (unsigned)ORBISYNC_TUNNEL_MAX_STREAMS, id);
+ tunnelSendBusy(id, format, binary, idNumeric);
+ return nullptr;
+}
+
+/// pool이 가득 찼을 때의 503. slot 버퍼 없이 작은 frame을 직접 만든다
+void OrbiSyncNode::tunnelSendBusy(const char* id, uint8_t format, bool binary, bool idNumeric) {
+ if (binary) {
+   if (!tunnelTxReady()) return;
+   uint8_t buf[kBinFrameHeaderLen + 48];
+   size_t idLen = strlen(id);
+   if (idLen > 47) idLen = 47;
+   uint8_t* p = buf;
+   *p++ = kBinFrameVersion;
+   *p++ = kBinTypeResponse;
+   *p++ = kBinFlagFinal;
+   *p++ = (uint8_t)idLen;
+   p = binPut16(p, 503);
+   p = binPut16(p, 0);
+   *p++ = 0;
+   memcpy(p, id, idLen);
+   tunnelSendBinary(buf, kBinFrameHeaderLen + idLen);
+   return;
+ }
+
+ StaticJsonDocument<256> doc;
+ if (format == TunnelHttpResponseWriter::kFormatHttpRes) {
+   doc["type"] = "HTTP_RES";
+   doc["stream_id"] = id;
+   doc["status"] = 503;
+   JsonObject headers = doc.createNestedObject("headers");
+   headers["content-type"] = "text/plain";
+   headers["retry-after"] = "1";
+   doc["body"] = "Service Unavailable";
+ } else if (format == TunnelHttpResponseWriter::kFormatRpc) {
+   if (idNumeric) doc["id"] = atol(id);
+   else doc["id"] = id;
+   doc["status"] = 503;
+   doc["body"] = "Service Unavailable";
  } else {
-   res.setStatus(200);
+   doc["type"] = "proxy_response";
+   doc["request_id"] = id;
+   doc["status_code"] = 503;
+   JsonObject headers = doc.createNestedObject("headers");
+   headers["Retry-After"] = "1";
+   doc["body"] = "";
+ }
+
+ char out[256];
+ size_t n = serializeJson(doc, out, sizeof(out));
+ if (n > 0 && n < sizeof(out)) {
+   out[n] = '\0';
+   tunnelSendOrQueue((const uint8_t*)out, n, false, outboxIdHash(id, 0));
+ }
+}
+
+bool OrbiSyncNode::tunnelWriterSend(TunnelHttpResponseWriter& w) {
+ if (!flowAllows(w.frameCost(w.bodyLen_))) {
+   if (!w.flowHeld_) {
+     w.flowHeld_ = true;
+     metrics_.tunnel.flowWaits++;
+     ORBI_LOGD("[TUNNEL] flow wait id=%s outstanding=%u window=%u\n", w.requestId_,
+       (unsigned)s_link.flowOutstanding, (unsigned)s_link.flowWindow);
+   }
+   return false;
+ }
+ w.flowHeld_ = false;
+ if (w.ended_) {
+   tunnelSendProxyResponse(w);
+   w.inUse_ = false;
+   w.deferred_ = false;
+ } else {
+   tunnelSendProxyChunk(w, false);
+ }
+ return true;
+}
+
+/// flow window를 기다리던 응답 재개 + deferred 응답 timeout 처리 (tunnelLoop에서 호출)
+void OrbiSyncNode::tunnelPollStreams() {
+ uint32_t timeoutMs = cfgOrDefaultU32(cfg_.tunnelDeferTimeoutMs, kDefaultTunnelDeferTimeoutMs);
+ uint32_t now = millis();
+
+ // 기다리는 송신이 있는데 credit이 오래 없음 → Hub가 다 읽은 것으로 보고 계속 (응답이 영영 멈추지 않도록)
+ if (s_link.flowOutstanding && now - s_link.flowLastCreditMs >= kFlowStallMs) {
+   bool waiting = outboxPending_ && !flowAllows(kFlowFrameOverhead);
+   for (uint8_t i = 0; i < ORBISYNC_TUNNEL_MAX_STREAMS && !waiting; i++) waiting = streams_[i].inUse_ && streams_[i].flowHeld_;
+   if (waiting) {
+     ORBI_LOGW("[TUNNEL] no flow_credit for %ums (outstanding=%u window=%u) -> reset\n", (unsigned)kFlowStallMs,
+       (unsigned)s_link.flowOutstanding, (unsigned)s_link.flowWindow);
+     s_link.flowOutstanding = 0;
+     s_link.flowLastCreditMs = now;
+     metrics_.tunnel.flowStalls++;
+   }
+ }
+
+ for (uint8_t i = 0; i < ORBISYNC_TUNNEL_MAX_STREAMS; i++) {
+   TunnelHttpResponseWriter& w = streams_[i];
+   if (w.inUse_ && w.flowHeld_) {
+     // task mode chunk: 보낸 뒤에야 loopTick core의 write()가 이어짐
+     if (tunnelWriterSend(w)) __atomic_store_n(&w.taskOpPending_, false, __ATOMIC_RELEASE);
+     continue;  // 기다리는 동안은 timeout 없음 (credit이 끊기면 kFlowStallMs 뒤 풀림)
+   }
+   // ended_ + inUse_: task mode에서 end()가 network task 전송을 기다리는 중
+   if (!w.inUse_ || !w.deferred_ || w.ended_ || now - w.startedMs_ < timeoutMs) continue;
+   metrics_.tunnel.deferTimeouts++;
+   ORBI_LOGW("[TUNNEL] deferred stream id=%s timeout %ums -> 504\n", w.requestId_, (unsigned)timeoutMs);
+   // 이미 chunk를 보냈다면 status는 바꿀 수 없음 → 남은 데이터로 마무리
+   if (w.chunkSeq_ == 0) {
+     w.statusCode_ = 504;
+     w.headerCount_ = 0;
+     w.bodyLen_ = 0;
+     w.bodyTotal_ = 0;
+     w.setHeader("Content-Type", "text/plain");
+     w.write("Gateway Timeout");
+   }
+   w.end();
+ }
+}
+
+/// 터널이 끊기면 진행 중인 응답은 보낼 곳이 없음 → slot 전부 반환
+void OrbiSyncNode::tunnelReleaseStreams() {
+#if ORBISYNC_TASK_MODE
+ // 대기 중인 writer op가 나중에 재사용된 slot을 건드리지 않도록 먼저 비움
+ if (netTask_) taskDrainWriterOps();
+#endif
+ for (uint8_t i = 0; i < ORBISYNC_TUNNEL_MAX_STREAMS; i++) {
+   if (!streams_[i].inUse_) continue;
+   ORBI_LOGI("[TUNNEL] drop stream id=%s (disconnected)\n", streams_[i].requestId_);
+   streams_[i].ended_ = true;
+   streams_[i].inUse_ = false;
+   streams_[i].deferred_ = false;
+   streams_[i].flowHeld_ = false;
+   __atomic_store_n(&streams_[i].taskOpPending_, false, __ATOMIC_RELEASE);  // window 대기 중이던 chunk의 write() 해제
+ }
+}
+
+// -----------------------------
+// Tunnel request router
+// -----------------------------
+// routes_는 (prefix, method) 순으로 정렬 유지. 요청 path의 segment 경계마다(긴 것부터)
+// 이진 탐색 → O(segments · log n), strstr 반복 없음.
+static int routeCmp(const char* a, size_t al, const char* b, size_t bl) {
+ size_t n = al < bl ? al : bl;
+ int c = memcmp(a, b, n);
+ if (c != 0) return c;
+ return (al < bl) ? -1 : (al > bl) ? 1 : 0;
+}
+
+static bool routeIsWildcard(const char* routeMethod) {
+ return !routeMethod || (routeMethod[0] == '*' && routeMethod[1] == '\0');
+}
+
+static bool routeMethodMatches(const char* routeMethod, const char* method) {
+ return routeIsWildcard(routeMethod) || (method && strcasecmp(routeMethod, method) == 0);
+}
+
+bool OrbiSyncNode::addRoute(const char* method, const char* pathPrefix, HttpRequestCallback handler) {
+ if (!pathPrefix || pathPrefix[0] != '/' || !handler) return false;
+ if (routeCount_ >= ORBISYNC_MAX_ROUTES) {
+   ORBI_LOGE("[ROUTE] table full (%u), skip %s\n", (unsigned)ORBISYNC_MAX_ROUTES, pathPrefix);
+   return false;
+ }
+
+ // trailing '/'는 무시 ("/" 자체는 catch-all)
+ size_t len = strlen(pathPrefix);
+ while (len > 1 && pathPrefix[len - 1] == '/') len--;
+ if (len > 0xFF) return false;
+
+ // 정렬 위치 (같은 prefix 안에서는 method 지정 route가 wildcard보다 앞, 나머지는 등록 순)
+ bool wildcard = routeIsWildcard(method);
+ uint8_t pos = 0;
+ for (; pos < routeCount_; pos++) {
+   const TunnelRoute& r = routes_[pos];
+   int c = routeCmp(r.prefix, r.prefixLen, pathPrefix, len);
+   if (c > 0) break;
+   if (c == 0 && !wildcard && routeIsWildcard(r.method)) break;
+ }
+ for (uint8_t i = routeCount_; i > pos; i--) routes_[i] = routes_[i - 1];
+
+ routes_[pos].method = method;
+ routes_[pos].prefix = pathPrefix;
+ routes_[pos].prefixLen = (uint8_t)len;
+ routes_[pos].handler = handler;
+ routeCount_++;
+ return true;
+}
+
+HttpRequestCallback OrbiSyncNode::findRoute(const char* method, const char* path) const {
+ if (routeCount_ == 0 || !path) return nullptr;
+
+ size_t len = strcspn(path, "?");
+ while (len > 1 && path[len - 1] == '/') len--;
+
+ while (true) {
+   // prefix == path[0..len) 인 첫 route 이진 탐색
+   int lo = 0, hi = (int)routeCount_ - 1, first = -1;
+   while (lo <= hi) {
+     int mid = (lo + hi) / 2;
+     int c = routeCmp(routes_[mid].prefix, routes_[mid].prefixLen, path, len);
+     if (c < 0) lo = mid + 1;
+     else { if (c == 0) first = mid; hi = mid - 1; }
+   }
+   for (int i = first; i >= 0 && i < (int)routeCount_ &&
+        routeCmp(routes_[i].prefix, routes_[i].prefixLen, path, len) == 0; i++) {
+     if (routeMethodMatches(routes_[i].method, method)) return routes_[i].handler;
+   }
+
+   if (len <= 1) return nullptr;
+   // 한 segment 위로 ("/a/b" → "/a" → "/")
+   size_t k = len - 1;
+   while (k > 0 && path[k] != '/') k--;
+   len = (k == 0) ? 1 : k;
+ }
+}
+
+// -----------------------------
+// Hub command (poll: heartbeat/session 응답 "commands", push: 터널 "command"/"commands")
+// -----------------------------
+// network 쪽(runStateMachine)이 받아 cmdInbox_에 넣고, loopTick(사용자 core)이 handler 실행 →
+// cmdAcks_ → network 쪽이 터널 command_ack로 보내거나 다음 HTTP heartbeat의 "acks"에 실음
+enum CommandResult : uint8_t { kCmdOk = 0, kCmdFailed, kCmdUnknown, kCmdArgsTooLarge, kCmdBusy };
+static constexpr uint8_t kCmdRunning = 0xFF;
+static const char* const kCmdErrors[] = {"", "failed", "unknown_command", "args_too_large", "busy"};
+static constexpr uint32_t kDefaultCommandPollMs = 10000;
+
+bool OrbiSyncNode::addCommand(const char* name, CommandHandler handler) {
+ if (!name || !name[0] || !handler) return false;
+ if (strlen(name) >= sizeof(CommandSlot::name)) return false;
+ for (uint8_t i = 0; i < commandCount_; i++) {
+   if (strcmp(commands_[i].name, name) == 0) {
+     commands_[i].handler = handler;
+     return true;
+   }
+ }
+ if (commandCount_ >= ORBISYNC_MAX_COMMANDS) {
+   ORBI_LOGE("[CMD] table full (%u), skip %s\n", (unsigned)ORBISYNC_MAX_COMMANDS, name);
+   return false;
+ }
+ commands_[commandCount_].name = name;
+ commands_[commandCount_].handler = handler;
+ commandCount_++;
+ return true;
+}
+
+uint32_t OrbiSyncNode::heartbeatPeriodMs() const {
+ uint32_t hb = cfgOrDefaultU32(cfg_.heartbeatIntervalMs, 60000);
+ if (!cfg_.enableCommandPolling || tunnelRegistered_) return hb;
+ uint32_t poll = cfgOrDefaultU32(cfg_.commandPollIntervalMs, kDefaultCommandPollMs);
+ return poll < hb ? poll : hb;
+}
+
+// command 하나 → slot. id는 문자열/숫자 모두 허용. false = id/name 없음
+static bool commandFields(JsonVariantConst v, CommandSlot& c, bool& argsFit) {
+ JsonVariantConst idV = v["id"];
+ if (idV.is<const char*>()) {
+   strncpy(c.id, idV.as<const char*>(), sizeof(c.id) - 1);
+   c.id[sizeof(c.id) - 1] = '\0';
+ } else if (idV.is<uint32_t>()) {
+   snprintf(c.id, sizeof(c.id), "%lu", (unsigned long)idV.as<uint32_t>());
+ } else {
+   return false;
+ }
+ const char* name = v["name"] | "";
+ if (!c.id[0] || !name[0]) return false;
+ strncpy(c.name, name, sizeof(c.name) - 1);
+ c.name[sizeof(c.name) - 1] = '\0';
+
+ JsonVariantConst a = v["args"];
+ argsFit = true;
+ if (a.isNull()) {
+   memcpy(c.args, "{}", 3);
+   c.argsLen = 2;
+ } else if (measureJson(a) >= sizeof(c.args)) {
+   argsFit = false;
+   c.args[0] = '\0';
+   c.argsLen = 0;
+ } else {
+   c.argsLen = (uint16_t)serializeJson(a, c.args, sizeof(c.args));
+ }
+ return true;
+}
+
+void OrbiSyncNode::commandIngest(bool fromTunnel) {
+ JsonVariantConst list = fromTunnel ? (JsonVariantConst)s_tunnelRxMsg["commands"] : (JsonVariantConst)s_hubRxDoc["commands"];
+ CommandSlot c;
+ bool fit;
+ if (fromTunnel && list.isNull()) {
+   // 단건 push: {"type":"command","id":..,"name":..,"args":{..}}
+   if (commandFields(s_tunnelRxMsg, c, fit)) commandAccept(c, fit);
+   return;
+ }
+ for (JsonVariantConst v : list.as<JsonArrayConst>()) {
+   if (commandFields(v, c, fit)) commandAccept(c, fit);
+ }
+}
+
+void OrbiSyncNode::commandAccept(const CommandSlot& c, bool argsFit) {
+ uint32_t h = outboxIdHash(c.id, 0);
+ for (uint8_t i = 0; i < sizeof(cmdRecent_) / sizeof(cmdRecent_[0]); i++) {
+   if (cmdRecent_[i] != h) continue;
+   // 재전송: 실행 중이면 무시 (곧 ack), 끝났으면 같은 결과로 다시 ack (앞선 ack 유실)
+   ORBI_LOGD("[CMD] duplicate id=%s\n", c.id);
+   if (cmdRecentResult_[i] != kCmdRunning) commandAckNow(c.id, cmdRecentResult_[i]);
+   return;
+ }
+
+ uint8_t result = kCmdRunning;
+ if (!argsFit) result = kCmdArgsTooLarge;
+ else if (!cmdInbox_.push(c)) {
+   // 기억하지 않음 → Hub가 다시 보내면 그때 실행
+   ORBI_LOGW("[CMD] inbox full, busy id=%s\n", c.id);
+   commandAckNow(c.id, kCmdBusy);
+   return;
+ }
+ cmdRecent_[cmdRecentPos_] = h;
+ cmdRecentResult_[cmdRecentPos_] = result;
+ cmdRecentPos_ = (uint8_t)((cmdRecentPos_ + 1) % (sizeof(cmdRecent_) / sizeof(cmdRecent_[0])));
+ if (result != kCmdRunning) commandAckNow(c.id, result);
+ else ORBI_LOGD("[CMD] queued id=%s name=%s args_len=%u\n", c.id, c.name, (unsigned)c.argsLen);
+}
+
+void OrbiSyncNode::commandAckNow(const char* id, uint8_t result) {
+ if (cmdAckPendingCount_ >= sizeof(cmdAckPending_) / sizeof(cmdAckPending_[0])) {
+   ORBI_LOGW("[CMD] ack queue full, drop id=%s\n", id);
+   return;
+ }
+ CommandAck& a = cmdAckPending_[cmdAckPendingCount_++];
+ strncpy(a.id, id, sizeof(a.id) - 1);
+ a.id[sizeof(a.id) - 1] = '\0';
+ a.result = result;
+}
+
+void OrbiSyncNode::commandRun() {
+ CommandSlot c;
+ while (cmdInbox_.pop(c)) {
+   CommandHandler h = nullptr;
+   for (uint8_t i = 0; i < commandCount_; i++) {
+     if (strcmp(commands_[i].name, c.name) == 0) { h = commands_[i].handler; break; }
+   }
+   CommandAck a;
+   memcpy(a.id, c.id, sizeof(a.id));
+   if (!h) {
+     ORBI_LOGW("[CMD] unknown command name=%s id=%s\n", c.name, c.id);
+     a.result = kCmdUnknown;
+   } else {
+     Command cmd = {c.id, c.name, c.args, c.argsLen};
+     a.result = h(cmd) ? kCmdOk : kCmdFailed;
+     ORBI_LOGI("[CMD] %s id=%s -> %s\n", c.name, c.id, a.result == kCmdOk ? "ok" : "failed");
+   }
+   // ack queue는 inbox의 2배라 loopTick이 밀려도 가득 차지 않지만, 만약을 위해 대기
+   while (!cmdAcks_.push(a)) {
+#if ORBISYNC_TASK_MODE
+     if (netTask_) { vTaskDelay(1); continue; }
+#endif
+     commandPumpAcks();
+   }
+ }
+}
+
+// 터널: {"type":"command_ack","id":..,"ok":..,"error":..} (합류 노드는 node_id)
+bool OrbiSyncNode::commandSendAck(const CommandAck& a) {
+ char buf[160];
+ size_t n = (size_t)snprintf(buf, sizeof(buf), "{\"type\":\"command_ack\",\"ok\":%s", a.result == kCmdOk ? "true" : "false");
+ if (linkIndexOf(this) > 0 && !payloadAppendStr(buf, sizeof(buf) - 1, n, "node_id", nodeId_)) return false;
+ if (!payloadAppendStr(buf, sizeof(buf) - 1, n, "id", a.id)) return false;
+ if (a.result != kCmdOk && !payloadAppendStr(buf, sizeof(buf) - 1, n, "error", kCmdErrors[a.result])) return false;
+ buf[n++] = '}';
+ buf[n] = '\0';
+ return tunnelSendOrQueue((const uint8_t*)buf, n, false, outboxIdHash(a.id, 0x61636bu));
+}
+
+void OrbiSyncNode::commandPumpAcks() {
+ CommandAck a;
+ while (cmdAcks_.pop(a)) {
+   uint32_t h = outboxIdHash(a.id, 0);
+   for (uint8_t i = 0; i < sizeof(cmdRecent_) / sizeof(cmdRecent_[0]); i++) {
+     if (cmdRecent_[i] == h) cmdRecentResult_[i] = a.result;
+   }
+   commandAckNow(a.id, a.result);
+ }
+ // push 모드: 등록된 터널로 바로. 진행 중인 heartbeat에 실린 ack는 그 결과를 기다림
+ if (!tunnelRegistered_ || cmdAckInFlight_ || !cmdAckPendingCount_) return;
+ uint8_t sent = 0;
+ while (sent < cmdAckPendingCount_ && commandSendAck(cmdAckPending_[sent])) sent++;
+ if (!sent) return;
+ memmove(cmdAckPending_, cmdAckPending_ + sent, (cmdAckPendingCount_ - sent) * sizeof(CommandAck));
+ cmdAckPendingCount_ -= sent;
+}
+
+// heartbeat body 끝 '}' 앞에 ,"acks":[{"ok":..,"id":..,"error":..},..] (넣지 못한 ack는 다음 poll)
+size_t OrbiSyncNode::commandAppendAcks(char* out, size_t cap, size_t n) {
+ cmdAckInFlight_ = 0;
+ if (!cmdAckPendingCount_ || n < 2 || out[n - 1] != '}') return n;
+ size_t w = n - 1;
+ static const char kAcksKey[] = ",\"acks\":[";
+ if (w + sizeof(kAcksKey) + 2 >= cap) return n;
+ memcpy(out + w, kAcksKey, sizeof(kAcksKey) - 1);
+ w += sizeof(kAcksKey) - 1;
+ for (uint8_t i = 0; i < cmdAckPendingCount_; i++) {
+   const CommandAck& a = cmdAckPending_[i];
+   size_t m = w;
+   int k = snprintf(out + m, cap - m, "%s{\"ok\":%s", i ? "," : "", a.result == kCmdOk ? "true" : "false");
+   if (k <= 0 || m + (size_t)k >= cap) break;
+   m += (size_t)k;
+   if (!payloadAppendStr(out, cap - 3, m, "id", a.id)) break;
+   if (a.result != kCmdOk && !payloadAppendStr(out, cap - 3, m, "error", kCmdErrors[a.result])) break;
+   out[m++] = '}';
+   w = m;
+   cmdAckInFlight_++;
+ }
+ if (!cmdAckInFlight_) {
+   out[n - 1] = '}';
+   out[n] = '\0';
+   return n;
+ }
+ out[w++] = ']';
+ out[w++] = '}';
+ out[w] = '\0';
+ return w;
+}
+
+void OrbiSyncNode::commandAcksDelivered(bool ok) {
+ uint8_t k = cmdAckInFlight_;
+ cmdAckInFlight_ = 0;
+ if (!ok || !k) return;
+ if (k > cmdAckPendingCount_) k = cmdAckPendingCount_;
+ memmove(cmdAckPending_, cmdAckPending_ + k, (cmdAckPendingCount_ - k) * sizeof(CommandAck));
+ cmdAckPendingCount_ -= k;
+}
+
+/// 파싱된 요청 처리 (RPC / HTTP_REQ / proxy_request / binary 공용)
+/// 순서: 내장 metrics → (task mode: loopTick core로 전달) addRoute 테이블 → onRequest → onHttpRequest
+///       → 내장 /led/on|off → 404
+void OrbiSyncNode::tunnelServeHttpRequest(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res) {
+ const char* method = req.method ? req.method : "GET";
+ const char* rawPath = req.path ? req.path : "/";
+
+ // RPC envelope는 "led/on"처럼 선행 '/' 없이 올 수 있음
+ char normPath[128];
+ const char* path = rawPath;
+ if (rawPath[0] != '/') {
+   snprintf(normPath, sizeof(normPath), "/%s", rawPath);
+   path = normPath;
+ }
+
+ metrics_.tunnel.requests++;
+
+ // 응답 압축 협상: body가 bytes로 나가는 proxy / binary 응답만 (HTTP_RES / RPC는 텍스트 그대로)
+ if (cfg_.tunnelCompress && res.format_ == TunnelHttpResponseWriter::kFormatProxy) {
+   size_t aeLen = 0;
+   const char* ae = req.getHeader("Accept-Encoding", &aeLen);
+   if (ae) res.acceptEnc_ = encodingFromAccept(ae, aeLen);
+ }
+
+ // 예약 path: 내장 metrics (Config::serveMetrics)
+ if (cfg_.serveMetrics && strcmp(path, kMetricsPath) == 0) {
    res.setHeader("Content-Type", "application/json");
-   char minBody[128];
-   int n = snprintf(minBody, sizeof(minBody), "{\"ok\":true,\"request_id\":\"%s\"}", reqId[0] ? reqId : "");
-   if (n > 0 && (size_t)n < sizeof(minBody)) res.write(minBody);
+   size_t cap = sizeof(res.body_) - 1 - res.bodyLen_;
+   char* out = (char*)res.body_ + res.bodyLen_;
+   size_t n = formatMetricsJson(getMetrics(), out, cap + 1, true);
+   if (n == 0) n = formatMetricsJson(metrics_, out, cap + 1, false);  // 버퍼 부족 → 요약
+   res.bodyLen_ += n;
+   res.bodyTotal_ += n;
    res.end();
+   return;
+ }
+
+#if ORBISYNC_TASK_MODE
+ if (netTask_ && taskHandoffRequest(req, res, method, path)) return;
+#endif
+ tunnelServeHandlers(req, res, method, path);
+}
+
+void OrbiSyncNode::tunnelServeHandlers(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res,
+                                       const char* method, const char* path) {
+ HttpRequestCallback route = findRoute(method, path);
+ if (route) {
+   uint32_t t0 = micros();
+   route(req, res);
+   metrics_.tunnel.handlerUs.record(micros() - t0);
+   if (!res.ended_ && !res.deferred_) res.end();
+   return;
+ }
+
+ if (requestHandler_) {
+   Request r = {Protocol::WS, method, path, req.body, req.bodyLen};
+   Response out = {200, nullptr, nullptr, 0};
+   uint32_t t0 = micros();
+   bool handled = requestHandler_(r, out);
+   metrics_.tunnel.handlerUs.record(micros() - t0);
+   if (handled) {
+     res.setStatus(out.status ? out.status : 200);
+     if (out.content_type) res.setHeader("Content-Type", out.content_type);
+     if (out.body && out.body_len) res.write(out.body, out.body_len);
+     res.end();
+     return;
+   }
  }
 
  if (httpRequestCb_) {
+   uint32_t t0 = micros();
    httpRequestCb_(req, res);
+   metrics_.tunnel.handlerUs.record(micros() - t0);
+   if (!res.ended_ && !res.deferred_) res.end();
+   return;
+ }
+
+ // 내장 LED 제어 (LOW = ON for most ESP boards)
+ bool ledOn = (strcmp(path, "/led/on") == 0);
+ bool ledOff = (strcmp(path, "/led/off") == 0);
+ if (ledOn || ledOff) {
+   res.setHeader("Content-Type", "application/json");
+   if (cfg_.ledPin < 0) {
+     ORBI_LOGE("[HTTP_REQ] ERROR: LED pin not configured\n");
+     res.setStatus(500);
+     res.write("{\"ok\":false,\"error\":\"led_pin_not_configured\"}");
+     res.end();
+     return;
+   }
+   int value = ledOn ? 1 : 0;
+   if (ledOn && req.body && req.bodyLen) {
+     StaticJsonDocument<64> b;
+     if (!deserializeJson(b, req.body, req.bodyLen)) value = b["value"] | 1;
+   }
+   digitalWrite(cfg_.ledPin, value ? LOW : HIGH);
+   ORBI_LOGD("[HTTP_REQ] LED turned %s\n", value ? "ON" : "OFF");
+   res.setStatus(200);
+   res.write(value ? "{\"ok\":true,\"value\":1}" : "{\"ok\":true,\"value\":0}");
+   res.end();
+   return;
+ }
+
+ res.setStatus(404);
+ res.setHeader("Content-Type", "application/json");
+ res.write("{\"ok\":false,\"error\":\"not_found\"}");
+ res.end();
+}
+
+// -----------------------------
+// Binary tunnel frame (register에서 binary_frames 협상, JSON은 fallback)
+// -----------------------------
+// [0] ver [1] type [2] flags [3] id_len [4..5] status(BE) [6..7] seq(BE) [8] header_count
+// id, REQUEST면 (u8 method_len, method, u16 path_len, path, u16 query_len, query),
+// headers × header_count (u8 key_len, key, u16 value_len, value), 나머지 = raw body
+
+// p에서 n바이트 소비 (부족하면 nullptr)
+static const uint8_t* binTake(const uint8_t*& p, size_t& left, size_t n) {
+ if (n > left) return nullptr;
+ const uint8_t* r = p;
+ p += n;
+ left -= n;
+ return r;
+}
+
+// 길이 prefix 문자열을 prefix 자리로 당겨 그 자리에서 NUL 종료 (복사 버퍼/잘림 없음)
+// [len][b0..bn-1] → [b0..bn-1][\0] : 자기 필드 범위 안에서만 쓰므로 뒤 필드는 그대로
+static const char* binTakeStrInPlace(uint8_t*& p, size_t& left, uint8_t prefixLen, size_t& outLen) {
+ if (prefixLen > left) return nullptr;
+ size_t n = (prefixLen == 2) ? (size_t)((p[0] << 8) | p[1]) : p[0];
+ if (prefixLen + n > left) return nullptr;
+ char* dst = (char*)p;
+ memmove(dst, p + prefixLen, n);
+ dst[n] = '\0';  // prefixLen >= 1 이므로 필드 마지막 바이트 이내
+ p += prefixLen + n;
+ left -= prefixLen + n;
+ outLen = n;
+ return dst;
+}
+
+// 길이 prefix(1 또는 2바이트) 문자열을 dst로 복사 (잘림 허용). 형식 오류면 false
+static bool binTakeStr(const uint8_t*& p, size_t& left, uint8_t prefixLen, char* dst, size_t dstSz) {
+ const uint8_t* lp = binTake(p, left, prefixLen);
+ if (!lp) return false;
+ size_t n = (prefixLen == 2) ? (size_t)((lp[0] << 8) | lp[1]) : lp[0];
+ const uint8_t* src = binTake(p, left, n);
+ if (!src) return false;
+ size_t cp = n < dstSz - 1 ? n : dstSz - 1;
+ memcpy(dst, src, cp);
+ dst[cp] = '\0';
+ return true;
+}
+
+/// Hub → Node binary frame (WStype_BIN). body는 payload를 그대로 가리킴 (base64/복사 없음)
+void OrbiSyncNode::tunnelHandleBinaryMessage(uint8_t* payload, size_t len) {
+ metrics_.tunnel.rxFrames++;
+ metrics_.tunnel.rxBytes += len;
+ if (!payload || len < kBinFrameHeaderLen || payload[0] != kBinFrameVersion) {
+   ORBI_LOGW("[TUNNEL] rx BIN len=%u (unknown format, ignored)\n", (unsigned)len);
+   return;
+ }
+ if (payload[1] != kBinTypeRequest) {
+   if (cfg_.debugHttp) ORBI_LOGD("[TUNNEL] rx BIN type=%u len=%u (ignored)\n", payload[1], (unsigned)len);
+   return;
+ }
+
+ const uint8_t* p = payload + kBinFrameHeaderLen;
+ size_t left = len - kBinFrameHeaderLen;
+ uint8_t headerCount = payload[8];
+
+ char reqId[48];
+ char method[12];
+ char path[128];
+ char query[128];
+ const uint8_t* idp = binTake(p, left, payload[3]);
+ bool ok = idp != nullptr;
+ if (ok) {
+   size_t cp = payload[3] < sizeof(reqId) - 1 ? payload[3] : sizeof(reqId) - 1;
+   memcpy(reqId, idp, cp);
+   reqId[cp] = '\0';
+ }
+ ok = ok && binTakeStr(p, left, 1, method, sizeof(method));
+ ok = ok && binTakeStr(p, left, 2, path, sizeof(path));
+ ok = ok && binTakeStr(p, left, 2, query, sizeof(query));
+
+ // header는 payload 안에서 view로 (초과분은 건너뜀)
+ TunnelHttpRequest req = {};
+ uint8_t* hp = payload + (p - payload);
+ for (uint8_t i = 0; ok && i < headerCount; i++) {
+   size_t kl = 0, vl = 0;
+   const char* k = binTakeStrInPlace(hp, left, 1, kl);
+   const char* v = k ? binTakeStrInPlace(hp, left, 2, vl) : nullptr;
+   ok = v != nullptr;
+   if (ok) req.addHeader(k, kl, v, vl);
+ }
+ p = hp;
+ if (!ok) {
+   ORBI_LOGW("[TUNNEL] rx BIN malformed len=%u\n", (unsigned)len);
+   return;
+ }
+
+ req.requestId = reqId;
+ req.streamId = reqId;
+ req.tunnelId = nodeId_;
+ req.method = method[0] ? method : "GET";
+ req.path = path[0] ? path : "/";
+ req.query = query;
+ req.body = left ? p : nullptr;
+ req.bodyLen = left;
+
+ ORBI_LOGD("[HTTP_TUNNEL] bin req_id=%s method=%s path=%s body_len=%u\n", reqId, req.method, req.path, (unsigned)left);
+ if (!tunnelInflateRequest(req, true)) return;
+
+ TunnelHttpResponseWriter* res = tunnelAcquireStream(reqId, TunnelHttpResponseWriter::kFormatProxy, true, false);
+ if (res) tunnelServeHttpRequest(req, *res);
+}
+
+/// binary 응답 frame 전송 (sendBIN, raw body)
+bool OrbiSyncNode::tunnelSendBinaryFrame(TunnelHttpResponseWriter& res, bool chunk, bool final) {
+ if (!tunnelTxReady() && !cfg_.tunnelOutbox) return false;
+
+ // 압축 body는 B64 영역에 (binary 응답은 base64를 쓰지 않음)
+ const uint8_t* body = res.body_;
+ size_t bodyLen = res.bodyLen_;
+ bool zHeap = false;
+ uint8_t* z = nullptr;
+ if (tunnelCompressBegin(res, chunk)) {
+   z = (uint8_t*)arenaTake(ARENA_TX_B64, deflateBound(res.bodyLen_), zHeap);
+   if (!z) return false;
+   bodyLen = tunnelCompressBody(res, z, !chunk || final);
+   body = z;
+ }
+
+ bool head = !chunk || res.chunkSeq_ == 0;
+ size_t idLen = strlen(res.requestId_);
+ size_t total = kBinFrameHeaderLen + idLen + bodyLen;
+ if (head) {
+   for (uint8_t i = 0; i < res.headerCount_; i++) {
+     total += 1 + strlen(res.headers_[i].key) + 2 + strlen(res.headers_[i].value);
+   }
  }
 
- if (bodyDec) free(bodyDec);
- if (!res.ended_) res.end();
+ bool heap;
+ uint8_t* buf = (uint8_t*)arenaTake(ARENA_TX_OUT, total, heap);
+ if (!buf) {
+   if (z) arenaGive(z, zHeap);
+   return false;
+ }
+
+ uint8_t* p = buf;
+ *p++ = kBinFrameVersion;
+ *p++ = chunk ? kBinTypeResponseChunk : kBinTypeResponse;
+ *p++ = (!chunk || final) ? kBinFlagFinal : 0;
+ *p++ = (uint8_t)idLen;
+ p = binPut16(p, (uint16_t)res.statusCode_);
+ p = binPut16(p, res.chunkSeq_);
+ *p++ = head ? res.headerCount_ : 0;
+ memcpy(p, res.requestId_, idLen);
+ p += idLen;
+ if (head) {
+   for (uint8_t i = 0; i < res.headerCount_; i++) {
+     size_t kl = strlen(res.headers_[i].key);
+     size_t vl = strlen(res.headers_[i].value);
+     *p++ = (uint8_t)kl;
+     memcpy(p, res.headers_[i].key, kl);
+     p += kl;
+     p = binPut16(p, (uint16_t)vl);
+     memcpy(p, res.headers_[i].value, vl);
+     p += vl;
+   }
+ }
+ memcpy(p, body, bodyLen);
+
+ bool ok = tunnelSendOrQueue(buf, total, true, outboxIdHash(res.requestId_, chunk ? res.chunkSeq_ + 1u : 0));
+ arenaGive(buf, heap);
+ if (z) arenaGive(z, zHeap);
+ return ok;
 }
 
 void OrbiSyncNode::tunnelSendProxyResponse(TunnelHttpResponseWriter& res) {
- if (!s_wsClient || !s_wsClient->isConnected()) return;
+ if (res.format_ != TunnelHttpResponseWriter::kFormatProxy) {
+   tunnelSendEnvelopeResponse(res);
+   return;
+ }
+
+ // 이미 chunk를 보내는 중이면 남은 버퍼를 마지막 조각으로
+ if (res.chunkSeq_ > 0) {
+   tunnelSendProxyChunk(res, true);
+ } else {
+   tunnelSendProxyFrame(res, false, false);
+ }
 
- size_t b64Len = (res.bodyLen_ / 3 + 1) * 4 + 1;
- char* b64 = (char*)malloc(b64Len);
- if (!b64) return;
+ ORBI_LOGD("[HTTP_RESP] status=%d len=%u chunks=%u\n", res.statusCode_, (unsigned)res.bodyTotal_, (unsigned)res.chunkSeq_);
+}
 
- base64Encode(b64, res.body_, res.bodyLen_);
+void OrbiSyncNode::tunnelSendProxyChunk(TunnelHttpResponseWriter& res, bool final) {
+ // handler 안의 write()가 버퍼를 비워야 함 (기다릴 곳 없음) → window를 넘겨 보냄
+ if (!flowAllows(res.frameCost(res.bodyLen_))) metrics_.tunnel.flowOverruns++;
+ if (!tunnelSendProxyFrame(res, true, final)) {
+   ORBI_LOGW("[HTTP_RESP] chunk send failed seq=%u\n", (unsigned)res.chunkSeq_);
+ }
+ res.chunkSeq_++;
+ res.bodyLen_ = 0;
+}
 
- StaticJsonDocument<1024> doc;
- doc["type"] = "proxy_response";
- doc["request_id"] = res.requestId_;
- doc["status_code"] = res.statusCode_;
+/// HTTP_REQ → HTTP_RES, RPC envelope → {id, status, body} 응답 (body는 텍스트/JSON 그대로)
+void OrbiSyncNode::tunnelSendEnvelopeResponse(TunnelHttpResponseWriter& res) {
+ // body_는 용량 +1이라 항상 NUL 종료 가능
+ res.body_[res.bodyLen_] = '\0';
+ const char* bodyText = (const char*)res.body_;
 
- JsonObject headersObj = doc.createNestedObject("headers");
+ const char* contentType = nullptr;
  for (uint8_t i = 0; i < res.headerCount_; i++) {
-   headersObj[res.headers_[i].key] = res.headers_[i].value;
+   if (strcasecmp(res.headers_[i].key, "Content-Type") == 0) contentType = res.headers_[i].value;
+ }
+
+ StaticJsonDocument<kTunnelHttpTxDocBytes> doc;
+ if (res.format_ == TunnelHttpResponseWriter::kFormatHttpRes) {
+   doc["type"] = "HTTP_RES";
+   doc["stream_id"] = (const char*)res.requestId_;  // 요청과 동일한 stream_id 사용
+   doc["status"] = res.statusCode_;
+   JsonObject headersObj = doc.createNestedObject("headers");
+   for (uint8_t i = 0; i < res.headerCount_; i++) {
+     headersObj[(const char*)res.headers_[i].key] = (const char*)res.headers_[i].value;
+   }
+   if (!contentType) headersObj["content-type"] = "text/plain";
+   doc["body"] = bodyText;
+ } else {
+   if (res.idNumeric_) doc["id"] = atol(res.requestId_);
+   else doc["id"] = (const char*)res.requestId_;
+   doc["status"] = res.statusCode_;
+   // JSON body는 객체로 그대로 삽입, 그 외는 문자열
+   if (res.bodyLen_ > 0 && contentType && strstr(contentType, "json")) doc["body"] = serialized(bodyText, res.bodyLen_);
+   else doc["body"] = bodyText;
+ }
+
+ size_t outLen = measureJson(doc) + 1;
+ bool outHeap;
+ char* out = (char*)arenaTake(ARENA_TX_OUT, outLen, outHeap);
+ bool sent = false;
+ if (out) {
+   size_t n = serializeJson(doc, out, outLen);
+   if (n > 0 && n < outLen) {
+     out[n] = '\0';
+     sent = tunnelSendOrQueue((const uint8_t*)out, n, false, outboxIdHash(res.requestId_, 0));
+   }
+   arenaGive(out, outHeap);
+ }
+
+ if (sent) {
+   ORBI_LOGD("[HTTP_RES] sent id=%s status=%d len=%u\n", res.requestId_, res.statusCode_, (unsigned)res.bodyLen_);
+ } else {
+   ORBI_LOGE("[HTTP_RES] FAILED to send id=%s status=%d (WS not connected?)\n", res.requestId_, res.statusCode_);
+ }
+}
+
+bool OrbiSyncNode::tunnelSendProxyFrame(TunnelHttpResponseWriter& res, bool chunk, bool final) {
+ if (res.binary_) return tunnelSendBinaryFrame(res, chunk, final);
+ if (!tunnelTxReady() && !cfg_.tunnelOutbox) return false;
+
+ // 압축 body는 잠시 OUT 영역에 (base64로 옮긴 뒤 frame 직렬화에 다시 사용)
+ const uint8_t* body = res.body_;
+ size_t bodyLen = res.bodyLen_;
+ bool zHeap = false;
+ uint8_t* z = nullptr;
+ if (tunnelCompressBegin(res, chunk)) {
+   z = (uint8_t*)arenaTake(ARENA_TX_OUT, deflateBound(res.bodyLen_), zHeap);
+   if (!z) return false;
+   bodyLen = tunnelCompressBody(res, z, !chunk || final);
+   body = z;
  }
 
- doc["body"] = b64;
+ size_t b64Len = base64EncodedLen(bodyLen) + 1;
+ bool b64Heap;
+ char* b64 = (char*)arenaTake(ARENA_TX_B64, b64Len, b64Heap);
+ if (!b64) {
+   if (z) arenaGive(z, zHeap);
+   return false;
+ }
+
+ base64Encode(b64, body, bodyLen);
+ if (z) arenaGive(z, zHeap);
+
+ StaticJsonDocument<kTunnelProxyTxDocBytes> doc;
+ doc["type"] = chunk ? "proxy_response_chunk" : "proxy_response";
+ doc["request_id"] = (const char*)res.requestId_;
+ if (chunk) {
+   doc["seq"] = res.chunkSeq_;
+   doc["final"] = final;
+ }
 
- char buf[1536];
- size_t n = serializeJson(doc, buf, sizeof(buf));
- if (n > 0 && n < sizeof(buf)) {
-   buf[n] = '\0';
-   tunnelSendText(buf);
+ // status/headers는 단일 응답 또는 첫 chunk에만
+ if (!chunk || res.chunkSeq_ == 0) {
+   doc["status_code"] = res.statusCode_;
+   JsonObject headersObj = doc.createNestedObject("headers");
+   for (uint8_t i = 0; i < res.headerCount_; i++) {
+     headersObj[(const char*)res.headers_[i].key] = (const char*)res.headers_[i].value;
+   }
+ }
+
+ // const char*로 넣어 문서에 복사하지 않음 (base64 body가 문서 용량을 넘지 않도록)
+ doc["body"] = (const char*)b64;
+
+ size_t outLen = measureJson(doc) + 1;
+ bool outHeap;
+ char* out = (char*)arenaTake(ARENA_TX_OUT, outLen, outHeap);
+ bool ok = false;
+ if (out) {
+   size_t n = serializeJson(doc, out, outLen);
+   if (n > 0 && n < outLen) {
+     out[n] = '\0';
+     ok = tunnelSendOrQueue((const uint8_t*)out, n, false, outboxIdHash(res.requestId_, chunk ? res.chunkSeq_ + 1u : 0));
+   }
+   arenaGive(out, outHeap);
  }
- free(b64);
+ arenaGive(b64, b64Heap);
+ return ok;
+}
 
- Serial.printf("[HTTP_RESP] status=%d len=%u\n", res.statusCode_, (unsigned)res.bodyLen_);
+// -----------------------------
+// 메모리 budget 보고 (Config::memoryReport 또는 직접 호출)
+// -----------------------------
+// static: 이 파일의 정적 버퍼 sizeof (profile 적용 결과). heap: 지금까지 확보한 것 (아직 안 쓴 기능은 0)
+// stack est: subsystem별 가장 큰 지역 버퍼. measured: 실제 peak (subsystem 구분 없이 전체)
+void OrbiSyncNode::logMemoryBudget() {
+ size_t hubStatic = sizeof(s_http) + sizeof(s_httpConn) + sizeof(s_hubRxDoc) + sizeof(s_httpResp) +
+                    sizeof(s_hubRxFilter) + sizeof(s_hubRxBody) + sizeof(s_pairBuf) +
+                    sizeof(s_approveBuf) + sizeof(s_regSlotBuf) + sizeof(s_heartbeatBuf);
+ size_t tlsStatic = sizeof(s_tls) + sizeof(s_plain);
+#if defined(ESP8266) && ORBISYNC_TLS_SESSION_CACHE
+ tlsStatic += sizeof(s_tlsSession) + sizeof(s_tlsSessionHost);
+#endif
+ size_t dnsStatic = 0;
+#if ORBISYNC_DNS_CACHE
+ dnsStatic = sizeof(s_dnsCache);
+#endif
+ size_t tunnelStatic = sizeof(s_link) + sizeof(s_tunnelRxDoc) +
+                       sizeof(s_outbox) + sizeof(s_outboxRecent);
+#if ORBISYNC_WS_STATIC_CLIENT
+ tunnelStatic += sizeof(s_wsClientStorage);
+#endif
+ size_t taskStatic = 0;
+#if ORBISYNC_TASK_MODE
+ taskStatic = sizeof(s_taskEvents) + sizeof(s_taskRequests) + sizeof(s_taskWriterOps) + sizeof(s_taskSends);
+#endif
+ size_t nodeBytes = sizeof(*this);
+
+ ORBI_LOGI("[MEM] profile=%s token=%u hub_err=%u hub_doc=%u body=%u rx_doc=%u streams=%u\n",
+           limits::kProfile == ORBISYNC_PROFILE_SMALL ? "SMALL" : "LARGE",
+           (unsigned)limits::kTokenBytes, (unsigned)limits::kHubErrBodyBytes, (unsigned)limits::kHubDocBytes,
+           (unsigned)limits::kTunnelBodyBytes, (unsigned)limits::kTunnelRxDocBytes, (unsigned)ORBISYNC_TUNNEL_MAX_STREAMS);
+ ORBI_LOGI("[MEM] static hub_http=%u tls=%u dns=%u tunnel=%u task=%u node=%u (streams=%u commands=%u templates=%u) total=%u\n",
+           (unsigned)hubStatic, (unsigned)tlsStatic, (unsigned)dnsStatic, (unsigned)tunnelStatic,
+           (unsigned)taskStatic, (unsigned)nodeBytes, (unsigned)sizeof(streams_),
+           (unsigned)(sizeof(cmdInbox_) + sizeof(cmdAcks_) + sizeof(cmdAckPending_)), (unsigned)sizeof(tpl_),
+           (unsigned)(hubStatic + tlsStatic + dnsStatic + tunnelStatic + taskStatic + nodeBytes));
+
+ size_t arenaBytes = s_tunnelArena ? kArenaTxB64Bytes + kArenaTxOutBytes : 0;
+ size_t batchBytes = s_link.txBatch ? limits::kTunnelBatchBytes : 0;
+ size_t outboxBytes = s_outbox.buf ? limits::kOutboxBytes : 0;
+ size_t zBytes = deflateHeapBytes() + s_inflateCap;
+ size_t taskStack = 0;
+#if ORBISYNC_TASK_MODE
+ if (netTask_) taskStack = cfgOrDefaultU32(cfg_.taskStackBytes, kDefaultTaskStackBytes);
+#endif
+#if defined(ESP8266)
+ uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+#else
+ uint32_t maxBlock = ESP.getMaxAllocHeap();
+#endif
+ ORBI_LOGI("[MEM] heap arena=%u batch=%u outbox=%u deflate=%u tls_io=%u task_stack=%u free=%u max_block=%u\n",
+           (unsigned)arenaBytes, (unsigned)batchBytes, (unsigned)outboxBytes, (unsigned)zBytes,
+           (unsigned)(limits::kTlsRxBytes + limits::kTlsTxBytes), (unsigned)taskStack,
+           (unsigned)ESP.getFreeHeap(), (unsigned)maxBlock);
+
+ ORBI_LOGI("[MEM] stack est hub_req=%u ws_auth=%u register=%u tx_doc=%u\n",
+           (unsigned)kHttpReqHeaderBytes, (unsigned)(limits::kTokenBytes + 16),
+           (unsigned)(sizeof(tpl_.reg) + limits::kTokenBytes + 64),
+           (unsigned)sizeof(StaticJsonDocument<kTunnelProxyTxDocBytes>));
+#if defined(ESP8266)
+ // cont stack 4KB, getFreeContStack은 부팅 후 최소 여유 (painted stack 검사)
+ uint32_t contFree = ESP.getFreeContStack();
+ ORBI_LOGI("[MEM] stack measured cont peak=%u free_min=%u\n", (unsigned)(4096 - contFree), (unsigned)contFree);
+#elif ORBISYNC_TASK_MODE
+ // ESP32 high-water mark = 최소 여유 bytes. 현재 task(loop 또는 network task) + network task
+ ORBI_LOGI("[MEM] stack measured this_task free_min=%u net_task free_min=%u\n",
+           (unsigned)uxTaskGetStackHighWaterMark(nullptr),
+           netTask_ ? (unsigned)uxTaskGetStackHighWaterMark((TaskHandle_t)netTask_) : 0u);
+#endif
 }
 
 } // namespace OrbiSyncNode
@@ -11,6 +11,11 @@
  
  #include <stdint.h>
  #include <stddef.h>
+
+ #include "OrbiSyncLimits.h"
+ #include "OrbiSyncMetrics.h"
+ #include "OrbiSyncQueue.h"
+ #include "OrbiSyncDeflate.h"
  
  #define ORBISYNC_HAS_TUNNEL_CONFIG 1
  #define ORBISYNC_HAS_TUNNEL_STATES 1
@@ -32,7 +37,19 @@ enum class State {
 
 enum class Protocol { HTTP, WS };
  
-#define TUNNEL_MAX_HEADERS 8
+/// 크기 한도는 OrbiSyncLimits.h (profile). 아래 이름은 호환용
+#define TUNNEL_MAX_HEADERS ORBISYNC_TUNNEL_MAX_HEADERS
+#define TUNNEL_MAX_RESPONSE_HEADERS ORBISYNC_TUNNEL_MAX_RESPONSE_HEADERS
+#define TUNNEL_RESPONSE_BODY_MAX ORBISYNC_TUNNEL_BODY_BYTES
+/// 요청 header view: 수신 JSON 문서 / binary frame을 가리킴 (복사·잘림 없음, handler 호출 동안만 유효)
+struct TunnelHeaderView {
+  const char* key;    /// NUL 종료
+  const char* value;  /// NUL 종료
+  uint16_t keyLen;
+  uint16_t valueLen;
+  uint16_t hash;      /// 대소문자 무시 key hash (getHeader 비교용)
+};
+
 /// Hub → Node HTTP 요청 구조체
 struct TunnelHttpRequest {
   const char* requestId;
@@ -44,15 +61,20 @@ struct TunnelHttpRequest {
   const uint8_t* body;
   size_t bodyLen;
 
-  const char* getHeader(const char* key) const;
+  /// 대소문자 무시 header 조회. outLen != nullptr면 값 길이
+  const char* getHeader(const char* key, size_t* outLen = nullptr) const;
+  /// view 추가 (key/value는 NUL 종료, 요청 처리 동안 유지돼야 함). 가득 차면 false
+  bool addHeader(const char* key, size_t keyLen, const char* value, size_t valueLen);
+  static uint16_t headerHash(const char* key, size_t len);
 
   uint8_t headerCount;
-  struct { char key[24]; char value[80]; } headers[TUNNEL_MAX_HEADERS];
+  TunnelHeaderView headers[TUNNEL_MAX_HEADERS];
 };
 
 class OrbiSyncNode;
 
-/// Node → Hub HTTP 응답 작성기 (2KB body 버퍼)
+/// Node → Hub HTTP 응답 작성기 (body 버퍼 TUNNEL_RESPONSE_BODY_MAX)
+/// Config::tunnelStreamResponses면 버퍼가 찰 때마다 proxy_response_chunk frame으로 flush (크기 제한 없음)
 class TunnelHttpResponseWriter {
   public:
    void setStatus(int code);
@@ -60,21 +82,88 @@ class TunnelHttpResponseWriter {
    void write(const uint8_t* data, size_t len);
    void write(const char* str);
    void end();
+   /// handler 리턴 후에도 응답을 열어둠. 이후 loopTick()에서 findTunnelStream(id)로 다시 찾아 write/end
+   void defer() { deferred_ = true; }
+   bool isDeferred() const { return deferred_; }
+   const char* streamId() const { return requestId_; }
+   /// Hub flow window를 넘지 않고 지금 write할 수 있는 bytes (streaming이면 현재 버퍼 + window가 받을 수 있는 chunk 하나)
+   /// deferred handler가 큰 응답을 나눠 쓸 때 0이면 다음 loopTick에 이어서 씀
+   size_t writable() const;
  
   private:
    friend class OrbiSyncNode;
    TunnelHttpResponseWriter();
+   void reset(void* node, uint8_t format, bool binary, bool streaming);
+   size_t frameCost(size_t bodyLen) const;  /// flow window에 대한 응답 frame 크기 추정
    void* node_;
    char requestId_[48];
    int statusCode_;
    uint8_t headerCount_;
-   struct { char key[24]; char value[80]; } headers_[TUNNEL_MAX_HEADERS];
-   uint8_t body_[2048];
+   struct { char key[24]; char value[80]; } headers_[TUNNEL_MAX_RESPONSE_HEADERS];
+   enum : uint8_t { kFormatProxy, kFormatHttpRes, kFormatRpc };  /// 응답 frame 형식 (요청 형식을 따름)
+   uint8_t body_[TUNNEL_RESPONSE_BODY_MAX + 1];  /// +1: 텍스트 응답(HTTP_RES/RPC)용 NUL
    size_t bodyLen_;
+   size_t bodyTotal_;   /// 지금까지 write된 전체 바이트 (flush된 chunk 포함)
+   uint16_t chunkSeq_;  /// 전송한 chunk 수 (0이면 단일 proxy_response)
+   uint8_t format_;
+   bool idNumeric_;     /// RPC id가 숫자였음
+   bool streaming_;
+   bool binary_;        /// binary 요청에 대한 응답 (sendBIN, base64 없음)
+   bool truncated_;
    bool ended_;
+   bool inUse_;         /// stream pool slot 점유 중
+   bool deferred_;
+   bool taskOpPending_; /// task mode: end/chunk를 network task에 넘기고 처리 대기 중
+   bool flowHeld_;      /// end/chunk가 Hub flow window를 기다리는 중 (tunnelPollStreams가 credit 뒤 전송)
+   uint32_t startedMs_;
+   uint8_t acceptEnc_;  /// 요청 Accept-Encoding으로 고른 encoding (Config::tunnelCompress, proxy/binary 응답만)
+   uint8_t contentEnc_; /// 첫 frame에서 압축을 시작했으면 그 encoding (이후 chunk도 같은 stream)
+   DeflateStream deflate_;
  };
  
  typedef void (*HttpRequestCallback)(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res);
+
+/// 1이면 RAM outbox가 가득 찼을 때 sendTunnelEvent(persist=true) 메시지를 LittleFS에 보관 (토큰/응답은 제외)
+#ifndef ORBISYNC_OUTBOX_SPILL
+#define ORBISYNC_OUTBOX_SPILL 0
+#endif
+#ifndef ORBISYNC_OUTBOX_SPILL_BYTES
+#define ORBISYNC_OUTBOX_SPILL_BYTES 16384
+#endif
+
+/// WS 연결 하나를 공유할 수 있는 노드 수 (Config::tunnelMultiplex, 연결을 연 노드 포함)
+#ifndef ORBISYNC_TUNNEL_MAX_NODES
+#define ORBISYNC_TUNNEL_MAX_NODES 4
+#endif
+
+/// ESP32 task mode (Config::taskMode) 포함 여부. host 빌드 등 FreeRTOS가 없으면 0
+#ifndef ORBISYNC_TASK_MODE
+#if defined(ESP32)
+#define ORBISYNC_TASK_MODE 1
+#else
+#define ORBISYNC_TASK_MODE 0
+#endif
+#endif
+
+/// task mode network task 우선순위 (Arduino loop task = 1)
+#ifndef ORBISYNC_TASK_PRIORITY
+#define ORBISYNC_TASK_PRIORITY 2
+#endif
+
+#ifndef ORBISYNC_MAX_ROUTES
+#define ORBISYNC_MAX_ROUTES 8
+#endif
+
+#ifndef ORBISYNC_MAX_COMMANDS
+#define ORBISYNC_MAX_COMMANDS 8
+#endif
+ /// 터널 요청 route (method nullptr/"*" = 모든 method, prefix는 segment 단위 매칭)
+ struct TunnelRoute {
+   const char* method;
+   const char* prefix;
+   uint8_t prefixLen;
+   HttpRequestCallback handler;
+ };
  
  struct Config {
    const char* hubBaseUrl;          // "https://hub.orbisync.io" 권장
@@ -121,6 +210,37 @@ class TunnelHttpResponseWriter {
  
    size_t maxTunnelBodyBytes;       // default 4096
    uint32_t tunnelReconnectMs;      // default 5000
+
+   bool httpKeepAlive;              // true면 Hub HTTP 연결 재사용 (Connection: keep-alive)
+   bool asyncHttp;                  // true면 Hub 요청을 loopTick마다 나눠 처리 (블로킹 대기 없음)
+   bool tunnelStreamResponses;      // true면 큰 터널 응답을 proxy_response_chunk로 분할 전송 (Hub 지원 필요)
+   bool tunnelBinaryFrames;         // true면 binary WS frame 지원을 register에 알림 (raw body, base64 없음)
+   uint32_t tunnelDeferTimeoutMs;   // deferred 응답 최대 대기 (0이면 10000ms), 초과 시 504
+   bool serveMetrics;               // true면 터널 요청 /__orbisync/metrics 에 getMetrics() JSON 응답
+   const char* heartbeatEndpointPath; // 터널이 없을 때 HTTP heartbeat (기본 "/api/device/heartbeat")
+   uint8_t scheduleJitterPct;       // 재시도 타이머 ±% 분산 (0이면 20)
+   uint32_t sessionLongPollMs;      // >0이면 session 요청을 Hub가 최대 이 시간 동안 보류 (long-poll, asyncHttp 권장)
+   bool tunnelBatchFrames;          // true면 등록 후 송신 메시지를 JSON 배열 frame 하나로 묶음 (Hub 지원 필요)
+   uint16_t tunnelBatchMaxDelayMs;  // batch 최대 보류 시간 (0이면 매 loopTick 끝에 flush)
+   bool taskMode;                   // (ESP32) true면 상태머신/터널을 taskCore의 별도 task에서 실행, handler/콜백은 loopTick에서
+   uint8_t taskCore;                // task mode network task core (기본 0, loop()는 core 1)
+   uint32_t taskStackBytes;         // task mode network task stack (0이면 8192)
+   bool idleWait;                   // (ESP32) true면 loopTick이 nextWakeupMs()까지 대기 (CPU idle → modem/auto light sleep)
+   uint16_t idleWaitMaxMs;          // idleWait 상한 = 열린 소켓(WS/Hub HTTP) 확인 주기 (0이면 50)
+   bool tunnelMultiplex;            // true면 같은 tunnel_url의 다른 노드와 WS 연결 하나를 공유 (frame은 node_id로 구분, Hub 지원 필요)
+   uint32_t dnsCacheTtlMs;          // Hub host DNS 결과 유지 시간 (0이면 300000, ORBISYNC_DNS_CACHE=1일 때)
+   bool tunnelOutbox;               // true면 터널이 끊긴 동안 응답/sendTunnelEvent 메시지를 보관, register_ack 후 순서대로 전송
+   bool memoryReport;               // true면 첫 loopTick과 첫 터널 등록 때 logMemoryBudget() 출력
+   bool tunnelCompress;             // true면 proxy 응답을 Accept-Encoding(gzip/deflate)에 따라 압축, 압축된 요청 body는 해제
+   uint16_t tunnelCompressMinBytes; // 이보다 작은 응답은 압축하지 않음 (0이면 256)
+ };
+
+ /// Hub/터널 URL 파싱 결과 (hubBaseUrl은 생성자에서 한 번 파싱해 노드가 보관)
+ struct ParsedBaseUrl {
+   char host[128];
+   uint16_t port;
+   bool useTls;
+   char basePath[128]; // optional, 끝 '/' 제거
  };
  
  struct Request {
@@ -144,6 +264,35 @@ class TunnelHttpResponseWriter {
  typedef void (*TunnelChangeCB)(bool connected, const char* url);
  typedef bool (*RequestHandler)(const Request& req, Response& resp);
  typedef void (*TunnelMessageCB)(const char* json);
+ /// 송신 frame tap (benchmark/replay용 loopback). true 반환 = 전송 성공으로 처리
+ typedef bool (*TunnelTapCB)(const uint8_t* data, size_t len, bool binary);
+
+ /// Hub command (heartbeat/session 응답의 "commands" 배열, 또는 터널 "command" / "commands" 메시지)
+ struct Command {
+   const char* id;
+   const char* name;
+   const char* args;  // JSON 텍스트 (없으면 "{}"). handler 호출 동안만 유효
+   size_t argsLen;
+ };
+ /// loopTick(사용자 core)에서 호출. true = 성공 (ack ok)
+ typedef bool (*CommandHandler)(const Command& cmd);
+
+ struct CommandRoute {
+   const char* name;
+   CommandHandler handler;
+ };
+ /// 내부: 실행 대기 command (network → loopTick)
+ struct CommandSlot {
+   char id[40];
+   char name[32];
+   char args[limits::kCommandArgsBytes];
+   uint16_t argsLen;
+ };
+ /// 내부: Hub로 보낼 실행 결과 (loopTick → network)
+ struct CommandAck {
+   char id[40];
+   uint8_t result;  // CommandResult (cpp)
+ };
  
 /// ESP32 터널 연결 및 HTTP 요청 처리 담당 클래스
 class OrbiSyncNode {
@@ -153,6 +302,7 @@ class OrbiSyncNode {
    /// WiFi 연결 시작
    void beginWiFi(const char* ssid, const char* pass);
    /// 메인 루프 (상태머신 실행)
+   /// task mode: 첫 호출에서 network task 시작, 이후에는 handler/콜백 전달만 함
    void loopTick();
 
    void onStateChange(StateChangeCB cb) { stateChangeCb_ = cb; }
@@ -163,6 +313,24 @@ class OrbiSyncNode {
    void onTunnelMessage(TunnelMessageCB cb) { tunnelMessageCb_ = cb; }
    void onHttpRequest(HttpRequestCallback cb) { httpRequestCb_ = cb; }
    void setHttpRequestHandler(HttpRequestCallback cb) { httpRequestCb_ = cb; }
+   /// 터널 요청 route 등록 (예: addRoute("GET", "/api/status", h)). prefix/method는 정적 문자열이어야 함
+   bool addRoute(const char* method, const char* pathPrefix, HttpRequestCallback handler);
+   /// Hub command handler 등록 (name은 정적 문자열). 같은 id는 한 번만 실행, 결과는 ack로 Hub에 전달
+   /// 터널이 없으면 HTTP heartbeat가 poll을 겸함 (enableCommandPolling: commandPollIntervalMs 주기)
+   bool addCommand(const char* name, CommandHandler handler);
+   /// 다음 할 일(hello/pair/approve/session/재연결/ping/heartbeat/deferred timeout/batch)까지 남은 ms. 0 = 지금
+   /// 터널/Hub HTTP 소켓이 열려 있으면 수신 확인을 위해 idleWaitMaxMs 이하
+   uint32_t nextWakeupMs() const;
+   /// 누적 metrics (heap/uptime/backoff는 호출 시점 값으로 갱신)
+   const Metrics& getMetrics();
+   /// subsystem별 static / heap / stack 사용량을 [MEM] 로그로 출력 (크기는 OrbiSyncLimits.h profile)
+   void logMemoryBudget();
+   /// 진행 중(deferred 포함)인 터널 응답을 stream_id로 찾기. 없으면 nullptr
+   TunnelHttpResponseWriter* findTunnelStream(const char* streamId);
+   /// 설정 시 터널 송신 frame을 WS 대신 cb로 보냄 (WS 연결 없이 동작). nullptr로 해제
+   void setTunnelTap(TunnelTapCB cb) { tunnelTapCb_ = cb; }
+   /// 수신 frame 주입 (WS 콜백과 같은 경로). binary frame은 payload를 제자리에서 수정함
+   void injectTunnelFrame(uint8_t* payload, size_t len, bool binary);
 
    State getState() const { return state_; }
    const char* getNodeId() const { return nodeId_; }
@@ -183,27 +351,52 @@ class OrbiSyncNode {
    void tunnelDisconnect();
    /// Hub에 register 요청 전송
    void tunnelSendRegister();
+   /// WS 연결됨 (owner): resume token으로 연결했으면 register 없이 바로 활성, 아니면 register 전송
+   void tunnelOnConnected();
 
    // ---- WebSocket 메시지 핸들러 ----
    void tunnelHandleMessage(const char* payload);                 /// 호환용
    void tunnelHandleMessage(const uint8_t* payload, size_t len);  /// 권장(복사/할당 없음)
    /// proxy_request 타입 메시지 처리
    void tunnelHandleProxyRequest(const uint8_t* payload, size_t len);
+   /// binary frame(WStype_BIN) 요청 처리
+   /// header 문자열은 payload 안에서 NUL 종료시킴 (WS 수신 버퍼, 콜백 동안 소유)
+   void tunnelHandleBinaryMessage(uint8_t* payload, size_t len);
 
    /// WebSocket으로 텍스트 전송
    bool tunnelSendText(const char* text);
+   /// 애플리케이션 이벤트(JSON) 전송. tunnelOutbox면 끊긴 동안 보관 후 재연결 시 전송 (보관도 true)
+   /// id: 같은 id가 보관 중이거나 최근 전송됐으면 버림 (nullptr = 중복 검사 없음)
+   /// persist: RAM이 가득 차면 LittleFS에 보관 (ORBISYNC_OUTBOX_SPILL, 토큰 등 비밀 없는 telemetry만)
+   bool sendTunnelEvent(const char* json, const char* id = nullptr, bool persist = false);
+   /// WS 연결됨 또는 tap 설정됨
+   bool tunnelTxReady() const;
+   /// WS(또는 tap)로 frame 하나 전송 (batch 거치지 않음)
+   bool tunnelWriteFrame(const uint8_t* data, size_t len, bool binary);
+   /// 모아 둔 송신 메시지 전송 (1개면 배열 없이 그대로)
+   bool tunnelFlushBatch();
+   /// loopTick 끝: 지연 한도가 지났으면 flush
+   void tunnelBatchTick(uint32_t now);
+   /// WebSocket으로 binary 전송
+   bool tunnelSendBinary(const uint8_t* data, size_t len);
    /// HTTP 응답 전송 (stream_id 매칭)
    void tunnelSendProxyResponse(TunnelHttpResponseWriter& res);
+   /// 스트리밍 응답 조각 전송 (proxy_response_chunk, 첫 조각에 status/headers 포함)
+   void tunnelSendProxyChunk(TunnelHttpResponseWriter& res, bool final);
+   /// loopTick core에서 end()/chunk flush → network task가 전송. 직접 보내도 되면 false
+   bool tunnelQueueWriterOp(TunnelHttpResponseWriter& w, bool end);
+   /// writer의 end(응답) 또는 chunk 전송. Hub flow window가 닫혀 있으면 보내지 않고 false (tunnelPollStreams가 이어서)
+   bool tunnelWriterSend(TunnelHttpResponseWriter& w);
  
   private:
    Config cfg_;
    State state_;
  
    char nodeId_[64];
-   char nodeToken_[256];
+   char nodeToken_[limits::kTokenBytes];
    char tunnelUrl_[256];
    char tunnelId_[64];
-   char sessionToken_[256];
+   char sessionToken_[limits::kTokenBytes];
  
    static constexpr size_t kPairingCodeMax = 32;
    char pairingCode_[kPairingCodeMax];
@@ -224,11 +417,28 @@ class OrbiSyncNode {
    uint8_t  tunnelBackoffIndex_;
    uint32_t lastTunnelPingMs_;
    bool tunnelRegistered_;
+   /// register_ack의 resume_token (RAM only). 재연결 시 WS upgrade header로 제시
+   char resumeToken_[128];
+   uint32_t resumeExpiresMs_;   /// 0 = Hub가 만료를 알려주지 않음
+   bool resumePresented_;       /// 현재 연결을 resume token으로 열었음
+   bool tunnelFastRetryUsed_;   /// graceful close 후 즉시 재시도를 이미 씀 (등록되면 초기화)
    bool approveMissingMacFailed_;
  
    uint32_t lastHeartbeatMs_;
    bool wifiConnecting_;
-   bool httpBusy_;
+   uint32_t lastTunnelStatusLogMs_;
+   uint32_t lastTunnelSkipLogMs_;
+   uint8_t memoryReportStage_;  /// Config::memoryReport: 0 = 아직, 1 = 시작 때 출력, 2 = 첫 등록 후 출력
+
+   /// cfg_.hubBaseUrl 파싱 결과 (요청마다 다시 파싱하지 않음)
+   ParsedBaseUrl hubUrl_;
+   bool hubUrlValid_;
+
+   /// 진행 중인 Hub HTTP 요청 (요청 slot은 하나, 완료 시 해당 handle*Response 호출)
+   enum class HttpOp : uint8_t { NONE, HELLO, PAIR, APPROVE, SESSION, REGISTER_BY_SLOT, HEARTBEAT };
+   HttpOp httpOp_;
+   /// 공유 Hub HTTP slot을 이 노드 또는 다른 노드(asyncHttp)가 쓰는 중
+   bool httpBusy() const;
  
    StateChangeCB stateChangeCb_;
    ErrorCB errorCb_;
@@ -236,11 +446,80 @@ class OrbiSyncNode {
    TunnelChangeCB tunnelChangeCb_;
    RequestHandler requestHandler_;
    TunnelMessageCB tunnelMessageCb_;
+   TunnelTapCB tunnelTapCb_;
    HttpRequestCallback httpRequestCb_;
+
+   TunnelRoute routes_[ORBISYNC_MAX_ROUTES];
+   uint8_t routeCount_;
+   HttpRequestCallback findRoute(const char* method, const char* path) const;
+
+   // ---- Hub command (poll: heartbeat/session 응답, push: 터널 메시지) ----
+   CommandRoute commands_[ORBISYNC_MAX_COMMANDS];
+   uint8_t commandCount_;
+   SpscQueue<CommandSlot, ORBISYNC_COMMAND_QUEUE> cmdInbox_;    /// network → loopTick (handler 실행 대기)
+   SpscQueue<CommandAck, ORBISYNC_COMMAND_QUEUE * 2> cmdAcks_;  /// loopTick → network (실행 결과)
+   CommandAck cmdAckPending_[ORBISYNC_COMMAND_QUEUE * 2];        /// network 쪽: 다음 poll / 전송 대기 ack
+   uint8_t cmdAckPendingCount_;
+   uint8_t cmdAckInFlight_;   /// 진행 중인 heartbeat에 실은 ack 수 (2xx면 앞에서부터 제거)
+   uint32_t cmdRecent_[8];    /// 최근 받은 command id hash (재전송이면 다시 실행하지 않음)
+   uint8_t cmdRecentResult_[8];  /// 위 id의 결과 (실행 중이면 0xFF). 끝난 command 재전송엔 같은 결과로 다시 ack
+   uint8_t cmdRecentPos_;
+   /// s_hubRxDoc["commands"] (fromTunnel=false) 또는 현재 터널 메시지에서 command 추출 → inbox
+   void commandIngest(bool fromTunnel);
+   void commandAccept(const CommandSlot& c, bool argsFit);
+   /// network 쪽에서 바로 ack (중복 / inbox 가득 / args 초과)
+   void commandAckNow(const char* id, uint8_t result);
+   /// loopTick: inbox → handler → ack queue
+   void commandRun();
+   /// network: ack → 터널 전송 (등록 중) 또는 다음 heartbeat 대기열
+   void commandPumpAcks();
+   bool commandSendAck(const CommandAck& a);
+   /// heartbeat body 끝 '}' 앞에 "acks" 배열 추가. 반환: 새 길이
+   size_t commandAppendAcks(char* out, size_t cap, size_t n);
+   void commandAcksDelivered(bool ok);
+   /// HTTP heartbeat 주기 (터널이 없고 enableCommandPolling이면 commandPollIntervalMs와 짧은 쪽)
+   uint32_t heartbeatPeriodMs() const;
+
+   Metrics metrics_;
+   uint32_t pingSentMs_;  /// 응답 대기 중인 ping 전송 시각 (0 = 없음)
+   uint16_t outboxPending_; /// outbox에 있는 이 노드의 미전송 메시지 수 (있으면 새 메시지도 뒤에 줄 섬)
+   HubEndpointMetrics* hubMetrics(HttpOp op);
+   uint32_t httpHeaderTimeoutFor(HttpOp op) const;
+
+   TunnelHttpResponseWriter streams_[ORBISYNC_TUNNEL_MAX_STREAMS];
+   TunnelHttpResponseWriter* tunnelAcquireStream(const char* id, uint8_t format, bool binary, bool idNumeric);
+   void tunnelSendBusy(const char* id, uint8_t format, bool binary, bool idNumeric);
+   void tunnelPollStreams();
+   void tunnelReleaseStreams();
+   /// route/onRequest/onHttpRequest/LED/404 (task mode면 loopTick core에서 실행)
+   void tunnelServeHandlers(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res,
+                            const char* method, const char* path);
+
+   // ---- 사용자 콜백 전달 (task mode: network task에서 queue → loopTick에서 호출) ----
+   void emitStateChange(State old, State s);
+   void emitError(const char* msg);  /// msg는 정적 문자열 (queue에 포인터만 보관)
+   void emitRegistered();
+   void emitTunnelChange(bool connected);
+
+#if ORBISYNC_TASK_MODE
+   void* netTask_;                /// TaskHandle_t (공개 헤더에 FreeRTOS 의존성을 두지 않음)
+   volatile bool handoffActive_;  /// loopTick이 넘겨받은 요청 실행 중 (network task는 대기)
+   static void taskEntry(void* arg);
+   void taskStart();
+   void taskUserTick();
+   void taskNetworkTick();
+   void taskDrainWriterOps();
+   bool taskOnNetworkSide() const;
+   /// network task → loopTick으로 요청 전달 후 완료(또는 timeout 504)까지 대기. 넘기지 않았으면 false
+   bool taskHandoffRequest(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res,
+                           const char* method, const char* path);
+#endif
  
    // ---- 내부 상태 관리 ----
    void setState(State s);
    void ensureWiFi();
+   /// Config::idleWait: ms 동안 대기. Hub HTTP 응답이 도착하거나 task mode writer op가 오면 일찍 깸
+   void idleWaitFor(uint32_t ms);
    void runStateMachine();
 
    // ---- Hub API 호출 ----
@@ -248,11 +527,48 @@ class OrbiSyncNode {
    void handleHelloResponse(int status, const char* body, size_t len);
    void tryPairIfNeeded();
    bool postDevicePair(const char* code, int* outStatus, char* outBody, size_t outBodyMax);
+   void handlePairResponse(int status, char* body, size_t len);
    void tryApprove();
+   void handleApproveResponse(int status, char* body, size_t len);
    void trySessionPoll();
+   void handleSessionResponse(int status, char* body, size_t len);
    void tryRegisterBySlot();
+   void handleRegisterBySlotResponse(int status, char* body, size_t len);
+   void handleHeartbeatResponse(int status, char* body, size_t len);
+   /// heartbeat JSON 객체 직렬화 (HTTP body / 터널 ping 공용). 반환: 길이, 실패 시 0
+   size_t buildHeartbeatJson(char* out, size_t cap, uint32_t now);
+   bool heartbeatDue(uint32_t now) const;
+   // ---- 요청 body 템플릿 (처음 사용 시 한 번 직렬화, 이후 nonce 등 slot만 갱신) ----
+   /// 노드별 보관: 공유 연결의 노드들이 번갈아 보내도 다시 만들지 않음. len 0 = 미생성
+   struct PayloadTemplates {
+     char hello[512];
+     char session[256];
+     char heartbeat[256];  /// 닫는 '}' 없는 prefix (metrics 요약을 뒤에 붙임)
+     char reg[320];        /// 닫는 '}' 없는 prefix (node_id/auth_token을 뒤에 붙임)
+     uint16_t helloLen;
+     uint16_t sessionLen;
+     uint16_t heartbeatLen;
+     uint16_t registerLen;
+     uint16_t helloNonceOff;
+     uint16_t sessionNonceOff;
+     uint16_t hbNonceOff;
+     uint16_t hbUptimeOff;
+     uint16_t hbHeapOff;
+     uint16_t hbRssiOff;
+     bool registerJoined;  /// 합류 노드용으로 만듦 (binary_frames 없음)
+   };
+   PayloadTemplates tpl_;
+   bool buildHelloTemplate();
+   bool buildSessionTemplate();
+   bool buildHeartbeatTemplate();
+   bool buildRegisterTemplate();
+   /// bearer != nullptr 이면 "Authorization: Bearer <bearer>" 헤더 추가
    bool postJsonUnified(const char* path, const char* body, int* outStatus,
-                        char* outBody, size_t outBodyMax);
+                        char* outBody, size_t outBodyMax, const char* bearer = nullptr);
+   /// asyncHttp: 요청 시작만 하고 반환 (완료는 pumpHttp → handle*Response)
+   bool startJsonUnified(HttpOp op, const char* path, const char* body,
+                         char* outBody, size_t outBodyMax, const char* bearer = nullptr);
+   void pumpHttp();
 
    // ---- 유틸리티 ----
    const char* getMacCStr();
@@ -268,9 +584,47 @@ class OrbiSyncNode {
    void advancePairBackoff();
    void resetNetBackoff();
    void resetPairBackoff();
+   /// millis() + delayMs (±scheduleJitterPct). delayMs == 0이면 즉시
+   uint32_t jitterAt(uint32_t delayMs) const;
+   /// HTTP 429/503: Retry-After(없으면 net backoff) 후로 nextMs 설정
+   bool hubThrottled(int status, uint32_t& nextMs, const char* tag);
+
+   /// 응답/이벤트 전송: 보낼 수 없거나 outbox에 먼저 온 메시지가 있으면 outbox로 (id 0 = 중복 검사 없음)
+   bool tunnelSendOrQueue(const uint8_t* data, size_t len, bool binary, uint32_t id);
+   /// register_ack 후 / tunnelLoop: 이 노드의 outbox 메시지를 순서대로 최대 maxMsgs개 전송
+   void outboxDrain(uint8_t maxMsgs);
+   /// sendTunnelEvent 본체 (network 쪽에서 실행)
+   bool tunnelEventSend(const char* json, uint32_t id, bool persist);
+   /// 미전송 batch를 outbox로 옮김 (끊김/전송 실패 시 버리지 않음). 옮겼으면 true
+   bool tunnelBatchToOutbox();
 
    /// 터널 연결 종료 후 정리 (상태/백오프/콜백만, 포인터 삭제 없음)
-   void tunnelDisconnectCleanup();
+   /// graceful: Hub가 정상 종료(close 1000/1001/1012 또는 goaway) → 첫 재시도는 지연 없이
+   void tunnelDisconnectCleanup(bool graceful = false);
+   /// register_ack ok / resume 연결: TUNNEL_CONNECTED로 전환, backoff 초기화, outbox 전송
+   void tunnelMarkRegistered();
+   /// resume 거절: token 폐기 후 같은 연결에서 전체 register
+   void tunnelResumeRejected(const char* reason);
+   /// 공유 WS 연결 종료: client 반환 후 연결에 있던 모든 노드 정리
+   void tunnelLinkClose();
+   /// 다른 노드가 연 연결에 합류 (tunnelMultiplex, 같은 tunnel_url, owner 등록 완료). 합류했으면 true
+   bool tunnelLinkJoin();
+   /// 파싱된 수신 frame을 type별 핸들러로 분기
+   void tunnelDispatchMessage(const uint8_t* payload, size_t len);
+   /// 수신 문서 크기 초과 frame에 413 응답
+   void tunnelRejectOversized(const uint8_t* payload, size_t len);
+   /// proxy_response / proxy_response_chunk frame 직렬화 + 전송
+   bool tunnelSendProxyFrame(TunnelHttpResponseWriter& res, bool chunk, bool final);
+   bool tunnelSendBinaryFrame(TunnelHttpResponseWriter& res, bool chunk, bool final);
+   void tunnelSendEnvelopeResponse(TunnelHttpResponseWriter& res);
+   /// 첫 frame이면 압축 여부 결정 (Content-Encoding header 추가). true = 이 frame body를 압축
+   bool tunnelCompressBegin(TunnelHttpResponseWriter& res, bool chunk);
+   /// res.body_ → out (deflateBound(bodyLen_) 바이트). 반환: 압축 길이
+   size_t tunnelCompressBody(TunnelHttpResponseWriter& res, uint8_t* out, bool final);
+   /// Content-Encoding 요청 body 해제. false = 오류 응답(400/413/415)을 보냄
+   bool tunnelInflateRequest(TunnelHttpRequest& req, bool binary);
+   /// 파싱된 터널 HTTP 요청 처리 (JSON/binary 공용)
+   void tunnelServeHttpRequest(const TunnelHttpRequest& req, TunnelHttpResponseWriter& res);
 
    /// Hub에 heartbeat 전송
    void tryHeartbeat();
@@ -0,0 +1,56 @@
+/**
+ * @file   OrbiSyncQueue.h
+ * @brief  고정 크기 single-producer/single-consumer queue (lock 없음)
+ * @details
+ * - 생산자 하나(push), 소비자 하나(pop)만 사용. 각 index는 한쪽만 씀
+ * - head/tail은 GCC __atomic builtin (acquire/release), 할당 없음
+ * - ESP32 task mode에서 network task ↔ loopTick core 사이 전달용
+ */
+ #ifndef ORBISYNC_QUEUE_H
+ #define ORBISYNC_QUEUE_H
+
+ #include <stdint.h>
+ #include <stddef.h>
+
+namespace OrbiSyncNode {
+
+/// N: 최대 보관 개수 (1~254). 실제 배열은 N+1 (가득/빈 구분용 빈 칸 하나)
+template <typename T, uint8_t N>
+class SpscQueue {
+ public:
+  SpscQueue() : head_(0), tail_(0) {}
+
+  /// 생산자 전용. 가득 차면 false
+  bool push(const T& v) {
+    uint8_t h = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    uint8_t next = advance(h);
+    if (next == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE)) return false;
+    items_[h] = v;
+    __atomic_store_n(&head_, next, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  /// 소비자 전용. 비어 있으면 false
+  bool pop(T& out) {
+    uint8_t t = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+    if (t == __atomic_load_n(&head_, __ATOMIC_ACQUIRE)) return false;
+    out = items_[t];
+    __atomic_store_n(&tail_, advance(t), __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool empty() const {
+    return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) == __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+  }
+
+ private:
+  static uint8_t advance(uint8_t i) { return (uint8_t)(i + 1 == N + 1 ? 0 : i + 1); }
+
+  T items_[N + 1];
+  uint8_t head_;  /// 생산자만 씀
+  uint8_t tail_;  /// 소비자만 씀
+};
+
+} // namespace OrbiSyncNode
+
+#endif